@@ -0,0 +1,797 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+
+#include "jpeg_encoder.h"
+
+// 编码器的性能测试。输入是固定种子生成的合成图像，每次运行的输入完全相同，
+// 输出为JSON，可以保存下来与其他版本的结果比较
+
+namespace {
+//-------------------------------------------------------------------------------
+//测试图像的尺寸
+const int Bench_Sizes[][2] = { { 512, 512 }, { 1920, 1080 }, { 3840, 2160 } };
+const int BENCH_SIZE_COUNT = sizeof(Bench_Sizes) / sizeof(Bench_Sizes[0]);
+
+//测试的质量(encode的quality_scale，越大压缩越多)和抽样方式
+const int Bench_Qualities[] = { 25, 75 };
+const int BENCH_QUALITY_COUNT = sizeof(Bench_Qualities) / sizeof(Bench_Qualities[0]);
+
+const JpegEncoder::Subsampling Bench_Subsamplings[] = { JpegEncoder::SUBSAMPLE_444, JpegEncoder::SUBSAMPLE_420 };
+const char* const Bench_Subsampling_Names[] = { "4:4:4", "4:2:0" };
+const int BENCH_SUBSAMPLING_COUNT = 2;
+
+//trellis量化的lambda，在第一种尺寸上与普通量化比较相同PSNR时的文件大小。
+//渐变图像在质量75时AC系数很少，lambda到0.003左右就只剩DC，再大的值结果都相同，所以只有最后一个超过它
+const float Bench_Lambdas[] = { 0.001f, 0.002f, 0.01f };
+const int BENCH_LAMBDA_COUNT = sizeof(Bench_Lambdas) / sizeof(Bench_Lambdas[0]);
+
+//-------------------------------------------------------------------------------
+double _now(void)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//-------------------------------------------------------------------------------
+//固定种子的xorshift随机数，保证每次生成的图像相同
+struct BenchRandom
+{
+	unsigned int state;
+
+	explicit BenchRandom(unsigned int seed) : state(seed) {}
+	unsigned int next(void)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+};
+
+//-------------------------------------------------------------------------------
+unsigned char _clamp(int value)
+{
+	return (unsigned char)(value<0 ? 0 : (value>255 ? 255 : value));
+}
+
+//-------------------------------------------------------------------------------
+//测试图像，BGR格式，自上而下存放
+struct BenchImage
+{
+	const char*					name;
+	int							width;
+	int							height;
+	std::vector<unsigned char>	pixels;
+};
+
+//-------------------------------------------------------------------------------
+//三个通道方向各不相同的线性渐变，几乎全部是低频
+void _make_gradient(BenchImage& image)
+{
+	int w = image.width, h = image.height;
+	for(int y=0; y<h; y++)
+	{
+		unsigned char* row = &image.pixels[(size_t)y * w * 3];
+		for(int x=0; x<w; x++)
+		{
+			row[x*3 + 0] = (unsigned char)((x + y) * 255 / (w + h - 2));
+			row[x*3 + 1] = (unsigned char)(y * 255 / (h - 1));
+			row[x*3 + 2] = (unsigned char)(x * 255 / (w - 1));
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+//均匀分布的白噪声，熵编码最慢的情况
+void _make_noise(BenchImage& image)
+{
+	BenchRandom random(12345);
+	for(size_t i=0; i<image.pixels.size(); i++) image.pixels[i] = (unsigned char)(random.next() >> 24);
+}
+
+//-------------------------------------------------------------------------------
+//模拟照片：平滑的低频背景，上面叠加一些边缘清晰的色块，再加上少量颗粒噪声
+void _make_photo(BenchImage& image)
+{
+	int w = image.width, h = image.height;
+	BenchRandom random(67890);
+
+	for(int y=0; y<h; y++)
+	{
+		unsigned char* row = &image.pixels[(size_t)y * w * 3];
+		for(int x=0; x<w; x++)
+		{
+			double u = (double)x / w, v = (double)y / h;
+			row[x*3 + 0] = _clamp((int)(110 + 60*sin(u*7.0 + 1.0) + 40*cos(v*5.0)));
+			row[x*3 + 1] = _clamp((int)(120 + 50*sin((u + v)*6.0) + 30*sin(u*23.0)*cos(v*17.0)));
+			row[x*3 + 2] = _clamp((int)(130 + 70*cos(u*3.0 - v*4.0)));
+		}
+	}
+
+	//按图像面积放置圆形色块，大小和颜色随机
+	int count = (int)((long long)w * h / 20000) + 8;
+	for(int i=0; i<count; i++)
+	{
+		int cx = (int)(random.next() % w), cy = (int)(random.next() % h);
+		int r = (int)(random.next() % (w/8 + 1)) + 4;
+		unsigned char b = (unsigned char)random.next(), g = (unsigned char)random.next(), red = (unsigned char)random.next();
+		for(int y=(cy-r>0 ? cy-r : 0); y<=cy+r && y<h; y++)
+		{
+			unsigned char* row = &image.pixels[(size_t)y * w * 3];
+			for(int x=(cx-r>0 ? cx-r : 0); x<=cx+r && x<w; x++)
+			{
+				if((x-cx)*(x-cx) + (y-cy)*(y-cy) > r*r) continue;
+				row[x*3 + 0] = b;
+				row[x*3 + 1] = g;
+				row[x*3 + 2] = red;
+			}
+		}
+	}
+
+	for(size_t i=0; i<image.pixels.size(); i++)
+		image.pixels[i] = _clamp(image.pixels[i] + (int)(random.next() % 9) - 4);
+}
+
+//-------------------------------------------------------------------------------
+//模拟文档或截图：白色背景上一行行黑色的文字，中间有表格线，顶部有一条彩色的标题栏，大部分块都是纯色的
+void _make_document(BenchImage& image)
+{
+	int w = image.width, h = image.height;
+	BenchRandom random(24680);
+	memset(&image.pixels[0], 255, image.pixels.size());
+
+	//标题栏
+	int header = h / 12;
+	for(int y=0; y<header; y++)
+	{
+		unsigned char* row = &image.pixels[(size_t)y * w * 3];
+		for(int x=0; x<w; x++)
+		{
+			row[x*3 + 0] = 160;
+			row[x*3 + 1] = 90;
+			row[x*3 + 2] = 40;
+		}
+	}
+
+	//文字行：每个字7*11个像素，由随机的横竖笔画组成，字之间有空格，每5行之后画一条横线
+	int margin = w / 16;
+	for(int line=0, top=header + 24; top + 11 < h; line++, top += 20)
+	{
+		if(line % 5 == 4)
+		{
+			unsigned char* row = &image.pixels[(size_t)(top + 5) * w * 3];
+			for(int x=margin; x<w-margin; x++) row[x*3 + 0] = row[x*3 + 1] = row[x*3 + 2] = 128;
+			continue;
+		}
+
+		int end = w - margin - (int)(random.next() % (w/3 + 1));
+		for(int x=margin; x+7<end; x+=8)
+		{
+			if(random.next() % 6 == 0) continue;
+			unsigned int strokes = random.next();
+			for(int k=0; k<4; k++)
+			{
+				if(!((strokes >> k) & 1)) continue;
+				//k为0、1时是竖笔画，2、3时是横笔画
+				int sx = k<2 ? x + 1 + k*4 : x, sy = k<2 ? top : top + 2 + (k-2)*6;
+				int sw = k<2 ? 2 : 7, sh = k<2 ? 11 : 2;
+				for(int y=sy; y<sy+sh; y++)
+				{
+					unsigned char* row = &image.pixels[(size_t)y * w * 3];
+					for(int i=sx; i<sx+sw; i++) row[i*3 + 0] = row[i*3 + 1] = row[i*3 + 2] = 20;
+				}
+			}
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+// 基线JPEG的参考解码器，只用于计算PSNR。与编码器不共用任何代码，支持本工程输出的所有基线格式
+// (4:4:4/4:2:2/4:2:0、复位间隔)，IDCT直接按定义用浮点计算
+class BenchDecoder
+{
+public:
+	/** 解码为BGR，失败时返回false */
+	bool decode(const unsigned char* data, int size, std::vector<unsigned char>& bgr, int& width, int& height);
+
+private:
+	struct Huffman
+	{
+		int				minCode[17];
+		int				maxCode[18];
+		int				valuePtr[17];
+		unsigned char	values[256];
+	};
+	struct Component
+	{
+		int		id;
+		int		h;
+		int		v;
+		int		quant;
+		int		dcTable;
+		int		acTable;
+		int		prevDC;
+		std::vector<unsigned char>	plane;
+		int		planeWidth;
+	};
+
+	bool _parseHuffman(const unsigned char* p, int length);
+	int _bit(void);
+	int _receive(int length);
+	int _decodeSymbol(const Huffman& table);
+	bool _decodeBlock(Component& component, unsigned char* out, int stride);
+	void _idct(const float* coef, unsigned char* out, int stride);
+	bool _restart(void);
+
+private:
+	unsigned short	m_quant[4][64];
+	Huffman			m_huffman[2][4];
+	Component		m_components[3];
+	int				m_componentCount;
+	int				m_width;
+	int				m_height;
+	int				m_restartInterval;
+
+	const unsigned char*	m_ptr;
+	const unsigned char*	m_end;
+	unsigned int			m_buffer;
+	int						m_bits;
+	bool					m_error;
+};
+
+//-------------------------------------------------------------------------------
+bool BenchDecoder::_parseHuffman(const unsigned char* p, int length)
+{
+	const unsigned char* end = p + length;
+	while(p < end)
+	{
+		int tableClass = p[0] >> 4, id = p[0] & 15;
+		if(tableClass>1 || id>3) return false;
+		Huffman& table = m_huffman[tableClass][id];
+
+		const unsigned char* counts = p + 1;
+		int total = 0;
+		for(int i=0; i<16; i++) total += counts[i];
+		if(total>256 || p + 17 + total > end) return false;
+		memcpy(table.values, p + 17, total);
+
+		//标准附录F.2.2.3的解码表
+		int code = 0, k = 0;
+		for(int len=1; len<=16; len++)
+		{
+			table.valuePtr[len] = k;
+			table.minCode[len] = code;
+			code += counts[len-1];
+			k += counts[len-1];
+			table.maxCode[len] = counts[len-1] ? code - 1 : -1;
+			code <<= 1;
+		}
+		table.maxCode[17] = 0x7FFFFFFF;
+		p += 17 + total;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+int BenchDecoder::_bit(void)
+{
+	if(m_bits==0)
+	{
+		//遇到标记时不再前进，之后读到的都是0
+		unsigned char byte = 0;
+		if(m_ptr < m_end && !(m_ptr[0]==0xFF && m_ptr + 1 < m_end && m_ptr[1]!=0x00))
+		{
+			byte = *m_ptr++;
+			if(byte==0xFF) m_ptr++;
+		}
+		else
+		{
+			m_error = m_error || m_ptr >= m_end;
+		}
+		m_buffer = byte;
+		m_bits = 8;
+	}
+	m_bits--;
+	return (m_buffer >> m_bits) & 1;
+}
+
+//-------------------------------------------------------------------------------
+int BenchDecoder::_receive(int length)
+{
+	int value = 0;
+	for(int i=0; i<length; i++) value = (value << 1) | _bit();
+	//最高位为0的是负数
+	if(length>0 && value < (1 << (length-1))) value -= (1 << length) - 1;
+	return value;
+}
+
+//-------------------------------------------------------------------------------
+int BenchDecoder::_decodeSymbol(const Huffman& table)
+{
+	int code = _bit();
+	int len = 1;
+	while(code > table.maxCode[len])
+	{
+		code = (code << 1) | _bit();
+		if(++len > 16)
+		{
+			m_error = true;
+			return 0;
+		}
+	}
+	return table.values[table.valuePtr[len] + code - table.minCode[len]];
+}
+
+//-------------------------------------------------------------------------------
+bool BenchDecoder::_decodeBlock(Component& component, unsigned char* out, int stride)
+{
+	short zz[64];
+	memset(zz, 0, sizeof(zz));
+
+	int length = _decodeSymbol(m_huffman[0][component.dcTable]);
+	component.prevDC += _receive(length);
+	zz[0] = (short)component.prevDC;
+
+	for(int k=1; k<64; )
+	{
+		int rs = _decodeSymbol(m_huffman[1][component.acTable]);
+		int run = rs >> 4, size = rs & 15;
+		if(size==0)
+		{
+			if(run!=15) break;
+			k += 16;
+			continue;
+		}
+		k += run;
+		if(k>63) return false;
+		zz[k++] = (short)_receive(size);
+	}
+
+	float coef[64];
+	const unsigned short* quant = m_quant[component.quant];
+	for(int i=0; i<64; i++) coef[i] = (float)(zz[jpeg_zigzag[i]] * quant[jpeg_zigzag[i]]);
+	_idct(coef, out, stride);
+	return !m_error;
+}
+
+//-------------------------------------------------------------------------------
+void BenchDecoder::_idct(const float* coef, unsigned char* out, int stride)
+{
+	static float table[8][8];
+	static bool initialized = false;
+	if(!initialized)
+	{
+		for(int x=0; x<8; x++)
+		{
+			for(int u=0; u<8; u++)
+				table[x][u] = (float)((u==0 ? sqrt(0.5) : 1.0) * 0.5 * cos((2*x + 1) * u * 3.14159265358979323846 / 16));
+		}
+		initialized = true;
+	}
+
+	//先对每一行做一维变换，再对每一列
+	float temp[64];
+	for(int v=0; v<8; v++)
+	{
+		for(int x=0; x<8; x++)
+		{
+			float sum = 0;
+			for(int u=0; u<8; u++) sum += table[x][u] * coef[v*8 + u];
+			temp[v*8 + x] = sum;
+		}
+	}
+	for(int y=0; y<8; y++)
+	{
+		for(int x=0; x<8; x++)
+		{
+			float sum = 0;
+			for(int v=0; v<8; v++) sum += table[y][v] * temp[v*8 + x];
+			out[y*stride + x] = _clamp((int)floor(sum + 128.5f));
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+bool BenchDecoder::_restart(void)
+{
+	m_bits = 0;
+	if(m_ptr + 1 >= m_end || m_ptr[0]!=0xFF || (m_ptr[1] & 0xF8)!=0xD0) return false;
+	m_ptr += 2;
+	for(int i=0; i<m_componentCount; i++) m_components[i].prevDC = 0;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool BenchDecoder::decode(const unsigned char* data, int size, std::vector<unsigned char>& bgr, int& width, int& height)
+{
+	const unsigned char* p = data;
+	const unsigned char* end = data + size;
+	m_componentCount = 0;
+	m_restartInterval = 0;
+	m_width = m_height = 0;
+
+	if(size<4 || p[0]!=0xFF || p[1]!=0xD8) return false;
+	p += 2;
+
+	//读取SOS之前的所有段
+	for(;;)
+	{
+		if(p + 4 > end || p[0]!=0xFF) return false;
+		int marker = p[1];
+		int length = (p[2] << 8) | p[3];
+		const unsigned char* segment = p + 4;
+		if(segment + length - 2 > end) return false;
+		p += 2 + length;
+
+		if(marker==0xDB)
+		{
+			for(const unsigned char* q=segment; q<segment + length - 2; q+=65)
+			{
+				if((q[0] >> 4)!=0) return false;
+				for(int i=0; i<64; i++) m_quant[q[0] & 3][i] = q[1 + i];
+			}
+		}
+		else if(marker==0xC4)
+		{
+			if(!_parseHuffman(segment, length - 2)) return false;
+		}
+		else if(marker==0xC0)
+		{
+			m_height = (segment[1] << 8) | segment[2];
+			m_width = (segment[3] << 8) | segment[4];
+			m_componentCount = segment[5];
+			if(m_componentCount!=3) return false;
+			for(int i=0; i<3; i++)
+			{
+				m_components[i].id = segment[6 + i*3];
+				m_components[i].h = segment[7 + i*3] >> 4;
+				m_components[i].v = segment[7 + i*3] & 15;
+				m_components[i].quant = segment[8 + i*3] & 3;
+			}
+		}
+		else if(marker==0xDD)
+		{
+			m_restartInterval = (segment[0] << 8) | segment[1];
+		}
+		else if(marker==0xDA)
+		{
+			//只支持包含所有分量的一次扫描
+			if(segment[0]!=m_componentCount) return false;
+			for(int i=0; i<m_componentCount; i++)
+			{
+				if(segment[1 + i*2]!=m_components[i].id) return false;
+				m_components[i].dcTable = segment[2 + i*2] >> 4;
+				m_components[i].acTable = segment[2 + i*2] & 15;
+			}
+			break;
+		}
+		else if(marker>=0xC1 && marker<=0xCF && marker!=0xC4 && marker!=0xC8 && marker!=0xCC)
+		{
+			return false;
+		}
+	}
+	if(m_componentCount==0) return false;
+
+	int hMax = 1, vMax = 1;
+	for(int i=0; i<m_componentCount; i++)
+	{
+		if(m_components[i].h > hMax) hMax = m_components[i].h;
+		if(m_components[i].v > vMax) vMax = m_components[i].v;
+	}
+	int mcusPerLine = (m_width + hMax*8 - 1) / (hMax*8);
+	int mcuRows = (m_height + vMax*8 - 1) / (vMax*8);
+	for(int i=0; i<m_componentCount; i++)
+	{
+		Component& c = m_components[i];
+		c.planeWidth = mcusPerLine * c.h * 8;
+		c.plane.assign((size_t)c.planeWidth * mcuRows * c.v * 8, 0);
+		c.prevDC = 0;
+	}
+
+	m_ptr = p;
+	m_end = end;
+	m_bits = 0;
+	m_error = false;
+
+	for(int mcu=0; mcu<mcusPerLine*mcuRows; mcu++)
+	{
+		if(m_restartInterval>0 && mcu>0 && mcu%m_restartInterval==0 && !_restart()) return false;
+
+		int mx = mcu % mcusPerLine, my = mcu / mcusPerLine;
+		for(int i=0; i<m_componentCount; i++)
+		{
+			Component& c = m_components[i];
+			for(int by=0; by<c.v; by++)
+			{
+				for(int bx=0; bx<c.h; bx++)
+				{
+					unsigned char* out = &c.plane[(size_t)((my*c.v + by)*8) * c.planeWidth + (mx*c.h + bx)*8];
+					if(!_decodeBlock(c, out, c.planeWidth)) return false;
+				}
+			}
+		}
+	}
+
+	//色度按最近的样本放大，转换为BGR
+	width = m_width;
+	height = m_height;
+	bgr.resize((size_t)m_width * m_height * 3);
+	for(int y=0; y<m_height; y++)
+	{
+		for(int x=0; x<m_width; x++)
+		{
+			float ycc[3];
+			for(int i=0; i<3; i++)
+			{
+				const Component& c = m_components[i];
+				ycc[i] = c.plane[(size_t)(y * c.v / vMax) * c.planeWidth + x * c.h / hMax];
+			}
+			unsigned char* pixel = &bgr[((size_t)y * m_width + x) * 3];
+			pixel[0] = _clamp((int)floor(ycc[0] + 1.772f*(ycc[1] - 128) + 0.5f));
+			pixel[1] = _clamp((int)floor(ycc[0] - 0.344136f*(ycc[1] - 128) - 0.714136f*(ycc[2] - 128) + 0.5f));
+			pixel[2] = _clamp((int)floor(ycc[0] + 1.402f*(ycc[2] - 128) + 0.5f));
+		}
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+double _psnr(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b)
+{
+	if(a.size()!=b.size() || a.empty()) return 0;
+
+	double sum = 0;
+	for(size_t i=0; i<a.size(); i++)
+	{
+		double d = (double)a[i] - b[i];
+		sum += d*d;
+	}
+	double mse = sum / a.size();
+	return mse>0 ? 10*log10(255.0*255.0/mse) : 99.0;
+}
+
+//-------------------------------------------------------------------------------
+//一次测试的结果，时间都是毫秒，取repeat次中最快的一次，各阶段的时间来自这一次编码的JpegEncodeStats
+struct BenchResult
+{
+	double			totalMs;		//整个encode
+	int				bytes;
+	double			psnr;
+	JpegEncodeStats	stats;
+};
+
+//-------------------------------------------------------------------------------
+bool _bench_one(const BenchImage& image, int quality, JpegEncoder::Subsampling mode, int repeat, BenchResult& result)
+{
+	JpegEncoder encoder;
+	encoder.setSubsampling(mode);
+
+	std::vector<unsigned char> buffer((size_t)image.width * image.height * 3 + 4096);
+	JpegBufferOutput output(&buffer[0], (int)buffer.size());
+
+	//第一次编码预热，同时用来计算PSNR
+	if(!encoder.encode(&image.pixels[0], image.width, image.height, image.width*3, JPEG_PIXEL_BGR, quality, output))
+		return false;
+	result.bytes = output.size();
+
+	std::vector<unsigned char> decoded;
+	int width = 0, height = 0;
+	BenchDecoder decoder;
+	if(!decoder.decode(&buffer[0], output.size(), decoded, width, height)) return false;
+	if(width!=image.width || height!=image.height) return false;
+	result.psnr = _psnr(image.pixels, decoded);
+
+	result.totalMs = 1e30;
+	for(int r=0; r<repeat; r++)
+	{
+		output.reset();
+		double start = _now();
+		encoder.encode(&image.pixels[0], image.width, image.height, image.width*3, JPEG_PIXEL_BGR, quality, output);
+		double ms = (_now() - start) * 1000;
+		if(ms < result.totalMs)
+		{
+			result.totalMs = ms;
+			result.stats = encoder.stats();
+		}
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+//编码一次并解码，得到文件大小、PSNR和编码时间
+bool _encode_once(JpegEncoder& encoder, const BenchImage& image, int quality, int& bytes, double& psnr, double& ms)
+{
+	//质量很高时噪声图像的文件可能比原始像素还大，用可以增长的vector
+	std::vector<unsigned char> buffer;
+	JpegVectorOutput output(buffer);
+
+	double start = _now();
+	if(!encoder.encode(&image.pixels[0], image.width, image.height, image.width*3, JPEG_PIXEL_BGR, quality, output))
+		return false;
+	ms = (_now() - start) * 1000;
+	bytes = (int)buffer.size();
+
+	std::vector<unsigned char> decoded;
+	int width = 0, height = 0;
+	BenchDecoder decoder;
+	if(!decoder.decode(&buffer[0], (int)buffer.size(), decoded, width, height)) return false;
+	psnr = _psnr(image.pixels, decoded);
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+//普通量化达到target的PSNR最少要多少字节：在quality_scale为1~99的曲线上线性插值，
+//曲线不一定单调，取所有达到target的点中最小的。target不在曲线的PSNR范围内时无法在相同PSNR下比较，返回0：
+//高于最好的质量时普通量化达不到，低于最差的质量(99)时只能拿PSNR更高、文件更大的点来比，省下的比例会虚高
+double _bytes_at_psnr(const std::vector<int>& bytes, const std::vector<double>& psnr, double target)
+{
+	double lowest = psnr[0], highest = psnr[0];
+	for(size_t i=1; i<psnr.size(); i++)
+	{
+		if(psnr[i] < lowest) lowest = psnr[i];
+		if(psnr[i] > highest) highest = psnr[i];
+	}
+	if(target < lowest || target > highest) return 0;
+
+	double best = 0;
+	for(size_t i=0; i<bytes.size(); i++)
+	{
+		if(psnr[i] >= target && (best==0 || bytes[i] < best)) best = bytes[i];
+		if(i+1 < bytes.size() && psnr[i] >= target && psnr[i+1] < target)
+		{
+			double t = (psnr[i] - target) / (psnr[i] - psnr[i+1]);
+			double interpolated = bytes[i] + t * (bytes[i+1] - bytes[i]);
+			if(interpolated < best) best = interpolated;
+		}
+	}
+	return best;
+}
+
+//-------------------------------------------------------------------------------
+//trellis量化与普通量化的比较，结果接在fp中JSON的trellis数组中
+bool _bench_trellis(FILE* fp, const BenchImage& image, JpegEncoder::Subsampling mode, const char* modeName, bool& first)
+{
+	JpegEncoder encoder;
+	encoder.setSubsampling(mode);
+
+	//普通量化的码率-失真曲线
+	std::vector<int> plainBytes(99);
+	std::vector<double> plainPsnr(99);
+	for(int q=1; q<=99; q++)
+	{
+		double ms;
+		if(!_encode_once(encoder, image, q, plainBytes[q-1], plainPsnr[q-1], ms)) return false;
+	}
+
+	for(int q=0; q<BENCH_QUALITY_COUNT; q++)
+	{
+		for(int l=0; l<BENCH_LAMBDA_COUNT; l++)
+		{
+			encoder.setTrellisLambda(Bench_Lambdas[l]);
+			int bytes;
+			double psnr, ms;
+			if(!_encode_once(encoder, image, Bench_Qualities[q], bytes, psnr, ms)) return false;
+			encoder.setTrellisLambda(0);
+
+			//超出普通量化的PSNR范围时两项都输出null
+			double plain = _bytes_at_psnr(plainBytes, plainPsnr, psnr);
+			char plainText[32] = "null", savedText[32] = "null";
+			if(plain > 0)
+			{
+				snprintf(plainText, sizeof(plainText), "%.0f", plain);
+				snprintf(savedText, sizeof(savedText), "%.2f", (1 - bytes / plain) * 100);
+			}
+			fprintf(fp, "%s    {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"quality\": %d, \"subsampling\": \"%s\", "
+				"\"lambda\": %.3f, \"bytes\": %d, \"psnr\": %.3f, \"ms\": %.3f, \"plain_bytes_at_psnr\": %s, \"saved_percent\": %s}",
+				first ? "" : ",\n", image.name, image.width, image.height, Bench_Qualities[q], modeName,
+				Bench_Lambdas[l], bytes, psnr, ms, plainText, savedText);
+			fflush(fp);
+			first = false;
+		}
+	}
+	return true;
+}
+
+}
+
+//-------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+	if(argc>1 && (strcmp(argv[1], "-h")==0 || strcmp(argv[1], "--help")==0))
+	{
+		printf("Usage: %s [output.json] [repeat]\n\tBenchmark the encoder on synthetic images, print JSON to stdout or output.json.\n", argv[0]);
+		return 1;
+	}
+
+	FILE* fp = stdout;
+	if(argc>1)
+	{
+		fp = fopen(argv[1], "w");
+		if(fp==0) return 1;
+	}
+	int repeat = argc>2 ? atoi(argv[2]) : 5;
+	if(repeat<1) repeat = 1;
+
+	typedef void (*MakeFunc)(BenchImage& image);
+	const char* names[] = { "gradient", "noise", "photo", "document" };
+	MakeFunc makers[] = { _make_gradient, _make_noise, _make_photo, _make_document };
+	const int imageCount = sizeof(names) / sizeof(names[0]);
+
+	fprintf(fp, "{\n  \"simd\": \"%s\",\n  \"repeat\": %d,\n  \"results\": [\n", jpeg_get_kernels(jpeg_detect_simd())->name, repeat);
+
+	bool first = true, successed = true;
+	for(int s=0; s<BENCH_SIZE_COUNT; s++)
+	{
+		for(int m=0; m<imageCount; m++)
+		{
+			BenchImage image;
+			image.name = names[m];
+			image.width = Bench_Sizes[s][0];
+			image.height = Bench_Sizes[s][1];
+			image.pixels.resize((size_t)image.width * image.height * 3);
+			makers[m](image);
+
+			for(int q=0; q<BENCH_QUALITY_COUNT; q++)
+			{
+				for(int k=0; k<BENCH_SUBSAMPLING_COUNT; k++)
+				{
+					BenchResult result;
+					if(!_bench_one(image, Bench_Qualities[q], Bench_Subsamplings[k], repeat, result))
+					{
+						fprintf(stderr, "%s %dx%d quality %d %s failed\n", image.name, image.width, image.height,
+							Bench_Qualities[q], Bench_Subsampling_Names[k]);
+						successed = false;
+						continue;
+					}
+
+					double mpix = (double)image.width * image.height / 1e6;
+					const JpegEncodeStats& stats = result.stats;
+					fprintf(fp, "%s    {\"image\": \"%s\", \"width\": %d, \"height\": %d, \"quality\": %d, \"subsampling\": \"%s\", "
+						"\"bytes\": %d, \"psnr\": %.3f, \"mpix_per_s\": %.2f, "
+						"\"stages_ms\": {\"color\": %.3f, \"dct\": %.3f, \"entropy\": %.3f, \"output\": %.3f, \"total\": %.3f}, "
+						"\"bits\": {\"y_dc\": %lld, \"y_ac\": %lld, \"cb_dc\": %lld, \"cb_ac\": %lld, \"cr_dc\": %lld, \"cr_ac\": %lld}, "
+						"\"stuffed_bytes\": %lld, \"eob\": %lld, \"zrl\": %lld, \"blocks\": %lld, \"zero_blocks\": %lld, "
+						"\"flat_blocks\": %lld, \"reduced_blocks\": %lld}",
+						first ? "" : ",\n", image.name, image.width, image.height, Bench_Qualities[q], Bench_Subsampling_Names[k],
+						result.bytes, result.psnr, mpix / (result.totalMs / 1000),
+						stats.nanoseconds(stats.colorCycles) / 1e6, stats.nanoseconds(stats.dctCycles) / 1e6,
+						stats.nanoseconds(stats.entropyCycles) / 1e6, stats.nanoseconds(stats.outputCycles) / 1e6, result.totalMs,
+						stats.dcBits[0], stats.acBits[0], stats.dcBits[1], stats.acBits[1], stats.dcBits[2], stats.acBits[2],
+						stats.stuffedBytes, stats.eobCount, stats.zrlCount, stats.blocks, stats.zeroBlocks, 
+						stats.flatBlocks, stats.reducedBlocks);
+					fflush(fp);
+					first = false;
+				}
+			}
+		}
+	}
+	fprintf(fp, "\n  ],\n  \"trellis\": [\n");
+
+	//trellis量化：相同PSNR下比普通量化省多少字节
+	first = true;
+	for(int m=0; m<3; m++)
+	{
+		BenchImage image;
+		image.name = names[m];
+		image.width = Bench_Sizes[0][0];
+		image.height = Bench_Sizes[0][1];
+		image.pixels.resize((size_t)image.width * image.height * 3);
+		makers[m](image);
+
+		for(int k=0; k<BENCH_SUBSAMPLING_COUNT; k++)
+		{
+			if(!_bench_trellis(fp, image, Bench_Subsamplings[k], Bench_Subsampling_Names[k], first))
+			{
+				fprintf(stderr, "%s trellis %s failed\n", image.name, Bench_Subsampling_Names[k]);
+				successed = false;
+			}
+		}
+	}
+	fprintf(fp, "\n  ]\n}\n");
+
+	if(fp!=stdout) fclose(fp);
+	return successed ? 0 : 1;
+}
@@ -0,0 +1,592 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define JPEG_HAVE_IO_URING
+#endif
+#endif
+#endif
+
+#include "jpeg_async_output.h"
+
+namespace {
+//O_DIRECT要求缓冲区地址、长度和文件偏移都按块对齐，4096对常见的设备都足够
+const int ALIGNMENT = 4096;
+
+//-------------------------------------------------------------------------------
+unsigned char* _alignedAlloc(int size)
+{
+#ifdef _WIN32
+	return (unsigned char*)_aligned_malloc(size, ALIGNMENT);
+#else
+	void* p = 0;
+	if(posix_memalign(&p, ALIGNMENT, size)!=0) return 0;
+	return (unsigned char*)p;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+void _alignedFree(unsigned char* p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+}
+
+#ifdef JPEG_HAVE_IO_URING
+//-------------------------------------------------------------------------------
+// 不依赖liburing，直接用系统调用和映射的环形队列。只有编码线程提交和收割，不需要加锁，
+// 与内核共享的head、tail用acquire/release访问
+struct JpegAsyncFileOutput::Uring
+{
+	int				fd;
+	void*			sqRing;
+	size_t			sqRingSize;
+	void*			cqRing;
+	size_t			cqRingSize;
+	io_uring_sqe*	sqes;
+	size_t			sqesSize;
+
+	unsigned*		sqTail;
+	unsigned*		sqMask;
+	unsigned*		sqArray;
+	unsigned*		cqHead;
+	unsigned*		cqTail;
+	unsigned*		cqMask;
+	io_uring_cqe*	cqes;
+
+	//每个缓冲区一个iovec，写入完成之前必须一直有效
+	std::vector<iovec>	iovecs;
+};
+#else
+struct JpegAsyncFileOutput::Uring
+{
+};
+#endif
+
+//-------------------------------------------------------------------------------
+JpegAsyncFileOutput::JpegAsyncFileOutput()
+	: m_bufferSize(1024*1024)
+	, m_bufferCount(2)
+	, m_wantDirect(false)
+	, m_useIoUring(true)
+	, m_syncPolicy(SYNC_NONE)
+	, m_current(0)
+	, m_fill(0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+#else
+	, m_fd(-1)
+#endif
+	, m_open(false)
+	, m_direct(false)
+	, m_backend(BACKEND_NONE)
+	, m_offset(0)
+	, m_bytes(0)
+	, m_stallSeconds(0)
+	, m_failed(false)
+	, m_uring(0)
+	, m_queued(0)
+	, m_written(0)
+	, m_quit(false)
+{
+}
+
+//-------------------------------------------------------------------------------
+JpegAsyncFileOutput::~JpegAsyncFileOutput()
+{
+	if(m_open) close();
+	_destroyUring();
+	_freeBuffers();
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::setBuffers(int bufferSize, int bufferCount)
+{
+	if(m_open || bufferSize<=0 || bufferSize > 0x7FFFFFFF - ALIGNMENT) return false;
+	bufferSize = (bufferSize + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	if(bufferCount < 2) bufferCount = 2;
+
+	//大小或个数变了才重新分配，io_uring的队列长度与缓冲区个数有关，也要重新创建
+	if(bufferSize!=m_bufferSize || bufferCount!=m_bufferCount)
+	{
+		_freeBuffers();
+		if(bufferCount!=m_bufferCount) _destroyUring();
+		m_bufferSize = bufferSize;
+		m_bufferCount = bufferCount;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::_allocBuffers(void)
+{
+	if(!m_buffers.empty()) return true;
+	for(int i=0; i<m_bufferCount; i++)
+	{
+		unsigned char* buffer = _alignedAlloc(m_bufferSize);
+		if(buffer==0)
+		{
+			_freeBuffers();
+			return false;
+		}
+		m_buffers.push_back(buffer);
+	}
+	m_inFlight.assign(m_bufferCount, 0);
+	m_requests.resize(m_bufferCount);
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_freeBuffers(void)
+{
+	for(size_t i=0; i<m_buffers.size(); i++) _alignedFree(m_buffers[i]);
+	m_buffers.clear();
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::open(const char* fileName)
+{
+	if(m_open) close();
+	if(!_allocBuffers()) return false;
+
+	//打开O_DIRECT失败时(tmpfs等不支持)退回普通写入
+	m_direct = false;
+#ifdef _WIN32
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if(m_syncPolicy==SYNC_EVERY_BUFFER) flags |= FILE_FLAG_WRITE_THROUGH;
+	if(m_wantDirect)
+	{
+		m_file = CreateFileA(fileName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, flags | FILE_FLAG_NO_BUFFERING, 0);
+		m_direct = m_file!=INVALID_HANDLE_VALUE;
+	}
+	if(!m_direct) m_file = CreateFileA(fileName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, flags, 0);
+	if(m_file==INVALID_HANDLE_VALUE) return false;
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC;
+#ifdef O_CLOEXEC
+	flags |= O_CLOEXEC;
+#endif
+	if(m_syncPolicy==SYNC_EVERY_BUFFER) flags |= O_DSYNC;
+	m_fd = -1;
+#ifdef O_DIRECT
+	if(m_wantDirect)
+	{
+		m_fd = ::open(fileName, flags | O_DIRECT, 0644);
+		m_direct = m_fd>=0;
+	}
+#endif
+	if(m_fd<0) m_fd = ::open(fileName, flags, 0644);
+	if(m_fd<0) return false;
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+	//macOS没有O_DIRECT，用F_NOCACHE不经过页缓存
+	if(m_wantDirect) m_direct = fcntl(m_fd, F_NOCACHE, 1)==0;
+#endif
+#endif
+
+	m_open = true;
+	m_current = 0;
+	m_fill = 0;
+	m_offset = 0;
+	m_bytes = 0;
+	m_stallSeconds = 0;
+	m_failed = false;
+	m_inFlight.assign(m_bufferCount, 0);
+	m_queued = m_written = 0;
+	m_quit = false;
+
+	if(m_useIoUring && (m_uring || _setupUring()))
+	{
+		m_backend = BACKEND_IO_URING;
+	}
+	else
+	{
+		m_backend = BACKEND_THREAD;
+		m_thread = std::thread(&JpegAsyncFileOutput::_writerMain, this);
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::write(const unsigned char* data, int size)
+{
+	if(!m_open || m_failed) return false;
+
+	while(size > 0)
+	{
+		int count = m_bufferSize - m_fill;
+		if(count > size) count = size;
+		memcpy(m_buffers[m_current] + m_fill, data, count);
+		m_fill += count;
+		m_bytes += count;
+		data += count;
+		size -= count;
+
+		if(m_fill==m_bufferSize) _submit(m_fill);
+	}
+	return !m_failed;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::close(void)
+{
+	if(!m_open) return false;
+
+	//最后不足一个缓冲区的数据，O_DIRECT时补0到对齐的长度，关闭前再截断
+	if(m_fill > 0)
+	{
+		int size = m_fill;
+		if(m_direct)
+		{
+			size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+			memset(m_buffers[m_current] + m_fill, 0, size - m_fill);
+		}
+		_submit(size);
+	}
+	for(int i=0; i<m_bufferCount; i++) _waitBuffer(i);
+
+	if(m_backend==BACKEND_THREAD)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+
+	bool successed = !m_failed;
+	bool truncated = m_offset != m_bytes;
+#ifdef _WIN32
+	if(truncated)
+	{
+		LARGE_INTEGER end;
+		end.QuadPart = m_bytes;
+		if(!SetFilePointerEx((HANDLE)m_file, end, 0, FILE_BEGIN) || !SetEndOfFile((HANDLE)m_file)) successed = false;
+	}
+	if(m_syncPolicy==SYNC_ON_CLOSE || (truncated && m_syncPolicy==SYNC_EVERY_BUFFER))
+	{
+		if(!FlushFileBuffers((HANDLE)m_file)) successed = false;
+	}
+	if(!CloseHandle((HANDLE)m_file)) successed = false;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if(truncated && ftruncate(m_fd, m_bytes)!=0) successed = false;
+	//O_DSYNC只保证写入的数据落盘，截断改变的长度还要fsync一次
+	if(m_syncPolicy==SYNC_ON_CLOSE || (truncated && m_syncPolicy==SYNC_EVERY_BUFFER))
+	{
+		if(fsync(m_fd)!=0) successed = false;
+	}
+	if(::close(m_fd)!=0) successed = false;
+	m_fd = -1;
+#endif
+
+	m_open = false;
+	m_fill = 0;
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_submit(int size)
+{
+	Request& request = m_requests[m_current];
+	request.offset = m_offset;
+	request.size = size;
+	request.done = 0;
+	m_offset += size;
+
+	if(m_backend==BACKEND_THREAD)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_inFlight[m_current] = 1;
+	}
+	else
+	{
+		m_inFlight[m_current] = 1;
+	}
+	_submitRequest(m_current);
+
+	//缓冲区按顺序轮流使用，下一个还在写的话只能等
+	m_current = (m_current + 1) % m_bufferCount;
+	m_fill = 0;
+	_waitBuffer(m_current);
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_waitBuffer(int index)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	bool waited = false;
+
+	if(m_backend==BACKEND_IO_URING)
+	{
+		while(m_inFlight[index])
+		{
+			_reap(true);
+			waited = true;
+		}
+	}
+	else
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while(m_inFlight[index])
+		{
+			m_done.wait(lock);
+			waited = true;
+		}
+	}
+
+	if(waited)
+	{
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		m_stallSeconds += elapsed.count();
+	}
+}
+
+//-------------------------------------------------------------------------------
+// 写线程：按提交的顺序逐个写出，请求的序号对缓冲区个数取余就是缓冲区的序号
+void JpegAsyncFileOutput::_writerMain(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for(;;)
+	{
+		while(m_written==m_queued && !m_quit) m_wake.wait(lock);
+		if(m_written==m_queued) break;
+
+		int index = (int)(m_written % m_bufferCount);
+		Request request = m_requests[index];
+		lock.unlock();
+		bool successed = _writeAll(m_buffers[index], request.size, request.offset);
+		lock.lock();
+
+		if(!successed) m_failed = true;
+		m_inFlight[index] = 0;
+		m_written++;
+		m_done.notify_all();
+	}
+}
+
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::_writeAll(const unsigned char* data, int size, long long offset)
+{
+	while(size > 0)
+	{
+#ifdef _WIN32
+		OVERLAPPED overlapped;
+		memset(&overlapped, 0, sizeof(overlapped));
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		DWORD written = 0;
+		if(!WriteFile((HANDLE)m_file, data, size, &written, &overlapped) || written==0) return false;
+#else
+		ssize_t written = pwrite(m_fd, data, size, offset);
+		if(written < 0 && errno==EINTR) continue;
+		if(written <= 0) return false;
+#endif
+		data += written;
+		size -= (int)written;
+		offset += written;
+	}
+	return true;
+}
+
+#ifdef JPEG_HAVE_IO_URING
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::_setupUring(void)
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = (int)syscall(__NR_io_uring_setup, m_bufferCount, &params);
+	if(fd < 0) return false;
+
+	//值初始化，指针都为0
+	Uring* uring = new Uring();
+	uring->fd = fd;
+	uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	//新内核的两个环形队列在同一块映射中
+	bool single = (params.features & IORING_FEAT_SINGLE_MMAP)!=0;
+	if(single && uring->cqRingSize > uring->sqRingSize) uring->sqRingSize = uring->cqRingSize;
+
+	uring->sqRing = mmap(0, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	uring->cqRing = single ? uring->sqRing
+		: mmap(0, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	uring->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	uring->sqes = (io_uring_sqe*)mmap(0, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(uring->sqRing==MAP_FAILED || uring->cqRing==MAP_FAILED || uring->sqes==MAP_FAILED)
+	{
+		if(uring->sqes==MAP_FAILED) uring->sqes = 0;
+		if(uring->cqRing==MAP_FAILED) uring->cqRing = 0;
+		if(uring->sqRing==MAP_FAILED) uring->sqRing = 0;
+		m_uring = uring;
+		_destroyUring();
+		return false;
+	}
+
+	unsigned char* sq = (unsigned char*)uring->sqRing;
+	unsigned char* cq = (unsigned char*)uring->cqRing;
+	uring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+	uring->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+	uring->sqArray = (unsigned*)(sq + params.sq_off.array);
+	uring->cqHead = (unsigned*)(cq + params.cq_off.head);
+	uring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+	uring->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+	uring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+	uring->iovecs.resize(m_bufferCount);
+
+	m_uring = uring;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_destroyUring(void)
+{
+	if(m_uring==0) return;
+	if(m_uring->sqes) munmap(m_uring->sqes, m_uring->sqesSize);
+	if(m_uring->cqRing && m_uring->cqRing!=m_uring->sqRing) munmap(m_uring->cqRing, m_uring->cqRingSize);
+	if(m_uring->sqRing) munmap(m_uring->sqRing, m_uring->sqRingSize);
+	::close(m_uring->fd);
+	delete m_uring;
+	m_uring = 0;
+}
+
+//-------------------------------------------------------------------------------
+// 同时在写的请求不超过缓冲区个数，也就是队列的长度，提交时队列总有空位
+void JpegAsyncFileOutput::_submitRequest(int index)
+{
+	if(m_backend==BACKEND_THREAD)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queued++;
+		}
+		m_wake.notify_one();
+		return;
+	}
+
+	const Request& request = m_requests[index];
+	iovec& vec = m_uring->iovecs[index];
+	vec.iov_base = m_buffers[index] + request.done;
+	vec.iov_len = request.size - request.done;
+
+	//WRITEV从5.1开始就有，WRITE要5.6
+	unsigned tail = *m_uring->sqTail;
+	unsigned slot = tail & *m_uring->sqMask;
+	io_uring_sqe* sqe = &m_uring->sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = m_fd;
+	sqe->addr = (unsigned long long)(size_t)&vec;
+	sqe->len = 1;
+	sqe->off = request.offset + request.done;
+	sqe->user_data = index;
+	m_uring->sqArray[slot] = slot;
+	__atomic_store_n(m_uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	for(;;)
+	{
+		int submitted = (int)syscall(__NR_io_uring_enter, m_uring->fd, 1, 0, 0, 0, 0);
+		if(submitted >= 0) break;
+		if(errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+		{
+			//提交不了，这个缓冲区算作写完(失败)，之后的write都返回false
+			m_failed = true;
+			m_inFlight[index] = 0;
+			break;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_reap(bool wait)
+{
+	unsigned head = *m_uring->cqHead;
+	unsigned tail = __atomic_load_n(m_uring->cqTail, __ATOMIC_ACQUIRE);
+	while(head==tail && wait)
+	{
+		int result = (int)syscall(__NR_io_uring_enter, m_uring->fd, 0, 1, IORING_ENTER_GETEVENTS, 0, 0);
+		if(result < 0 && errno!=EINTR)
+		{
+			//等不到完成事件，所有还在写的缓冲区都算失败
+			m_failed = true;
+			m_inFlight.assign(m_bufferCount, 0);
+			return;
+		}
+		tail = __atomic_load_n(m_uring->cqTail, __ATOMIC_ACQUIRE);
+	}
+
+	for(; head!=tail; head++)
+	{
+		const io_uring_cqe& cqe = m_uring->cqes[head & *m_uring->cqMask];
+		int index = (int)cqe.user_data;
+		Request& request = m_requests[index];
+
+		if(cqe.res <= 0)
+		{
+			m_failed = true;
+			m_inFlight[index] = 0;
+			continue;
+		}
+		//只写了一部分(比如被信号打断)，把剩下的再提交一次
+		request.done += cqe.res;
+		if(request.done < request.size)
+			_submitRequest(index);
+		else
+			m_inFlight[index] = 0;
+	}
+	__atomic_store_n(m_uring->cqHead, head, __ATOMIC_RELEASE);
+}
+#else
+//-------------------------------------------------------------------------------
+bool JpegAsyncFileOutput::_setupUring(void)
+{
+	return false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_destroyUring(void)
+{
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_submitRequest(int index)
+{
+	(void)index;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued++;
+	}
+	m_wake.notify_one();
+}
+
+//-------------------------------------------------------------------------------
+void JpegAsyncFileOutput::_reap(bool wait)
+{
+	(void)wait;
+}
+#endif
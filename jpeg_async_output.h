@@ -0,0 +1,131 @@
+#ifndef __JPEG_ASYNC_OUTPUT_HEADER__
+#define __JPEG_ASYNC_OUTPUT_HEADER__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "jpeg_output.h"
+
+// 异步写文件的输出。数据先攒在几个对齐的大缓冲区(默认2个1MB)中，一个写满就提交给内核或者写线程，
+// 编码接着写下一个缓冲区，只有所有缓冲区都还在写的时候才等待。
+// Linux上优先使用io_uring，内核不支持(或者被禁止)时与其他平台一样退回到一个专门的写线程。
+// 打开O_DIRECT时绕过页缓存，最后不足一块的数据补0写出后再截断到实际长度
+class JpegAsyncFileOutput : public JpegOutput
+{
+public:
+	/** 什么时候把数据刷到磁盘上：不刷，关闭时fsync一次，或者每个缓冲区写完时就已经落盘(O_DSYNC) */
+	enum SyncPolicy
+	{
+		SYNC_NONE,
+		SYNC_ON_CLOSE,
+		SYNC_EVERY_BUFFER
+	};
+	/** 实际使用的异步方式 */
+	enum Backend
+	{
+		BACKEND_NONE,
+		BACKEND_IO_URING,
+		BACKEND_THREAD
+	};
+
+	JpegAsyncFileOutput();
+	virtual ~JpegAsyncFileOutput();
+
+	/** 每个缓冲区的大小(向上取整到4096的倍数)和个数(至少2)，打开文件之前设置 */
+	bool setBuffers(int bufferSize, int bufferCount = 2);
+	/** 使用O_DIRECT(Windows为FILE_FLAG_NO_BUFFERING)，文件系统不支持时open退回普通写入，见directIo */
+	void setDirectIo(bool enable) { m_wantDirect = enable; }
+	/** 默认为SYNC_NONE */
+	void setSyncPolicy(SyncPolicy policy) { m_syncPolicy = policy; }
+	/** 是否尝试io_uring(默认是)，为false时总是用写线程 */
+	void setUseIoUring(bool enable) { m_useIoUring = enable; }
+
+	/** 创建(或者清空)文件，之前打开的文件先关闭 */
+	bool open(const char* fileName);
+	virtual bool write(const unsigned char* data, int size);
+	/** 写出剩下的数据，等待所有写入完成，按策略fsync后关闭文件。其中任何一次写入失败都返回false */
+	bool close(void);
+
+	/** 以下几项为当前(或者最近关闭的)文件的状态 */
+	bool isOpen(void) const { return m_open; }
+	Backend backend(void) const { return m_backend; }
+	bool directIo(void) const { return m_direct; }
+	/** 写入的字节数，不包括O_DIRECT补齐的部分 */
+	long long bytesWritten(void) const { return m_bytes; }
+	/** write和close等待空闲缓冲区的总时间，即编码被I/O阻塞的时间 */
+	double stallSeconds(void) const { return m_stallSeconds; }
+
+private:
+	//一次提交的写入，offset和size在提交时确定，done为已经写完的字节数(io_uring可能只写了一部分)
+	struct Request
+	{
+		long long	offset;
+		int			size;
+		int			done;
+	};
+
+	bool _allocBuffers(void);
+	void _freeBuffers(void);
+	//提交当前缓冲区中的size字节，并切换到下一个缓冲区
+	void _submit(int size);
+	void _submitRequest(int index);
+	//等待第index个缓冲区的写入完成
+	void _waitBuffer(int index);
+	//io_uring：处理已经完成的写入，wait为true时至少等到一个
+	void _reap(bool wait);
+	bool _setupUring(void);
+	void _destroyUring(void);
+	void _writerMain(void);
+	bool _writeAll(const unsigned char* data, int size, long long offset);
+
+private:
+	//设置
+	int				m_bufferSize;
+	int				m_bufferCount;
+	bool			m_wantDirect;
+	bool			m_useIoUring;
+	SyncPolicy		m_syncPolicy;
+
+	//对齐的缓冲区、每个缓冲区是否正在写，以及正在写的请求
+	std::vector<unsigned char*>	m_buffers;
+	std::vector<char>			m_inFlight;
+	std::vector<Request>		m_requests;
+	int				m_current;
+	int				m_fill;
+
+	//当前文件
+#ifdef _WIN32
+	void*			m_file;
+#else
+	int				m_fd;
+#endif
+	bool			m_open;
+	bool			m_direct;
+	Backend			m_backend;
+	long long		m_offset;
+	long long		m_bytes;
+	double			m_stallSeconds;
+	std::atomic<bool>	m_failed;
+
+	//io_uring的状态，第一次使用时创建，之后每个文件重复使用
+	struct Uring;
+	Uring*			m_uring;
+
+	//写线程按提交的顺序依次写出，m_queued和m_written为提交和写完的请求个数
+	std::thread		m_thread;
+	std::mutex		m_mutex;
+	std::condition_variable	m_wake;
+	std::condition_variable	m_done;
+	long long		m_queued;
+	long long		m_written;
+	bool			m_quit;
+
+private:
+	JpegAsyncFileOutput(const JpegAsyncFileOutput&);
+	JpegAsyncFileOutput& operator=(const JpegAsyncFileOutput&);
+};
+
+#endif
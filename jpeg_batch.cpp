@@ -0,0 +1,143 @@
+#include <string.h>
+#include <chrono>
+
+#include "jpeg_batch.h"
+
+namespace {
+//-------------------------------------------------------------------------------
+// 转交给任务的输出，同时统计写出的字节数
+class CountingOutput : public JpegOutput
+{
+public:
+	explicit CountingOutput(JpegOutput* output) : m_output(output), m_size(0) {}
+
+	virtual bool write(const unsigned char* data, int size)
+	{
+		m_size += size;
+		return m_output->write(data, size);
+	}
+
+	int size(void) const { return m_size; }
+
+private:
+	JpegOutput*	m_output;
+	int			m_size;
+};
+}
+
+//-------------------------------------------------------------------------------
+JpegBatchEncoder::JpegBatchEncoder(int threadCount)
+	: m_threadPool(threadCount)
+	, m_jobs(0)
+{
+	if(threadCount<1) threadCount = 1;
+	for(int i=0; i<threadCount; i++)
+	{
+		Worker* worker = new Worker;
+		worker->images = worker->failed = worker->inputBytes = worker->outputBytes = 0;
+		m_workers.push_back(worker);
+	}
+	resetStats();
+}
+
+//-------------------------------------------------------------------------------
+JpegBatchEncoder::~JpegBatchEncoder()
+{
+	for(size_t i=0; i<m_workers.size(); i++) delete m_workers[i];
+	m_workers.clear();
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setDctMethod(JpegEncoder::DctMethod method)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setDctMethod(method);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setSubsampling(mode, filter);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setOptimizeHuffman(bool enable)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setOptimizeHuffman(enable);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setProgressive(bool enable)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setProgressive(enable);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setTrellisLambda(float lambda)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setTrellisLambda(lambda);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::setRestartInterval(int mcus)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setRestartInterval(mcus);
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::resetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//-------------------------------------------------------------------------------
+void JpegBatchEncoder::_encodeTask(void* context, int index, int worker)
+{
+	JpegBatchEncoder* self = (JpegBatchEncoder*)context;
+	JpegBatchJob& job = self->m_jobs[index];
+	Worker* w = self->m_workers[worker];
+
+	CountingOutput output(job.output);
+	job.successed = job.output!=0 && w->encoder.encode(job.input.pixels, job.input.width, job.input.height, 
+		job.input.stride, job.input.format, job.quality, output);
+	job.outputSize = output.size();
+
+	w->images++;
+	if(!job.successed) w->failed++;
+	w->inputBytes += jpeg_pixel_bytes(job.input.format, job.input.width, job.input.height);
+	w->outputBytes += job.outputSize;
+}
+
+//-------------------------------------------------------------------------------
+int JpegBatchEncoder::encode(JpegBatchJob* jobs, int count)
+{
+	if(jobs==0 || count<=0) return 0;
+
+	for(size_t i=0; i<m_workers.size(); i++)
+	{
+		Worker* w = m_workers[i];
+		w->images = w->failed = w->inputBytes = w->outputBytes = 0;
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	m_jobs = jobs;
+	m_threadPool.parallelForStealing(count, _encodeTask, this);
+	m_jobs = 0;
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	//汇总每个线程的统计
+	long long failed = 0;
+	for(size_t i=0; i<m_workers.size(); i++)
+	{
+		Worker* w = m_workers[i];
+		m_stats.images += w->images;
+		m_stats.inputBytes += w->inputBytes;
+		m_stats.outputBytes += w->outputBytes;
+		failed += w->failed;
+	}
+	m_stats.failed += failed;
+	m_stats.seconds += elapsed.count();
+
+	return count - (int)failed;
+}
@@ -0,0 +1,84 @@
+#ifndef __JPEG_BATCH_HEADER__
+#define __JPEG_BATCH_HEADER__
+
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+/** 批量编码中的一幅图像 */
+struct JpegBatchJob
+{
+	JpegImageView	input;			//输入图像
+	int				quality;		//与JpegEncoder::encode的quality_scale相同
+	JpegOutput*		output;			//编码结果写到这里，每个任务使用各自的输出
+	bool			successed;		//编码完成后填写
+	int				outputSize;		//编码后的字节数
+};
+
+/** 批量编码的累计统计 */
+struct JpegBatchStats
+{
+	long long	images;			//编码的图像数，包括失败的
+	long long	failed;			//失败的图像数
+	long long	inputBytes;		//输入像素的字节数
+	long long	outputBytes;	//输出的JPEG字节数
+	double		seconds;		//encode调用的总时间
+
+	double imagesPerSecond(void) const { return seconds>0 ? images/seconds : 0; }
+	/** 按输入像素计算的吞吐量 */
+	double inputMBPerSecond(void) const { return seconds>0 ? inputBytes/seconds/(1024.0*1024.0) : 0; }
+	double outputMBPerSecond(void) const { return seconds>0 ? outputBytes/seconds/(1024.0*1024.0) : 0; }
+};
+
+// 大量小图像的批量编码。固定数量的线程常驻，每个线程有自己的JpegEncoder，
+// 其中的霍夫曼表、量化表(质量不变时)、输出缓冲区等都在第一次使用后重复使用，之后编码不再分配内存。
+// 一批任务先按线程平均分段，做完自己那一段的线程从其他线程的段中窃取
+class JpegBatchEncoder
+{
+public:
+	/** threadCount为参与编码的线程总数，包括调用encode的线程 */
+	explicit JpegBatchEncoder(int threadCount);
+	~JpegBatchEncoder();
+
+	int threadCount(void) const { return (int)m_workers.size(); }
+
+	/** 编码参数，对每个线程的编码器都生效 */
+	void setDctMethod(JpegEncoder::DctMethod method);
+	void setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter = JpegEncoder::CHROMA_BOX);
+	void setOptimizeHuffman(bool enable);
+	void setProgressive(bool enable);
+	void setTrellisLambda(float lambda);
+	void setRestartInterval(int mcus);
+
+	/** 编码一批图像，全部完成后返回，返回值为成功的个数 */
+	int encode(JpegBatchJob* jobs, int count);
+
+	/** 从创建或者上一次resetStats以来的累计统计 */
+	const JpegBatchStats& stats(void) const { return m_stats; }
+	void resetStats(void);
+
+private:
+	//每个线程各自的编码器和统计，分别分配，避免不同线程的数据落在同一个缓存行中
+	struct Worker
+	{
+		JpegEncoder		encoder;
+		long long		images;
+		long long		failed;
+		long long		inputBytes;
+		long long		outputBytes;
+	};
+
+	static void _encodeTask(void* context, int index, int worker);
+
+private:
+	std::vector<Worker*>	m_workers;
+	JpegThreadPool			m_threadPool;
+	JpegBatchJob*			m_jobs;
+	JpegBatchStats			m_stats;
+
+private:
+	JpegBatchEncoder(const JpegBatchEncoder&);
+	JpegBatchEncoder& operator=(const JpegBatchEncoder&);
+};
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef __JPEG_BITWRITER_HEADER__
+#define __JPEG_BITWRITER_HEADER__
+
+#include <string.h>
+
+#include "jpeg_stats.h"
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#include <intrin.h>
+#endif
+
+/** 数值的二进制位数，即JPEG中的幅值类别，0的位数为0 */
+inline int jpeg_bit_length(unsigned int v)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	return _BitScanReverse(&index, v) ? (int)index + 1 : 0;
+#elif defined(__GNUC__)
+	return v ? 32 - __builtin_clz(v) : 0;
+#else
+	int length = 0;
+	for(; v; v>>=1) length++;
+	return length;
+#endif
+}
+
+/** 64位数中最低的1所在的位置，v不能为0 */
+inline int jpeg_ctz64(unsigned long long v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, v);
+	return (int)index;
+#elif defined(__GNUC__)
+	return __builtin_ctzll(v);
+#else
+	int n = 0;
+	for(; (v & 1) == 0; v>>=1) n++;
+	return n;
+#endif
+}
+
+/** 输出回调，写入成功返回true */
+typedef bool (*JpegWriteFunc)(void* context, const unsigned char* data, int size);
+
+// 熵编码的输出级：用64位的累加器拼接码字，满8个字节后一次写入内存缓冲区，
+// 缓冲区满了再交给输出回调，0xFF后补0x00的操作按8字节整体检测
+class JpegBitWriter
+{
+public:
+	/** buffer由调用者提供，大小至少为64字节 */
+	JpegBitWriter(unsigned char* buffer, int bufferSize, JpegWriteFunc write, void* context)
+		: m_acc(0)
+		, m_free(64)
+		, m_begin(buffer)
+		, m_ptr(buffer)
+		, m_end(buffer + bufferSize - RESERVE)
+		, m_write(write)
+		, m_context(context)
+		, m_error(false)
+#ifndef JPEG_NO_STATS
+		, m_stuffedBytes(0)
+		, m_outputCycles(0)
+		, m_outputBytes(0)
+#endif
+	{
+	}
+
+	/** 写入length位(1~32)的码字，code的高位必须为0 */
+	inline void putBits(unsigned int code, int length)
+	{
+		if(length < m_free)
+		{
+			m_free -= length;
+			m_acc = (m_acc << length) | code;
+		}
+		else
+		{
+			//累加器放不下，先用code的高位填满64位写出去，低位留在累加器中
+			int over = length - m_free;
+			unsigned long long acc = (m_acc << m_free) | (code >> over);
+			_emit8(acc);
+
+			//code中已经写出去的高位会在下次写出时被移出累加器，不需要清除
+			m_acc = code;
+			m_free = 64 - over;
+		}
+	}
+
+	/** 用1补齐到字节边界，并把累加器中的数据全部写入缓冲区 */
+	void flushBits(void)
+	{
+		int bits = 64 - m_free;
+		if(bits & 7)
+		{
+			int pad = 8 - (bits & 7);
+			putBits((1u << pad) - 1, pad);
+			bits = 64 - m_free;
+		}
+
+		for(int i=bits-8; i>=0; i-=8)
+		{
+			unsigned char b = (unsigned char)(m_acc >> i);
+			*m_ptr++ = b;
+			if(b == 0xFF)
+			{
+				*m_ptr++ = 0;
+				JPEG_STATS(m_stuffedBytes++);
+			}
+		}
+		m_acc = 0;
+		m_free = 64;
+		if(m_ptr >= m_end) flush();
+	}
+
+	/** 直接写入字节(标记、文件头等)，需要在flushBits之后调用 */
+	void writeBytes(const void* data, int size)
+	{
+		const unsigned char* p = (const unsigned char*)data;
+		while(size > 0)
+		{
+			int n = (int)(m_end - m_ptr);
+			if(n > size) n = size;
+			memcpy(m_ptr, p, n);
+			m_ptr += n;
+			p += n;
+			size -= n;
+			if(m_ptr >= m_end) flush();
+		}
+	}
+
+	/** 把缓冲区中的数据交给输出回调 */
+	void flush(void)
+	{
+		if(m_ptr > m_begin)
+		{
+			JPEG_STATS(unsigned long long start = jpeg_cycles());
+			if(!m_write(m_context, m_begin, (int)(m_ptr - m_begin))) m_error = true;
+			JPEG_STATS(m_outputCycles += jpeg_cycles() - start);
+			JPEG_STATS(m_outputBytes += m_ptr - m_begin);
+			m_ptr = m_begin;
+		}
+	}
+
+	/** 输出回调是否失败过 */
+	bool hasError(void) const { return m_error; }
+
+#ifndef JPEG_NO_STATS
+	/** 补0x00的次数，在输出回调中花费的周期数，交给输出回调的字节数 */
+	long long stuffedBytes(void) const { return m_stuffedBytes; }
+	unsigned long long outputCycles(void) const { return m_outputCycles; }
+	long long outputBytes(void) const { return m_outputBytes; }
+#else
+	long long stuffedBytes(void) const { return 0; }
+	unsigned long long outputCycles(void) const { return 0; }
+	long long outputBytes(void) const { return 0; }
+#endif
+
+private:
+	//一次写出8字节，每个字节最多补一个0x00，缓冲区末尾需要预留16字节
+	enum { RESERVE = 16 };
+
+	inline void _emit8(unsigned long long acc)
+	{
+		//~acc中有0字节，即acc中有0xFF字节
+		unsigned long long x = ~acc;
+		if(((x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL) == 0)
+		{
+			unsigned long long be = _bswap64(acc);
+			memcpy(m_ptr, &be, 8);
+			m_ptr += 8;
+		}
+		else
+		{
+			for(int i=56; i>=0; i-=8)
+			{
+				unsigned char b = (unsigned char)(acc >> i);
+				*m_ptr++ = b;
+				if(b == 0xFF)
+				{
+					*m_ptr++ = 0;
+					JPEG_STATS(m_stuffedBytes++);
+				}
+			}
+		}
+		if(m_ptr >= m_end) flush();
+	}
+
+	static inline unsigned long long _bswap64(unsigned long long v)
+	{
+#if defined(_MSC_VER)
+		return _byteswap_uint64(v);
+#elif defined(__GNUC__)
+		return __builtin_bswap64(v);
+#else
+		unsigned long long r = 0;
+		for(int i=0; i<8; i++) { r = (r << 8) | (v & 0xFF); v >>= 8; }
+		return r;
+#endif
+	}
+
+private:
+	unsigned long long	m_acc;		//位累加器，低位是最新写入的位
+	int					m_free;		//累加器中剩余的空位数
+	unsigned char*		m_begin;
+	unsigned char*		m_ptr;
+	unsigned char*		m_end;
+	JpegWriteFunc		m_write;
+	void*				m_context;
+	bool				m_error;
+#ifndef JPEG_NO_STATS
+	long long			m_stuffedBytes;
+	unsigned long long	m_outputCycles;
+	long long			m_outputBytes;
+#endif
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "jpeg_bmp.h"
+
+namespace {
+//-------------------------------------------------------------------------------
+//BMP 文件格式
+//BMP格式图片的文件头长度是54字节，包括14字节的文件数据头、40字节的位图信息数据头
+#pragma pack(push, 2)
+typedef struct {
+		unsigned short	bfType;//文件类型
+		unsigned int	bfSize;//bmp文件的大小
+		unsigned short	bfReserved1;//预留字段，通常为0
+		unsigned short	bfReserved2;//预留字段，通常为0
+		unsigned int	bfOffBits;//图片信息的开始位置
+} BITMAPFILEHEADER_;
+
+typedef struct {
+		unsigned int	biSize;//位图信息数据头的大小
+		int				biWidth;//图像宽度
+		int				biHeight;//图像高度，正数表示自下而上存储，负数表示自上而下存储
+		unsigned short	biPlanes;//色彩平面的数量，必须为1
+		unsigned short	biBitCount;//每像素用多少bit表示
+		unsigned int	biCompression;//采用何种压缩方式，通常不压缩，即BI_RGB，对应值为0
+		unsigned int	biSizeImage;//图片大小（原始位图数据的大小）
+		int				biXPelsPerMeter;//横向分辨率（像素/米）
+		int				biYPelsPerMeter;//纵向分辨率（像素/米）
+		unsigned int	biClrUsed;//调色板中颜色数量，通常为0（不表示没有颜色）
+		unsigned int	biClrImportant;//重要颜色的数量（通常被忽略），通常为0，表示每种颜色都重要
+} BITMAPINFOHEADER_;
+#pragma pack(pop)
+}
+
+//-------------------------------------------------------------------------------
+JpegBmpFile::JpegBmpFile()
+	: m_data(0)
+	, m_size(0)
+#ifdef _WIN32
+	, m_file(INVALID_HANDLE_VALUE)
+	, m_mapping(0)
+#endif
+{
+	memset(&m_view, 0, sizeof(m_view));
+}
+
+//-------------------------------------------------------------------------------
+JpegBmpFile::~JpegBmpFile()
+{
+	close();
+}
+
+//-------------------------------------------------------------------------------
+bool JpegBmpFile::open(const char* fileName)
+{
+	close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if(m_file==INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(m_file, &size) || size.QuadPart==0) { close(); return false; }
+	m_size = (size_t)size.QuadPart;
+
+	m_mapping = CreateFileMappingA(m_file, 0, PAGE_READONLY, 0, 0, 0);
+	if(m_mapping==0) { close(); return false; }
+
+	m_data = (const unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+	if(m_data==0) { close(); return false; }
+#else
+	int fd = ::open(fileName, O_RDONLY);
+	if(fd<0) return false;
+
+	struct stat st;
+	if(fstat(fd, &st)!=0 || st.st_size<=0)
+	{
+		::close(fd);
+		return false;
+	}
+	m_size = (size_t)st.st_size;
+
+	//映射建立之后文件描述符就不再需要了
+	void* data = mmap(0, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(data==MAP_FAILED) return false;
+	m_data = (const unsigned char*)data;
+
+	//提示内核提前读入，编码时少一些缺页等待
+	madvise(data, m_size, MADV_WILLNEED);
+#endif
+
+	if(!_parse())
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegBmpFile::close(void)
+{
+#ifdef _WIN32
+	if(m_data) UnmapViewOfFile(m_data);
+	if(m_mapping) CloseHandle(m_mapping);
+	if(m_file!=INVALID_HANDLE_VALUE) CloseHandle(m_file);
+	m_mapping = 0;
+	m_file = INVALID_HANDLE_VALUE;
+#else
+	if(m_data) munmap((void*)m_data, m_size);
+#endif
+	m_data = 0;
+	m_size = 0;
+	memset(&m_view, 0, sizeof(m_view));
+}
+
+//-------------------------------------------------------------------------------
+bool JpegBmpFile::_parse(void)
+{
+	BITMAPFILEHEADER_ fileHeader;//文件头
+	BITMAPINFOHEADER_ infoHeader;//信息头
+	if(m_size < sizeof(fileHeader) + sizeof(infoHeader)) return false;
+
+	//映射的内存不一定对齐，先复制出来再读取
+	memcpy(&fileHeader, m_data, sizeof(fileHeader));
+	memcpy(&infoHeader, m_data + sizeof(fileHeader), sizeof(infoHeader));
+
+	if(fileHeader.bfType!=0x4D42) return false;//若读取的文件头信息中文件类型不为bmp
+	if(infoHeader.biCompression!=0) return false;//只支持不压缩的格式
+
+	//24位为BGR，32位为BGRX，8位只支持调色板是灰度渐变(第i项为(i,i,i))的文件
+	JpegPixelFormat format;
+	int pixelSize;
+	switch(infoHeader.biBitCount)
+	{
+	case 24:	format = JPEG_PIXEL_BGR;	pixelSize = 3;	break;
+	case 32:	format = JPEG_PIXEL_BGRX;	pixelSize = 4;	break;
+	case 8:		format = JPEG_PIXEL_GRAY;	pixelSize = 1;	break;
+	default:	return false;
+	}
+	if(format==JPEG_PIXEL_GRAY && !_isGrayPalette(infoHeader.biSize, infoHeader.biClrUsed)) return false;
+
+	int width = infoHeader.biWidth;
+	if(width<=0 || infoHeader.biHeight==0 || infoHeader.biHeight==(int)0x80000000) return false;
+	int height = infoHeader.biHeight < 0 ? (-infoHeader.biHeight) : infoHeader.biHeight;
+
+	//每行的字节数要补齐到4的倍数
+	long long rowSize = ((long long)width*pixelSize + 3) & ~3LL;
+	if(rowSize > 0x7FFFFFFF) return false;
+	if(fileHeader.bfOffBits > m_size || (long long)(m_size - fileHeader.bfOffBits) < rowSize*height) return false;
+
+	//BMP存储像素值的方式通常为从下至上，文件中的第一行是图像最下面的一行，这时从最后一行开始，stride取负
+	const unsigned char* pixels = m_data + fileHeader.bfOffBits;
+	int stride = (int)rowSize;
+	if(infoHeader.biHeight>0)
+	{
+		pixels += (height-1) * rowSize;
+		stride = -stride;
+	}
+
+	m_view.pixels = pixels;
+	m_view.width = width;
+	m_view.height = height;
+	m_view.stride = stride;
+	m_view.format = format;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegBmpFile::_isGrayPalette(unsigned int infoSize, unsigned int colorCount) const
+{
+	//调色板紧跟在信息头后面，每项4字节，B G R和保留的一个字节
+	if(colorCount==0) colorCount = 256;
+	if(colorCount>256) return false;
+
+	size_t offset = sizeof(BITMAPFILEHEADER_) + infoSize;
+	if(offset > m_size || (m_size - offset) / 4 < colorCount) return false;
+
+	const unsigned char* palette = m_data + offset;
+	for(unsigned int i=0; i<colorCount; i++)
+	{
+		const unsigned char* entry = palette + i*4;
+		if(entry[0]!=i || entry[1]!=i || entry[2]!=i) return false;
+	}
+	return true;
+}
@@ -0,0 +1,47 @@
+#ifndef __JPEG_BMP_HEADER__
+#define __JPEG_BMP_HEADER__
+
+#include <stddef.h>
+
+#include "jpeg_image.h"
+
+// 以只读方式把BMP文件映射到内存中，像素直接在映射的内存中访问，不做任何复制。
+// 支持不压缩的24位(BGR)、32位(BGRX)以及灰度调色板的8位(GRAY)格式。
+// 每行按4字节对齐，自下而上存储的文件用负的stride表示，view()始终是从上到下的图像。
+// 映射期间文件不能被其他程序截短，否则访问像素时会出错
+class JpegBmpFile
+{
+public:
+	JpegBmpFile();
+	~JpegBmpFile();
+
+	/** 映射并解析文件，仅支持未压缩的24bit、32bit和灰度8bit格式 */
+	bool open(const char* fileName);
+	/** 解除映射 */
+	void close(void);
+
+	bool isOpen(void) const { return m_view.pixels!=0; }
+	/** 文件中的图像，pixels为图像最上面一行的起始地址 */
+	const JpegImageView& view(void) const { return m_view; }
+
+private:
+	bool _parse(void);
+	//8位文件的调色板是否为灰度渐变
+	bool _isGrayPalette(unsigned int infoSize, unsigned int colorCount) const;
+
+private:
+	//映射的起始地址和大小
+	const unsigned char*	m_data;
+	size_t					m_size;
+#ifdef _WIN32
+	void*					m_file;
+	void*					m_mapping;
+#endif
+	JpegImageView			m_view;
+
+private:
+	JpegBmpFile(const JpegBmpFile&);
+	JpegBmpFile& operator=(const JpegBmpFile&);
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "jpeg_coefficients.h"
+#include "jpeg_dct.h"
+
+//-------------------------------------------------------------------------------
+JpegCoefficientStore::JpegCoefficientStore()
+	: m_width(0)
+	, m_height(0)
+	, m_hSamp(1)
+	, m_vSamp(1)
+	, m_componentCount(3)
+	, m_mcusPerLine(0)
+	, m_mcuRows(0)
+{
+}
+
+//-------------------------------------------------------------------------------
+void JpegCoefficientStore::reset(int width, int height, int hSamp, int vSamp, int componentCount)
+{
+	m_width = width;
+	m_height = height;
+	m_hSamp = hSamp;
+	m_vSamp = vSamp;
+	m_componentCount = componentCount;
+	m_mcusPerLine = (width + hSamp*8 - 1) / (hSamp*8);
+	m_mcuRows = (height + vSamp*8 - 1) / (vSamp*8);
+
+	//vector的容量只增不减，同样大小的图像反复编码时不再分配
+	m_data.resize((size_t)mcuCount() * blocksPerMcu() * 64);
+}
+
+//-------------------------------------------------------------------------------
+const short* JpegCoefficientStore::block(int component, int bx, int by) const
+{
+	//色度在每个MCU中只有一块，亮度块在MCU中按从左到右、从上到下排列
+	if(component>0)
+		return mcu(by*m_mcusPerLine + bx) + (m_hSamp*m_vSamp + component - 1) * 64;
+
+	const short* coef = mcu((by/m_vSamp)*m_mcusPerLine + bx/m_hSamp);
+	return coef + ((by%m_vSamp)*m_hSamp + bx%m_hSamp) * 64;
+}
+
+//-------------------------------------------------------------------------------
+int JpegCoefficientStore::blocksWide(int component) const
+{
+	int width = (component>0) ? (m_width + m_hSamp - 1) / m_hSamp : m_width;
+	return (width + 7) / 8;
+}
+
+//-------------------------------------------------------------------------------
+int JpegCoefficientStore::blocksHigh(int component) const
+{
+	int height = (component>0) ? (m_height + m_vSamp - 1) / m_vSamp : m_height;
+	return (height + 7) / 8;
+}
+
+//-------------------------------------------------------------------------------
+JpegDctStore::JpegDctStore()
+	: m_width(0)
+	, m_height(0)
+	, m_hSamp(1)
+	, m_vSamp(1)
+	, m_componentCount(3)
+	, m_floatDct(false)
+	, m_mcusPerLine(0)
+	, m_mcuRows(0)
+{
+}
+
+//-------------------------------------------------------------------------------
+void JpegDctStore::reset(int width, int height, int hSamp, int vSamp, int componentCount, bool floatDct)
+{
+	m_width = width;
+	m_height = height;
+	m_hSamp = hSamp;
+	m_vSamp = vSamp;
+	m_componentCount = componentCount;
+	m_floatDct = floatDct;
+	m_mcusPerLine = (width + hSamp*8 - 1) / (hSamp*8);
+	m_mcuRows = (height + vSamp*8 - 1) / (vSamp*8);
+
+	//只保留用到的一种，另一种的容量留着，换回来时不用重新分配
+	size_t size = (size_t)mcuCount() * blocksPerMcu() * 64;
+	m_islow.resize(floatDct ? 0 : size);
+	m_float.resize(floatDct ? size : 0);
+}
+
+//-------------------------------------------------------------------------------
+void JpegDctStore::loadBlock(int index, int block, float* raw) const
+{
+	size_t offset = ((size_t)index * blocksPerMcu() + block) * 64;
+	if(m_floatDct)
+	{
+		const float* data = &m_float[offset];
+		for(int i=0; i<64; i++) raw[i] = data[jpeg_zigzag[i]];
+	}
+	else
+	{
+		const short* data = &m_islow[offset];
+		for(int i=0; i<64; i++) raw[i] = (float)data[jpeg_zigzag[i]];
+	}
+}
@@ -0,0 +1,94 @@
+#ifndef __JPEG_COEFFICIENTS_HEADER__
+#define __JPEG_COEFFICIENTS_HEADER__
+
+#include <stddef.h>
+#include <vector>
+
+// 整幅图像量化后的DCT系数。按MCU顺序存放，每个MCU依次为所有亮度块、Cb块、Cr块(灰度图像没有色度块)，
+// 每块64个short，zigzag顺序，与_doHuffmanEncoding的输入相同。两遍编码和渐进式编码都从这里读取
+class JpegCoefficientStore
+{
+public:
+	JpegCoefficientStore();
+
+	/** 按图像尺寸、亮度抽样因子和分量数(1或3)重新划分，空间够用时不重新分配 */
+	void reset(int width, int height, int hSamp, int vSamp, int componentCount);
+
+	int width(void) const { return m_width; }
+	int height(void) const { return m_height; }
+	int hSamp(void) const { return m_hSamp; }
+	int vSamp(void) const { return m_vSamp; }
+	int componentCount(void) const { return m_componentCount; }
+	int mcusPerLine(void) const { return m_mcusPerLine; }
+	int mcuCount(void) const { return m_mcusPerLine * m_mcuRows; }
+	/** 每个MCU中的块数，亮度块在前 */
+	int blocksPerMcu(void) const { return m_hSamp*m_vSamp + m_componentCount - 1; }
+
+	/** 第index个MCU的所有块 */
+	short* mcu(int index) { return &m_data[(size_t)index * blocksPerMcu() * 64]; }
+	const short* mcu(int index) const { return &m_data[(size_t)index * blocksPerMcu() * 64]; }
+
+	/** 分量component(0为亮度，1、2为色度)按自己的分辨率排列时，第by行第bx列的块 */
+	const short* block(int component, int bx, int by) const;
+	/** 分量实际覆盖的块数，不包括MCU补齐的部分，非交错扫描只编码这些块 */
+	int blocksWide(int component) const;
+	int blocksHigh(int component) const;
+
+private:
+	int					m_width;
+	int					m_height;
+	int					m_hSamp;
+	int					m_vSamp;
+	int					m_componentCount;
+	int					m_mcusPerLine;
+	int					m_mcuRows;
+	std::vector<short>	m_data;
+};
+
+// 整幅图像未量化的DCT系数，用来以不同的质量反复量化。与JpegCoefficientStore一样按MCU顺序、每块64个系数
+// 按zigzag顺序连续存放，重新量化时从头到尾顺序读一遍。定点DCT(jpeg_fdct_islow)的结果是绝对值不超过8192的整数，存为short；
+// 浮点DCT的结果有小数部分，量化时的舍入与它有关，存为float
+class JpegDctStore
+{
+public:
+	JpegDctStore();
+
+	/** 按图像尺寸、亮度抽样因子、分量数和DCT方式重新划分，空间够用时不重新分配 */
+	void reset(int width, int height, int hSamp, int vSamp, int componentCount, bool floatDct);
+
+	int width(void) const { return m_width; }
+	int height(void) const { return m_height; }
+	int hSamp(void) const { return m_hSamp; }
+	int vSamp(void) const { return m_vSamp; }
+	int componentCount(void) const { return m_componentCount; }
+	bool isFloat(void) const { return m_floatDct; }
+	int mcusPerLine(void) const { return m_mcusPerLine; }
+	int mcuCount(void) const { return m_mcusPerLine * m_mcuRows; }
+	int blocksPerMcu(void) const { return m_hSamp*m_vSamp + m_componentCount - 1; }
+	bool empty(void) const { return mcuCount()==0; }
+
+	/** 第index个MCU的所有块，定点DCT时用islowMcu，浮点DCT时用floatMcu */
+	short* islowMcu(int index) { return &m_islow[(size_t)index * blocksPerMcu() * 64]; }
+	float* floatMcu(int index) { return &m_float[(size_t)index * blocksPerMcu() * 64]; }
+	const short* islowMcu(int index) const { return &m_islow[(size_t)index * blocksPerMcu() * 64]; }
+	const float* floatMcu(int index) const { return &m_float[(size_t)index * blocksPerMcu() * 64]; }
+	/** 第index个MCU中的第block块，转换为自然顺序的float */
+	void loadBlock(int index, int block, float* raw) const;
+
+	/** 系数占用的字节数 */
+	size_t bytes(void) const { return m_islow.size()*sizeof(short) + m_float.size()*sizeof(float); }
+
+private:
+	int					m_width;
+	int					m_height;
+	int					m_hSamp;
+	int					m_vSamp;
+	int					m_componentCount;
+	bool				m_floatDct;
+	int					m_mcusPerLine;
+	int					m_mcuRows;
+	std::vector<short>	m_islow;
+	std::vector<float>	m_float;
+};
+
+#endif
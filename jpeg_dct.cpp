@@ -0,0 +1,227 @@
+#include "jpeg_dct.h"
+
+//-------------------------------------------------------------------------------
+// ZigZag数组用于将DCT变换得到的系数矩阵重新排列成一个一维数组，注意到排列方式是按照低频到高频的顺序，即从左上角排到右下角。目的是为了更有效的进行后续的量化和熵编码
+const unsigned char jpeg_zigzag[64] =
+{
+	0, 1, 5, 6,14,15,27,28,
+	2, 4, 7,13,16,26,29,42,
+	3, 8,12,17,25,30,41,43,
+	9,11,18,24,31,40,44,53,
+	10,19,23,32,39,45,52,54,
+	20,22,33,38,46,51,55,60,
+	21,34,37,47,50,56,59,61,
+	35,36,48,49,57,58,62,63
+};
+
+namespace {
+//-------------------------------------------------------------------------------
+inline int _descale(int x, int n) { return (x + (1 << (n-1))) >> n; }
+
+//-------------------------------------------------------------------------------
+// 负数左移在C++14中是未定义行为，用乘法代替，结果相同
+inline int _left_shift(int x, int n) { return x * (1 << n); }
+
+//-------------------------------------------------------------------------------
+//AAN算法输出的缩放系数 aan[k] = cos(k*PI/16)*sqrt(2), aan[0] = 1
+const double AAN_Scale_Factor[8] =
+{
+	1.0, 1.387039845, 1.306562965, 1.175875602,
+	1.0, 0.785694958, 0.541196100, 0.275899379
+};
+
+//-------------------------------------------------------------------------------
+// Loeffler算法的一维8点变换，in/out的步长为stride，pass为0表示行变换，1表示列变换
+inline void _fdct_islow_1d(int* d, int stride, int pass)
+{
+	int tmp0 = d[0*stride] + d[7*stride];
+	int tmp7 = d[0*stride] - d[7*stride];
+	int tmp1 = d[1*stride] + d[6*stride];
+	int tmp6 = d[1*stride] - d[6*stride];
+	int tmp2 = d[2*stride] + d[5*stride];
+	int tmp5 = d[2*stride] - d[5*stride];
+	int tmp3 = d[3*stride] + d[4*stride];
+	int tmp4 = d[3*stride] - d[4*stride];
+
+	//偶数部分
+	int tmp10 = tmp0 + tmp3;
+	int tmp13 = tmp0 - tmp3;
+	int tmp11 = tmp1 + tmp2;
+	int tmp12 = tmp1 - tmp2;
+
+	int shift = pass ? (JPEG_CONST_BITS + JPEG_PASS1_BITS) : (JPEG_CONST_BITS - JPEG_PASS1_BITS);
+	if(pass)
+	{
+		d[0*stride] = _descale(tmp10 + tmp11, JPEG_PASS1_BITS);
+		d[4*stride] = _descale(tmp10 - tmp11, JPEG_PASS1_BITS);
+	}
+	else
+	{
+		d[0*stride] = _left_shift(tmp10 + tmp11, JPEG_PASS1_BITS);
+		d[4*stride] = _left_shift(tmp10 - tmp11, JPEG_PASS1_BITS);
+	}
+
+	int z1 = (tmp12 + tmp13) * FIX_0_541196100;
+	d[2*stride] = _descale(z1 + tmp13 * FIX_0_765366865, shift);
+	d[6*stride] = _descale(z1 - tmp12 * FIX_1_847759065, shift);
+
+	//奇数部分
+	z1 = tmp4 + tmp7;
+	int z2 = tmp5 + tmp6;
+	int z3 = tmp4 + tmp6;
+	int z4 = tmp5 + tmp7;
+	int z5 = (z3 + z4) * FIX_1_175875602;
+
+	tmp4 *= FIX_0_298631336;
+	tmp5 *= FIX_2_053119869;
+	tmp6 *= FIX_3_072711026;
+	tmp7 *= FIX_1_501321110;
+	z1 *= -FIX_0_899976223;
+	z2 *= -FIX_2_562915447;
+	z3 *= -FIX_1_961570560;
+	z4 *= -FIX_0_390180644;
+
+	z3 += z5;
+	z4 += z5;
+
+	d[7*stride] = _descale(tmp4 + z1 + z3, shift);
+	d[5*stride] = _descale(tmp5 + z2 + z4, shift);
+	d[3*stride] = _descale(tmp6 + z2 + z3, shift);
+	d[1*stride] = _descale(tmp7 + z1 + z4, shift);
+}
+
+//-------------------------------------------------------------------------------
+// AAN算法的一维8点变换，只需要5次乘法
+inline void _fdct_float_1d(float* d, int stride)
+{
+	float tmp0 = d[0*stride] + d[7*stride];
+	float tmp7 = d[0*stride] - d[7*stride];
+	float tmp1 = d[1*stride] + d[6*stride];
+	float tmp6 = d[1*stride] - d[6*stride];
+	float tmp2 = d[2*stride] + d[5*stride];
+	float tmp5 = d[2*stride] - d[5*stride];
+	float tmp3 = d[3*stride] + d[4*stride];
+	float tmp4 = d[3*stride] - d[4*stride];
+
+	//偶数部分
+	float tmp10 = tmp0 + tmp3;
+	float tmp13 = tmp0 - tmp3;
+	float tmp11 = tmp1 + tmp2;
+	float tmp12 = tmp1 - tmp2;
+
+	d[0*stride] = tmp10 + tmp11;
+	d[4*stride] = tmp10 - tmp11;
+
+	float z1 = (tmp12 + tmp13) * 0.707106781f;
+	d[2*stride] = tmp13 + z1;
+	d[6*stride] = tmp13 - z1;
+
+	//奇数部分
+	tmp10 = tmp4 + tmp5;
+	tmp11 = tmp5 + tmp6;
+	tmp12 = tmp6 + tmp7;
+
+	float z5 = (tmp10 - tmp12) * 0.382683433f;
+	float z2 = 0.541196100f * tmp10 + z5;
+	float z4 = 1.306562965f * tmp12 + z5;
+	float z3 = tmp11 * 0.707106781f;
+
+	float z11 = tmp7 + z3;
+	float z13 = tmp7 - z3;
+
+	d[5*stride] = z13 + z2;
+	d[3*stride] = z13 - z2;
+	d[1*stride] = z11 + z4;
+	d[7*stride] = z11 - z4;
+}
+
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_init_divisors(const unsigned char* quant_table, JpegQuantDivisors* divisors)
+{
+	for(int v=0; v<8; v++)
+	{
+		for(int u=0; u<8; u++)
+		{
+			int i = v*8+u;
+			int q = quant_table[jpeg_zigzag[i]];
+
+			divisors->fdiv[i] = (float)(1.0 / (q * AAN_Scale_Factor[v] * AAN_Scale_Factor[u] * 8.0));
+			divisors->recip[i] = ((1<<16) + 4*q) / (8*q);
+			divisors->fdivZigzag[jpeg_zigzag[i]] = divisors->fdiv[i];
+			divisors->recipZigzag[jpeg_zigzag[i]] = divisors->recip[i];
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_fdct_islow(const char* block, int* data)
+{
+	for(int i=0; i<64; i++) data[i] = (signed char)block[i];
+
+	for(int y=0; y<8; y++) _fdct_islow_1d(data + y*8, 1, 0);
+	for(int x=0; x<8; x++) _fdct_islow_1d(data + x, 8, 1);
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_fdct_float(const char* block, float* data)
+{
+	for(int i=0; i<64; i++) data[i] = (signed char)block[i];
+
+	for(int y=0; y<8; y++) _fdct_float_1d(data + y*8, 1);
+	for(int x=0; x<8; x++) _fdct_float_1d(data + x, 8);
+}
+
+//-------------------------------------------------------------------------------
+// 相同的行做完行变换之后还相同，每一列都是常数，列变换只剩下第0行：8个相同的值相加，再去掉额外精度
+void jpeg_fdct_islow_row(const char* row, int* out)
+{
+	int d[8];
+	for(int i=0; i<8; i++) d[i] = (signed char)row[i];
+	_fdct_islow_1d(d, 1, 0);
+	for(int i=0; i<8; i++) out[i] = _descale(d[i] * 8, JPEG_PASS1_BITS);
+}
+
+//-------------------------------------------------------------------------------
+// 常数行的行变换只有第0列，为8个像素之和保留额外精度，之后只对这一列做列变换
+void jpeg_fdct_islow_column(const char* block, int* out)
+{
+	for(int i=0; i<8; i++) out[i] = _left_shift((signed char)block[i*8] * 8, JPEG_PASS1_BITS);
+	_fdct_islow_1d(out, 1, 1);
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_fdct_quant_islow(const char* block, short* coef, const JpegQuantDivisors* divisors)
+{
+	int data[64];
+	jpeg_fdct_islow(block, data);
+
+	//乘以倒数后右移，算术右移对负数也是向下取整，与浮点版本的四舍五入方式一致
+	for(int i=0; i<64; i++)
+		coef[jpeg_zigzag[i]] = (short)((data[i] * divisors->recip[i] + (1<<15)) >> 16);
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_fdct_quant_float(const char* block, short* coef, const JpegQuantDivisors* divisors)
+{
+	float data[64];
+	jpeg_fdct_float(block, data);
+
+	for(int i=0; i<64; i++)
+		coef[jpeg_zigzag[i]] = (short)((int)(data[i] * divisors->fdiv[i] + 16384.5f) - 16384);
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_quant_islow(const short* data, short* coef, const JpegQuantDivisors* divisors)
+{
+	for(int i=0; i<64; i++)
+		coef[i] = (short)((data[i] * divisors->recipZigzag[i] + (1<<15)) >> 16);
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_quant_float(const float* data, short* coef, const JpegQuantDivisors* divisors)
+{
+	for(int i=0; i<64; i++)
+		coef[i] = (short)((int)(data[i] * divisors->fdivZigzag[i] + 16384.5f) - 16384);
+}
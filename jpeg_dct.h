@@ -0,0 +1,71 @@
+#ifndef __JPEG_DCT_HEADER__
+#define __JPEG_DCT_HEADER__
+
+// 正向DCT变换引擎：行列分离的快速算法，量化步骤合并进缩放因子中
+// 提供两种实现，定点的Loeffler算法(islow)和浮点的AAN算法(float)
+
+//定点算法的精度，常数放大2^13倍，第一遍变换后保留2位额外精度
+const int JPEG_CONST_BITS = 13;
+const int JPEG_PASS1_BITS = 2;
+
+const int FIX_0_298631336 = 2446;
+const int FIX_0_390180644 = 3196;
+const int FIX_0_541196100 = 4433;
+const int FIX_0_765366865 = 6270;
+const int FIX_0_899976223 = 7373;
+const int FIX_1_175875602 = 9633;
+const int FIX_1_501321110 = 12299;
+const int FIX_1_847759065 = 15137;
+const int FIX_1_961570560 = 16069;
+const int FIX_2_053119869 = 16819;
+const int FIX_2_562915447 = 20995;
+const int FIX_3_072711026 = 25172;
+
+/** ZigZag表，自然顺序下标 -> zigzag顺序下标 */
+extern const unsigned char jpeg_zigzag[64];
+
+/** 量化除数表，按自然顺序存储，由量化表和DCT输出的缩放系数合并而来 */
+struct JpegQuantDivisors
+{
+	//浮点AAN：1/(q*aan[v]*aan[u]*8)
+	float	fdiv[64];
+	//定点islow：(1<<16)/(8*q) 的倒数乘法系数
+	int		recip[64];
+	//与上面两项相同，按zigzag顺序排列，用于量化按zigzag顺序保存的DCT输出
+	float	fdivZigzag[64];
+	int		recipZigzag[64];
+};
+
+/** 一个块的DCT+量化，输入为8*8的电平偏移后的数据，输出为zigzag顺序的量化系数 */
+typedef void (*JpegFdctQuantFunc)(const char* block, short* coef, const JpegQuantDivisors* divisors);
+
+/** 根据zigzag顺序的量化表计算除数表 */
+void jpeg_init_divisors(const unsigned char* quant_table, JpegQuantDivisors* divisors);
+
+/** 定点DCT，输出为自然顺序，数值是标准DCT系数的8倍 */
+void jpeg_fdct_islow(const char* block, int* data);
+
+/** 浮点AAN DCT，输出为自然顺序，数值带有aan[v]*aan[u]*8的缩放 */
+void jpeg_fdct_float(const char* block, float* data);
+
+/** 只在一个方向上有变化的块的定点DCT，其余56个系数都为0，非0的8个系数与jpeg_fdct_islow的结果完全相同，只需要一次一维变换。
+ *  jpeg_fdct_islow_row：每一行都相同的块，row为其中一行，out[u]为第0行第u列的系数；
+ *  jpeg_fdct_islow_column：每一行的8个像素都相同的块，out[v]为第v行第0列的系数 */
+void jpeg_fdct_islow_row(const char* row, int* out);
+void jpeg_fdct_islow_column(const char* block, int* out);
+
+/** DCT+量化的两种实现，可以直接作为JpegFdctQuantFunc使用 */
+void jpeg_fdct_quant_islow(const char* block, short* coef, const JpegQuantDivisors* divisors);
+void jpeg_fdct_quant_float(const char* block, short* coef, const JpegQuantDivisors* divisors);
+
+/** 只做DCT，与jpeg_fdct_islow/jpeg_fdct_float相同，但输出为zigzag顺序。定点DCT的输出不超过±8192，保存为short */
+typedef void (*JpegFdctIslowFunc)(const char* block, short* data);
+typedef void (*JpegFdctFloatFunc)(const char* block, float* data);
+
+/** 只量化保存下来的DCT输出，输入和输出都是zigzag顺序，结果与对应的DCT+量化完全相同 */
+typedef void (*JpegQuantIslowFunc)(const short* data, short* coef, const JpegQuantDivisors* divisors);
+typedef void (*JpegQuantFloatFunc)(const float* data, short* coef, const JpegQuantDivisors* divisors);
+void jpeg_quant_islow(const short* data, short* coef, const JpegQuantDivisors* divisors);
+void jpeg_quant_float(const float* data, short* coef, const JpegQuantDivisors* divisors);
+
+#endif
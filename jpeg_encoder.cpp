@@ -5,619 +5,1959 @@
 #include <stdio.h>
 #include <memory.h>
 #include <math.h>
+#include <vector>
 
 #include "jpeg_encoder.h"
 
 namespace {
 //-------------------------------------------------------------------------------
-//׼ 8*8洢Ϊһάʽ
-const unsigned char Luminance_Quantization_Table[64] = 
-{
-	16,  11,  10,  16,  24,  40,  51,  61,
-	12,  12,  14,  19,  26,  58,  60,  55,
-	14,  13,  16,  24,  40,  57,  69,  56,
-	14,  17,  22,  29,  51,  87,  80,  62,
-	18,  22,  37,  56,  68, 109, 103,  77,
-	24,  35,  55,  64,  81, 104, 113,  92,
-	49,  64,  78,  87, 103, 121, 120, 101,
-	72,  92,  95,  98, 112, 100, 103,  99
+//输出缓冲区的大小
+const int OUTPUT_BUFFER_SIZE = 64*1024;
+
+//-------------------------------------------------------------------------------
+//抽样前的色度临时数组，在最大的16*16的MCU外面再加一圈边框
+const int FULL_CHROMA_STRIDE = 16 + 2;
+
+//-------------------------------------------------------------------------------
+//每像素最多的字节数，用于分配边缘MCU的临时缓冲区
+const int MAX_PIXEL_SIZE = 4;
+
+//-------------------------------------------------------------------------------
+//流水线编码时每个变换线程的队列能放多少个MCU行，熵编码偶尔慢一些时变换线程不用马上等待
+const int PIPELINE_DEPTH = 4;
+
+}
+
+//-------------------------------------------------------------------------------
+JpegEncoder::JpegEncoder()
+	: m_width(0)
+	, m_height(0)
+	, m_sourceTop(0)
+	, m_chromaPlane(0)
+	, m_chromaPlaneHeight(0)
+	, m_qualityTables(0)
+	, m_kernels(jpeg_get_kernels(jpeg_detect_simd()))
+	, m_dctMethod(DCT_ISLOW)
+	, m_fdctQuant(m_kernels->fdctQuantIslow)
+	, m_huffman(&jpeg_std_huffman_tables)
+	, m_optimizedHuffman(0)
+	, m_optimizeHuffman(false)
+	, m_progressive(false)
+	, m_trellisLambda(0)
+	, m_fastBlocks(true)
+	, m_coefficientsReady(false)
+	, m_dctOutput(0)
+	, m_dct(0)
+	, m_outputBuffer(0)
+	, m_subsampling(SUBSAMPLE_444)
+	, m_chromaFilter(CHROMA_BOX)
+	, m_hSamp(1)
+	, m_vSamp(1)
+	, m_componentCount(3)
+	, m_restartInterval(0)
+	, m_streamWriter(0)
+	, m_threadPool(0)
+	, m_pipelined(false)
+	, m_statsStartCycles(0)
+{
+	memset(&m_source, 0, sizeof(m_source));
+}
+
+//-------------------------------------------------------------------------------
+JpegEncoder::~JpegEncoder()
+{
+	//结束时调用
+	clean();
+
+	if(m_outputBuffer) delete[] m_outputBuffer;
+	m_outputBuffer=0;
+
+	if(m_optimizedHuffman) delete m_optimizedHuffman;
+	m_optimizedHuffman=0;
+
+	if(m_streamWriter) delete m_streamWriter;
+	m_streamWriter=0;
+
+	if(m_threadPool) delete m_threadPool;
+	m_threadPool=0;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::setDctMethod(DctMethod method)
+{
+	m_dctMethod = method;
+	m_fdctQuant = (method==DCT_FLOAT) ? m_kernels->fdctQuantFloat : m_kernels->fdctQuantIslow;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::setSimdLevel(JpegSimdLevel level)
+{
+	const JpegKernels* kernels = jpeg_get_kernels(level);
+	if(kernels==0 || level>jpeg_detect_simd()) return false;
+
+	m_kernels = kernels;
+	setDctMethod(m_dctMethod);
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::setSubsampling(Subsampling mode, ChromaFilter filter)
+{
+	m_subsampling = mode;
+	m_chromaFilter = filter;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::setRestartInterval(int mcus)
+{
+	if(mcus<0) mcus=0;
+	if(mcus>0xFFFF) mcus=0xFFFF;
+	m_restartInterval = mcus;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::setThreadCount(int threads)
+{
+	if(m_threadPool) delete m_threadPool;
+	m_threadPool = (threads>1) ? new JpegThreadPool(threads) : 0;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::clean(void)
+{
+	//解除BMP文件的映射
+	m_bmpFile.close();
+
+	m_width=0;
+	m_height=0;
+}
+
+//-------------------------------------------------------------------------------
+// 将位图文件映射到内存中，编码时按图像从上至下的顺序直接读取，行的对齐和存储方向由JpegBmpFile处理
+bool JpegEncoder::readFromBMP(const char* fileName)
+{
+	//开始时清理旧数据
+	clean();
+
+	if(!m_bmpFile.open(fileName)) return false;
+
+	//任意尺寸都可以编码，右边和下边不足一块的部分在取块时重复边缘的像素
+	const JpegImageView& view = m_bmpFile.view();
+	m_width = view.width;
+	m_height = view.height;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::encodeToJPG(const char* fileName, int quality_scale)
+{
+	//尚未读取？
+	if(!m_bmpFile.isOpen() || m_width==0 || m_height==0) return false;
+
+	//输出文件，写满一个缓冲区就在后台写出，编码继续
+	if(!m_fileOutput.open(fileName)) return false;
+
+	const JpegImageView& view = m_bmpFile.view();
+	bool successed = encode(view.pixels, view.width, view.height, view.stride, view.format, quality_scale, m_fileOutput);
+
+	//关闭时等待所有写入完成，写入失败也算编码失败
+	if(!m_fileOutput.close()) successed = false;
+
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::encode(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+	int quality_scale, JpegOutput& output)
+{
+	if(pixels==0 || !_checkImage(width, height, format)) return false;
+	if(m_streamWriter) return false;
+	if(!_setSource(pixels, width, height, stride, format)) return false;
+
+	return _encodeSource(quality_scale, output);
+}
+
+//-------------------------------------------------------------------------------
+// 区域的左上角直接作为图像的起点，stride沿用整幅图像的，不复制像素。
+// 平面格式的色度平面仍然在整幅图像的Y平面之后，单独算出区域在色度平面中的起点
+bool JpegEncoder::encodeRegion(const JpegImageView& image, int x, int y, int width, int height, 
+	int quality_scale, JpegOutput& output)
+{
+	if(image.pixels==0 || !_checkImage(width, height, image.format)) return false;
+	if(x<0 || y<0 || x > image.width - width || y > image.height - height) return false;
+	if(m_streamWriter) return false;
+
+	bool planar = jpeg_pixel_planar(image.format);
+	if(planar && ((x|y) & 1)) return false;
+
+	const unsigned char* pixels = image.pixels + (long long)y * image.stride + x * jpeg_pixel_size(image.format);
+	if(!_setSource(pixels, width, height, image.stride, image.format)) return false;
+
+	if(planar)
+	{
+		//I420的U、V平面相邻，_convertPlanarMcu由U平面的起点和色度平面的高度找到V平面，这里的高度要用整幅图像的
+		const unsigned char* chroma = image.pixels + (long long)image.height * image.stride;
+		if(image.format==JPEG_PIXEL_NV12)
+		{
+			m_chromaPlane = chroma + (long long)(y/2) * image.stride + x;
+		}
+		else
+		{
+			int chromaStride = (image.stride + 1) / 2;
+			m_chromaPlane = chroma + (long long)(y/2) * chromaStride + x/2;
+			m_chromaPlaneHeight = (image.height + 1) / 2;
+		}
+	}
+
+	return _encodeSource(quality_scale, output);
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_encodeSource(int quality_scale, JpegOutput& output)
+{
+	_beginStats();
+
+	//初始化量化表
+	_initQualityTables(quality_scale);
+
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcuCount = ((m_source.width + mcuWidth - 1) / mcuWidth) * ((m_source.height + mcuHeight - 1) / mcuHeight);
+
+	//两遍编码和渐进式编码：先做完所有MCU的DCT和量化，之后直接对保存的系数做熵编码
+	if(m_optimizeHuffman || m_progressive)
+	{
+		_transformAll(mcuCount);
+		m_coefficientsReady = true;
+	}
+
+	bool successed = _writeImage(mcuCount, output);
+
+	m_source.pixels = 0;
+	m_coefficientsReady = false;
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_encodeDirty(int quality_scale, const unsigned char* dirty, std::vector< std::vector<unsigned char> >* segments, 
+	JpegOutput& output)
+{
+	_beginStats();
+
+	_initQualityTables(quality_scale);
+
+	//m_coefficients的划分与上一帧相同时reset不改变其中的数据，没有标记的MCU直接沿用
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcuCount = ((m_source.width + mcuWidth - 1) / mcuWidth) * ((m_source.height + mcuHeight - 1) / mcuHeight);
+	_transformAll(mcuCount, TRANSFORM_QUANTIZED, dirty);
+	m_coefficientsReady = true;
+
+	bool successed = _writeImage(mcuCount, output, dirty, segments);
+
+	m_source.pixels = 0;
+	m_coefficientsReady = false;
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_writeImage(int mcuCount, JpegOutput& output, 
+	const unsigned char* dirty, std::vector< std::vector<unsigned char> >* segments)
+{
+	//渐进式编码的霍夫曼表在每次扫描之前生成
+	if(m_optimizeHuffman && !m_progressive) _optimizeHuffmanTables(mcuCount);
+
+	//输出先写入内存缓冲区，满了再一次写入文件
+	if(m_outputBuffer==0) m_outputBuffer = new unsigned char[OUTPUT_BUFFER_SIZE];
+	JpegBitWriter writer(m_outputBuffer, OUTPUT_BUFFER_SIZE, JpegOutput::writeCallback, &output);
+	JpegBitWriter* out = &writer;
+
+	//文件头
+	_write_jpeg_header(out);
+
+	if(m_progressive)
+	{
+		_encodeProgressive(out);
+	}
+	else if(segments && m_restartInterval>0 && m_huffman==&jpeg_std_huffman_tables)
+	{
+		_encodeSegments(mcuCount, dirty, *segments, out);
+	}
+	else if(m_threadPool && m_restartInterval>0)
+	{
+		_encodeStripes(mcuCount, out);
+	}
+	else if(m_threadPool && m_pipelined && !m_coefficientsReady)
+	{
+		_encodePipelined(mcuCount, out);
+	}
+	else
+	{
+		short prevDC[3] = { 0, 0, 0 };
+		_encodeMcus(0, mcuCount, prevDC, out, &m_stats);
+	}
+
+	//flush remain data
+	out->flushBits();
+	_write_word_(0xFFD9, out); //Write End of Image Marker   
+	out->flush();
+
+	_endStats(out);
+
+	//恢复标准霍夫曼表
+	m_huffman = &jpeg_std_huffman_tables;
+
+	return !out->hasError();
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::encodeToSize(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+	int maxBytes, JpegOutput& output, int* quality_scale)
+{
+	return _encodeToTarget(pixels, width, height, stride, format, false, maxBytes, output, quality_scale);
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::encodeToPsnr(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+	double minPsnr, JpegOutput& output, int* quality_scale)
+{
+	return _encodeToTarget(pixels, width, height, stride, format, true, minPsnr, output, quality_scale);
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_encodeToTarget(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+	bool psnrTarget, double target, JpegOutput& output, int* quality_scale)
+{
+	if(pixels==0 || !_checkImage(width, height, format)) return false;
+	if(m_streamWriter) return false;
+	if(!_setSource(pixels, width, height, stride, format)) return false;
+
+	_beginStats();
+
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcuCount = ((width + mcuWidth - 1) / mcuWidth) * ((height + mcuHeight - 1) / mcuHeight);
+
+	//颜色转换和DCT只做一次
+	m_dctOutput = &m_dctStore;
+	m_dct = &m_dctStore;
+	_transformAll(mcuCount, TRANSFORM_RAW);
+	m_coefficientsReady = true;
+
+	//quality_scale越大压缩越多，文件越小、PSNR越低。
+	//大小目标找放得下的最小quality_scale，PSNR目标找达标的最大quality_scale
+	int best = 0;
+	int low = 1, high = 99;
+	while(low <= high)
+	{
+		int quality = (low + high) / 2;
+		_initQualityTables(quality);
+		_transformAll(mcuCount, TRANSFORM_REQUANTIZE);
+
+		bool met;
+		if(psnrTarget)
+		{
+			met = _lumaPsnr() >= target;
+		}
+		else
+		{
+			//只数字节数，数据直接丢掉
+			JpegCountingOutput counter;
+			met = _writeImage(mcuCount, counter) && counter.size() <= (long long)target;
+		}
+
+		if(met) best = quality;
+		//PSNR目标达标时试更大的quality_scale，大小目标放得下时试更小的
+		if(met == psnrTarget)
+			low = quality + 1;
+		else
+			high = quality - 1;
+	}
+
+	bool successed = false;
+	if(best > 0)
+	{
+		_initQualityTables(best);
+		_transformAll(mcuCount, TRANSFORM_REQUANTIZE);
+
+		//各阶段的耗时包括所有的尝试，符号和字节数只统计最终的输出
+		JpegEncodeStats cycles = m_stats;
+		m_stats.reset();
+		m_stats.colorCycles = cycles.colorCycles;
+		m_stats.dctCycles = cycles.dctCycles;
+		m_stats.entropyCycles = cycles.entropyCycles;
+		m_stats.outputCycles = cycles.outputCycles;
+
+		successed = _writeImage(mcuCount, output);
+		if(quality_scale) *quality_scale = best;
+	}
+
+	m_source.pixels = 0;
+	m_coefficientsReady = false;
+	m_dctOutput = 0;
+	m_dct = 0;
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::transform(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+	JpegDctStore& store)
+{
+	if(pixels==0 || !_checkImage(width, height, format)) return false;
+	if(m_streamWriter) return false;
+	if(!_setSource(pixels, width, height, stride, format)) return false;
+
+	_beginStats();
+
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcuCount = ((width + mcuWidth - 1) / mcuWidth) * ((height + mcuHeight - 1) / mcuHeight);
+
+	m_dctOutput = &store;
+	_transformAll(mcuCount, TRANSFORM_RAW);
+	m_dctOutput = 0;
+
+	m_source.pixels = 0;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+// 文件头只用到宽高、分量数和抽样因子，都从store中取得，不需要像素
+bool JpegEncoder::encodeCoefficients(const JpegDctStore& store, int quality_scale, JpegOutput& output)
+{
+	if(store.empty()) return false;
+	if(m_streamWriter) return false;
+
+	memset(&m_source, 0, sizeof(m_source));
+	m_source.width = store.width();
+	m_source.height = store.height();
+	m_componentCount = store.componentCount();
+	m_hSamp = store.hSamp();
+	m_vSamp = store.vSamp();
+
+	_beginStats();
+
+	_initQualityTables(quality_scale);
+
+	//与_encodeSource一样，两遍编码和渐进式编码先量化所有MCU，基线编码在熵编码时逐个MCU量化
+	int mcuCount = store.mcuCount();
+	m_dct = &store;
+	if(m_optimizeHuffman || m_progressive)
+	{
+		m_coefficients.reset(m_source.width, m_source.height, m_hSamp, m_vSamp, m_componentCount);
+		_transformAll(mcuCount, TRANSFORM_REQUANTIZE);
+		m_coefficientsReady = true;
+	}
+
+	bool successed = _writeImage(mcuCount, output);
+
+	m_coefficientsReady = false;
+	m_dct = 0;
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+double JpegEncoder::_lumaPsnr(void)
+{
+	const JpegQuantDivisors& divisors = m_qualityTables->yDivisors;
+
+	//DCT是正交变换，系数的误差平方和等于IDCT输出(还没有取整)的误差平方和。
+	//x为未量化的系数除以量化步长，误差为(x - 量化结果)^2 * 步长^2
+	const unsigned char* table = m_qualityTables->yTable;
+	double step2[64];
+	for(int i=0; i<64; i++)
+		step2[i] = (double)table[jpeg_zigzag[i]] * table[jpeg_zigzag[i]];
+
+	int blocksWide = m_coefficients.blocksWide(0), blocksHigh = m_coefficients.blocksHigh(0);
+	double error = 0;
+	for(int by=0; by<blocksHigh; by++)
+	{
+		for(int bx=0; bx<blocksWide; bx++)
+		{
+			//MCU补齐的部分不计
+			int mcu = (by/m_vSamp)*m_coefficients.mcusPerLine() + bx/m_hSamp;
+			int block = (by%m_vSamp)*m_hSamp + bx%m_hSamp;
+			float data[64];
+			m_dct->loadBlock(mcu, block, data);
+			const short* coef = m_coefficients.block(0, bx, by);
+			for(int i=0; i<64; i++)
+			{
+				double x = m_dct->isFloat() ? data[i] * divisors.fdiv[i] : data[i] * divisors.recip[i] / 65536.0;
+				double diff = x - coef[jpeg_zigzag[i]];
+				error += diff * diff * step2[i];
+			}
+		}
+	}
+
+	//块中超出图像的部分(边缘重复的像素)的误差也算在图像内的像素上，估计偏大一些。
+	//解码器还要把每个像素取整，均匀分布的取整误差再加上1/12
+	double mse = error / ((double)m_source.width * m_source.height) + 1.0 / 12.0;
+	return 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_checkImage(int width, int height, JpegPixelFormat format)
+{
+	if(width<=0 || height<=0 || width>0xFFFF || height>0xFFFF) return false;
+	if(format<0 || format>=JPEG_PIXEL_FORMAT_COUNT) return false;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_setSource(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format)
+{
+	//平面格式的色度平面紧接在Y平面之后，由stride推算位置
+	if(jpeg_pixel_planar(format) && stride<width) return false;
+	//NV12的色度行有(width+1)/2对U、V，宽度为奇数时比Y行多一个字节
+	if(format==JPEG_PIXEL_NV12 && stride < ((width+1)&~1)) return false;
+
+	m_source.pixels = pixels;
+	m_source.width = width;
+	m_source.height = height;
+	m_source.stride = stride;
+	m_source.format = format;
+	m_chromaPlane = pixels ? pixels + (long long)height * stride : 0;
+	m_chromaPlaneHeight = (height + 1) / 2;
+
+	m_componentCount = jpeg_pixel_components(format);
+	if(m_componentCount==1)
+	{
+		m_hSamp = m_vSamp = 1;
+	}
+	else if(jpeg_pixel_planar(format))
+	{
+		m_hSamp = m_vSamp = 2;
+	}
+	else
+	{
+		m_hSamp = (m_subsampling==SUBSAMPLE_444) ? 1 : 2;
+		m_vSamp = (m_subsampling==SUBSAMPLE_420) ? 2 : 1;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::begin(int width, int height, JpegPixelFormat format, int quality_scale, JpegOutput& output)
+{
+	if(!_checkImage(width, height, format) || jpeg_pixel_planar(format)) return false;
+	if(m_streamWriter || m_progressive || m_optimizeHuffman) return false;
+
+	//条带缓冲区：一个MCU行，再加上面一行和下面一行，只在色度滤波时用到
+	int bandStride = width * jpeg_pixel_size(format);
+	_setSource(0, width, height, bandStride, format);
+	int mcuHeight = m_vSamp*8;
+	m_band.resize((size_t)(mcuHeight + 2) * bandStride);
+
+	m_source.pixels = &m_band[0];
+	m_sourceTop = -1;
+
+	m_streamRows = 0;
+	m_streamDC[0] = m_streamDC[1] = m_streamDC[2] = 0;
+
+	_beginStats();
+
+	_initQualityTables(quality_scale);
+
+	if(m_outputBuffer==0) m_outputBuffer = new unsigned char[OUTPUT_BUFFER_SIZE];
+	m_streamWriter = new JpegBitWriter(m_outputBuffer, OUTPUT_BUFFER_SIZE, JpegOutput::writeCallback, &output);
+
+	_write_jpeg_header(m_streamWriter);
+	return !m_streamWriter->hasError();
+}
+
+//-------------------------------------------------------------------------------
+// 第y行放在条带缓冲区的第(y - m_sourceTop)行。一行MCU收齐之后，还要等到下一行MCU的第一行
+// (或者图像结束)才编码，这样三角滤波需要的下一行也已经在缓冲区中
+bool JpegEncoder::writeRows(const unsigned char* pixels, int rows, int stride)
+{
+	if(m_streamWriter==0 || pixels==0 || rows<0) return false;
+	if(rows > m_source.height - m_streamRows) return false;
+
+	int mcuHeight = m_vSamp*8;
+	for(int i=0; i<rows; i++)
+	{
+		int y = m_streamRows++;
+		memcpy(&m_band[(size_t)(y - m_sourceTop) * m_source.stride], pixels + (long long)i * stride, m_source.stride);
+
+		//下一行MCU的第一行到了，当前这行MCU可以编码了
+		if(y - m_sourceTop == mcuHeight + 1) _encodeBand();
+		//图像的最后一行
+		if(y == m_source.height - 1) _encodeBand();
+	}
+	return !m_streamWriter->hasError();
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodeBand(void)
+{
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcusPerLine = (m_source.width + mcuWidth - 1) / mcuWidth;
+	int mcuRow = (m_sourceTop + 1) / mcuHeight;
+
+	_encodeMcus(mcuRow * mcusPerLine, (mcuRow + 1) * mcusPerLine, m_streamDC, m_streamWriter, &m_stats);
+
+	//这一行MCU的最后一行成为下一个条带上面的那一行，已经收到的下一行MCU的第一行也随之移动
+	size_t rowSize = m_source.stride;
+	memmove(&m_band[0], &m_band[mcuHeight * rowSize], 2 * rowSize);
+	m_sourceTop += mcuHeight;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::finish(void)
+{
+	if(m_streamWriter==0) return false;
+
+	JpegBitWriter* out = m_streamWriter;
+	out->flushBits();
+	_write_word_(0xFFD9, out); //Write End of Image Marker   
+	out->flush();
+
+	bool successed = !out->hasError() && m_streamRows == m_source.height;
+	_endStats(out);
+
+	delete m_streamWriter;
+	m_streamWriter = 0;
+	m_source.pixels = 0;
+	m_sourceTop = 0;
+
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_convertMcu(int mcu, char* yData, char* cbData, char* crData)
+{
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int mcusPerLine = (m_source.width + mcuWidth - 1) / mcuWidth;
+	int pixelSize = jpeg_pixel_size(m_source.format);
+
+	int yPos = (mcu/mcusPerLine) * mcuHeight;
+	int xPos = (mcu%mcusPerLine) * mcuWidth;
+
+	if(jpeg_pixel_planar(m_source.format))
+	{
+		_convertPlanarMcu(xPos, yPos, yData, cbData, crData);
+		return;
+	}
+
+	unsigned char edge[16*16*MAX_PIXEL_SIZE];
+
+	const unsigned char* pixels = _sourceRow(yPos) + xPos * pixelSize;
+	int stride = m_source.stride;
+	if(xPos + mcuWidth > m_source.width || yPos + mcuHeight > m_source.height)
+	{
+		_copyEdgeMcu(xPos, yPos, edge);
+		pixels = edge;
+		stride = mcuWidth * pixelSize;
+	}
+	_convertColorSpace(pixels, stride, xPos, yPos, yData, cbData, crData);
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_transformMcu(int mcu, short* coef, JpegEncodeStats* stats)
+{
+	JPEG_STATS(bool timed = jpeg_stats_sampled(mcu));
+	JPEG_STATS(unsigned long long start = timed ? jpeg_cycles() : 0);
+
+	int yBlocks = m_hSamp*m_vSamp;
+	char yData[4*64], cbData[64], crData[64];
+
+	//转换颜色空间
+	_convertMcu(mcu, yData, cbData, crData);
+
+	JPEG_STATS(unsigned long long middle = timed ? jpeg_cycles() : 0);
+	JPEG_STATS(if(timed) stats->colorCycles += (middle - start) * JPEG_STATS_SAMPLE_INTERVAL);
+
+	//DCT和量化，MCU中的亮度块按从左到右、从上到下的顺序
+	if(m_trellisLambda > 0)
+	{
+		//trellis量化需要未量化的系数
+		for(int b=0; b<yBlocks+m_componentCount-1; b++)
+		{
+			const char* data = b<yBlocks ? yData + b*64 : (b==yBlocks ? cbData : crData);
+			int component = b<yBlocks ? 0 : 1;
+			float raw[64];
+			if(!m_fastBlocks || !_fastDct(data, component, 0, raw, stats)) _dctRaw(data, raw);
+			_quantizeBlock(raw, coef + b*64, component, m_dctMethod==DCT_FLOAT);
+		}
+	}
+	else
+	{
+		for(int b=0; b<yBlocks+m_componentCount-1; b++)
+		{
+			const char* data = b<yBlocks ? yData + b*64 : (b==yBlocks ? cbData : crData);
+			int component = b<yBlocks ? 0 : 1;
+			if(m_fastBlocks && _fastDct(data, component, coef + b*64, 0, stats)) continue;
+			_foword_FDC(data, coef + b*64, component==0 ? &m_qualityTables->yDivisors : &m_qualityTables->cbcrDivisors);
+		}
+	}
+
+	JPEG_STATS(if(timed) stats->dctCycles += (jpeg_cycles() - middle) * JPEG_STATS_SAMPLE_INTERVAL);
+#ifdef JPEG_NO_STATS
+	(void)stats;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_transformMcuRaw(int mcu, JpegEncodeStats* stats)
+{
+	JPEG_STATS(bool timed = jpeg_stats_sampled(mcu));
+	JPEG_STATS(unsigned long long start = timed ? jpeg_cycles() : 0);
+
+	int blocks = m_coefficients.blocksPerMcu();
+	int yBlocks = m_hSamp*m_vSamp;
+	char data[6*64];
+
+	//亮度块、Cb块、Cr块正好连续存放，灰度图像只有亮度块
+	_convertMcu(mcu, data, data + yBlocks*64, data + (yBlocks+1)*64);
+
+	JPEG_STATS(unsigned long long middle = timed ? jpeg_cycles() : 0);
+	JPEG_STATS(if(timed) stats->colorCycles += (middle - start) * JPEG_STATS_SAMPLE_INTERVAL);
+
+	//与_foword_FDC使用同一个指令集的DCT，重新量化的结果与直接编码逐位相同
+	if(m_dctMethod==DCT_FLOAT)
+	{
+		float* raw = m_dctOutput->floatMcu(mcu);
+		for(int b=0; b<blocks; b++)
+			m_kernels->fdctFloat(data + b*64, raw + b*64);
+	}
+	else
+	{
+		short* raw = m_dctOutput->islowMcu(mcu);
+		for(int b=0; b<blocks; b++)
+			m_kernels->fdctIslow(data + b*64, raw + b*64);
+	}
+
+	JPEG_STATS(if(timed) stats->dctCycles += (jpeg_cycles() - middle) * JPEG_STATS_SAMPLE_INTERVAL);
+#ifdef JPEG_NO_STATS
+	(void)stats;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_dctRaw(const char* data, float* raw)
+{
+	if(m_dctMethod==DCT_FLOAT)
+	{
+		float zigzag[64];
+		m_kernels->fdctFloat(data, zigzag);
+		for(int i=0; i<64; i++) raw[i] = zigzag[jpeg_zigzag[i]];
+	}
+	else
+	{
+		short zigzag[64];
+		m_kernels->fdctIslow(data, zigzag);
+		for(int i=0; i<64; i++) raw[i] = (float)zigzag[jpeg_zigzag[i]];
+	}
+}
+
+//-------------------------------------------------------------------------------
+bool JpegEncoder::_fastDct(const char* data, int component, short* coef, float* raw, JpegEncodeStats* stats)
+{
+	const JpegQuantDivisors* divisors = component==0 ? &m_qualityTables->yDivisors : &m_qualityTables->cbcrDivisors;
+	int flatRange = component==0 ? m_qualityTables->yFlatRange : m_qualityTables->cbcrFlatRange;
+
+	//平坦的块：AC系数量化后都为0，两种DCT的DC都正好是64个像素之和
+	int sum;
+	if(jpeg_block_range(data, &sum) <= flatRange)
+	{
+		JPEG_STATS(stats->flatBlocks++);
+		if(raw)
+		{
+			memset(raw, 0, 64*sizeof(float));
+			raw[0] = (float)sum;
+		}
+		else if(m_dctMethod==DCT_FLOAT)
+		{
+			//浮点的舍入交给同一个指令集的量化内核，与完整的DCT+量化逐位相同
+			float dct[64] = { 0 };
+			dct[0] = (float)sum;
+			m_kernels->quantFloat(dct, coef, divisors);
+		}
+		else
+		{
+			memset(coef, 0, 64*sizeof(short));
+			coef[0] = (short)((sum * divisors->recip[0] + (1<<15)) >> 16);
+		}
+		return true;
+	}
+
+	//浮点DCT的向量内核与标量实现的舍入不一定相同，一维DCT只用于定点DCT
+	if(m_dctMethod==DCT_FLOAT) return false;
+
+	//每一行都与第一行相同时只有第0行系数，每一行的8个像素都相同时只有第0列系数
+	unsigned long long first, row;
+	memcpy(&first, data, 8);
+	int y = 1;
+	for(; y<8; y++)
+	{
+		memcpy(&row, data + y*8, 8);
+		if(row != first) break;
+	}
+
+	int line[8], step;
+	if(y==8)
+	{
+		jpeg_fdct_islow_row(data, line);
+		step = 1;
+	}
+	else
+	{
+		for(y=0; y<8; y++)
+		{
+			memcpy(&row, data + y*8, 8);
+			if(row != (unsigned char)data[y*8] * 0x0101010101010101ULL) return false;
+		}
+		jpeg_fdct_islow_column(data, line);
+		step = 8;
+	}
+	JPEG_STATS(stats->reducedBlocks++);
+#ifdef JPEG_NO_STATS
+	(void)stats;
+#endif
+
+	if(raw)
+	{
+		memset(raw, 0, 64*sizeof(float));
+		for(int k=0; k<8; k++) raw[k*step] = (float)line[k];
+	}
+	else
+	{
+		memset(coef, 0, 64*sizeof(short));
+		for(int k=0; k<8; k++)
+			coef[jpeg_zigzag[k*step]] = (short)((line[k] * divisors->recip[k*step] + (1<<15)) >> 16);
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_requantizeMcu(int mcu, short* coef, JpegEncodeStats* stats)
+{
+	JPEG_STATS(bool timed = jpeg_stats_sampled(mcu));
+	JPEG_STATS(unsigned long long start = timed ? jpeg_cycles() : 0);
+
+	int blocks = m_dct->blocksPerMcu();
+	int yBlocks = m_hSamp*m_vSamp;
+	if(m_trellisLambda > 0)
+	{
+		float raw[64];
+		for(int b=0; b<blocks; b++)
+		{
+			m_dct->loadBlock(mcu, b, raw);
+			_quantizeBlock(raw, coef + b*64, (b < yBlocks) ? 0 : 1, m_dct->isFloat());
+		}
+	}
+	else
+	{
+		//普通的量化直接用向量化的内核
+		for(int b=0; b<blocks; b++)
+		{
+			const JpegQuantDivisors* divisors = (b < yBlocks) ? &m_qualityTables->yDivisors : &m_qualityTables->cbcrDivisors;
+			if(m_dct->isFloat())
+				m_kernels->quantFloat(m_dct->floatMcu(mcu) + b*64, coef + b*64, divisors);
+			else
+				m_kernels->quantIslow(m_dct->islowMcu(mcu) + b*64, coef + b*64, divisors);
+		}
+	}
+
+	JPEG_STATS(if(timed) stats->dctCycles += (jpeg_cycles() - start) * JPEG_STATS_SAMPLE_INTERVAL);
+#ifdef JPEG_NO_STATS
+	(void)stats;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_quantizeBlock(const float* raw, short* coef, int component, bool floatDct)
+{
+	const JpegQuantDivisors* divisors = component==0 ? &m_qualityTables->yDivisors : &m_qualityTables->cbcrDivisors;
+
+	//舍入方式与jpeg_fdct_quant_islow/jpeg_fdct_quant_float相同，islow的输出是整数，存成float没有误差
+	float scaled[64];
+	if(floatDct)
+	{
+		for(int i=0; i<64; i++)
+		{
+			float x = raw[i] * divisors->fdiv[i];
+			coef[jpeg_zigzag[i]] = (short)((int)(x + 16384.5f) - 16384);
+			scaled[jpeg_zigzag[i]] = x;
+		}
+	}
+	else
+	{
+		for(int i=0; i<64; i++)
+		{
+			coef[jpeg_zigzag[i]] = (short)(((int)raw[i] * divisors->recip[i] + (1<<15)) >> 16);
+			scaled[jpeg_zigzag[i]] = raw[i] * divisors->recip[i] * (1.0f/65536);
+		}
+	}
+
+	if(m_trellisLambda > 0)
+	{
+		//亮度和色度用同一个尺度(亮度量化表)，使整幅图像最小化同一个 失真 + lambda*位数。
+		//抽样后一个色度块覆盖hSamp*vSamp倍的像素，失真要乘以这个面积，等价于lambda除以它
+		float lambda = m_trellisLambda * m_qualityTables->trellisScale;
+		if(component>0) lambda /= (float)(m_hSamp*m_vSamp);
+
+		const unsigned char* table = component==0 ? m_qualityTables->yTable : m_qualityTables->cbcrTable;
+		jpeg_trellis_quantize(scaled, coef, table, m_huffman->codes[component==0 ? 1 : 3], lambda);
+	}
+}
+
+//-------------------------------------------------------------------------------
+struct JpegEncoder::TransformJob
+{
+	JpegEncoder*	encoder;
+	TransformMode	mode;
+	int				mcuCount;
+	int				chunkCount;
+	//不为0时只处理标记了的MCU
+	const unsigned char*	dirty;
+	//每段各自的统计
+	JpegEncodeStats*	stats;
 };
 
-//-------------------------------------------------------------------------------
-//׼ɫ 8*8洢Ϊһάʽ
-const unsigned char Chrominance_Quantization_Table[64] = 
-{
-	17,  18,  24,  47,  99,  99,  99,  99,
-	18,  21,  26,  66,  99,  99,  99,  99,
-	24,  26,  56,  99,  99,  99,  99,  99,
-	47,  66,  99,  99,  99,  99,  99,  99,
-	99,  99,  99,  99,  99,  99,  99,  99,
-	99,  99,  99,  99,  99,  99,  99,  99,
-	99,  99,  99,  99,  99,  99,  99,  99,
-	99,  99,  99,  99,  99,  99,  99,  99
-};
+//-------------------------------------------------------------------------------
+void JpegEncoder::_transformTask(void* context, int index)
+{
+	TransformJob* job = (TransformJob*)context;
+	JpegEncoder* encoder = job->encoder;
+
+	int firstMcu = (int)((long long)index * job->mcuCount / job->chunkCount);
+	int endMcu = (int)((long long)(index+1) * job->mcuCount / job->chunkCount);
+	for(int mcu=firstMcu; mcu<endMcu; mcu++)
+	{
+		if(job->dirty && !job->dirty[mcu]) continue;
+
+		switch(job->mode)
+		{
+		case TRANSFORM_QUANTIZED:
+			encoder->_transformMcu(mcu, encoder->m_coefficients.mcu(mcu), &job->stats[index]);
+			break;
+		case TRANSFORM_RAW:
+			encoder->_transformMcuRaw(mcu, &job->stats[index]);
+			break;
+		case TRANSFORM_REQUANTIZE:
+			encoder->_requantizeMcu(mcu, encoder->m_coefficients.mcu(mcu), &job->stats[index]);
+			break;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_transformAll(int mcuCount, TransformMode mode, const unsigned char* dirty)
+{
+	//重新量化时沿用已有的划分
+	if(mode != TRANSFORM_REQUANTIZE)
+		m_coefficients.reset(m_source.width, m_source.height, m_hSamp, m_vSamp, m_componentCount);
+	if(mode == TRANSFORM_RAW)
+		m_dctOutput->reset(m_source.width, m_source.height, m_hSamp, m_vSamp, m_componentCount, m_dctMethod==DCT_FLOAT);
+
+	TransformJob job;
+	job.encoder = this;
+	job.mode = mode;
+	job.mcuCount = mcuCount;
+	job.dirty = dirty;
+	job.chunkCount = m_threadPool ? m_threadPool->threadCount() * 4 : 1;
+	if(job.chunkCount > mcuCount) job.chunkCount = mcuCount;
+
+	m_chunkStats.resize(job.chunkCount);
+	for(int i=0; i<job.chunkCount; i++) m_chunkStats[i].reset();
+	job.stats = &m_chunkStats[0];
+
+	if(m_threadPool)
+		m_threadPool->parallelFor(job.chunkCount, _transformTask, &job);
+	else
+		_transformTask(&job, 0);
+
+	for(int i=0; i<job.chunkCount; i++) m_stats.add(m_chunkStats[i]);
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodeMcus(int firstMcu, int endMcu, short* prevDC, JpegBitWriter* out, JpegEncodeStats* stats, 
+	const short* coef)
+{
+	int yBlocks = m_hSamp*m_vSamp;
+	int mcuSize = (yBlocks + m_componentCount - 1) * 64;
+	short prev_DC_Y = prevDC[0], prev_DC_Cb = prevDC[1], prev_DC_Cr = prevDC[2];
+
+	short mcuCoef[6*64];
+
+	for(int mcu=firstMcu; mcu<endMcu; mcu++)
+	{
+		//每个复位间隔开始时补齐字节，写入RSTn标记，DC的预测值清零
+		if(m_restartInterval>0 && mcu>0 && mcu%m_restartInterval==0)
+		{
+			out->flushBits();
+			_write_word_((unsigned short)(0xFFD0 + ((mcu/m_restartInterval - 1) & 7)), out);
+			prev_DC_Y = prev_DC_Cb = prev_DC_Cr = 0;
+		}
+
+		//两遍编码时直接使用第一遍保存的量化结果，编码保存的DCT系数时逐个MCU量化
+		const short* data = mcuCoef;
+		if(coef)
+			data = coef + (mcu - firstMcu) * mcuSize;
+		else if(m_coefficientsReady)
+			data = m_coefficients.mcu(mcu);
+		else if(m_dct)
+			_requantizeMcu(mcu, mcuCoef, stats);
+		else
+			_transformMcu(mcu, mcuCoef, stats);
 
-//-------------------------------------------------------------------------------
-// ZigZagڽDCT任õϵгһһά飬ע⵽зʽǰյƵƵ˳򣬼Ͻŵ½ǡĿΪ˸ЧĽкر
-const char ZigZag[64] =
-{ 
-	0, 1, 5, 6,14,15,27,28,
-	2, 4, 7,13,16,26,29,42,
-	3, 8,12,17,25,30,41,43,
-	9,11,18,24,31,40,44,53,
-	10,19,23,32,39,45,52,54,
-	20,22,33,38,46,51,55,60,
-	21,34,37,47,50,56,59,61,
-	35,36,48,49,57,58,62,63 
-};     
-
-//-------------------------------------------------------------------------------
-// Ƕһά飬б롣
-//ǣ1.ʹг̱룬0ĸһyǰx㣬Ϊ(X,Y)һάĵһֱֵDCֵֵΪ(0,Y)
-//2.Yб룬õJPEGṩһű׼һϢZϳϢıλ
-//3.XZϲһʮʽM
-//4.ʱٷֱõֱֵıͽֵıȿܸ󣩣ֱֱֵMͽֵMб롣
-
-
-//ȷDCֵMıϢһʾ볤Ϊ+1ıֵĸ
-const char Standard_DC_Luminance_NRCodes[] = { 0, 0, 7, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
-//ʾȷDCֵMֵֵƵɸߵУͬʱҲӦһı볤ȵ˳򡣼еǰ7Ԫ3λб룬εĺ1Ԫ4λб
-const unsigned char Standard_DC_Luminance_Values[] = { 4, 5, 3, 2, 6, 1, 0, 7, 8, 9, 10, 11 };
-
-//-------------------------------------------------------------------------------
-//ƣֻӦɫȷDC
-const char Standard_DC_Chrominance_NRCodes[] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
-const unsigned char Standard_DC_Chrominance_Values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
-
-//-------------------------------------------------------------------------------
-//ҲƣֻӦȷĽ
-const char Standard_AC_Luminance_NRCodes[] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
-const unsigned char Standard_AC_Luminance_Values[] = 
-{
-	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
-	0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
-	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
-	0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
-	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
-	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
-	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
-	0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
-	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
-	0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
-	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
-	0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
-	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
-	0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
-	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
-	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
-	0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
-	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
-	0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-	0xf9, 0xfa
-};
+		//输出回调可能在熵编码的过程中被调用，这部分时间算在输出中
+		JPEG_STATS(bool timed = jpeg_stats_sampled(mcu));
+		JPEG_STATS(unsigned long long start = timed ? jpeg_cycles() : 0);
+		JPEG_STATS(unsigned long long outputStart = out->outputCycles());
 
-//-------------------------------------------------------------------------------
-//ҲƣֻӦɫȷĽ
-const char Standard_AC_Chrominance_NRCodes[] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
-const unsigned char Standard_AC_Chrominance_Values[] =
-{
-	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
-	0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
-	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
-	0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
-	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
-	0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
-	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
-	0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
-	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
-	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
-	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
-	0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
-	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
-	0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
-	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
-	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
-	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
-	0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
-	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
-	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
-	0xf9, 0xfa
-};
+		//Y通道
+		for(int i=0; i<yBlocks; i++)
+			_doHuffmanEncoding(data + i*64, prev_DC_Y, m_huffman->codes[0], m_huffman->codes[1], out, stats, 0);
+
+		//Cb、Cr通道，灰度图像没有
+		if(m_componentCount==3)
+		{
+			_doHuffmanEncoding(data + yBlocks*64, prev_DC_Cb, m_huffman->codes[2], m_huffman->codes[3], out, stats, 1);
+			_doHuffmanEncoding(data + (yBlocks+1)*64, prev_DC_Cr, m_huffman->codes[2], m_huffman->codes[3], out, stats, 2);
+		}
 
+		JPEG_STATS(if(timed) stats->entropyCycles += (jpeg_cycles() - start - (out->outputCycles() - outputStart)) * JPEG_STATS_SAMPLE_INTERVAL);
+	}
+
+	prevDC[0] = prev_DC_Y;
+	prevDC[1] = prev_DC_Cb;
+	prevDC[2] = prev_DC_Cr;
 }
 
 //-------------------------------------------------------------------------------
-JpegEncoder::JpegEncoder()
-	: m_width(0)
-	, m_height(0)
-	, m_rgbBuffer(0)
+void JpegEncoder::_copyEdgeMcu(int xPos, int yPos, unsigned char* edge)
 {
-	//ʼ̬׼ûںJPEG
-	_initHuffmanTables();
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int pixelSize = jpeg_pixel_size(m_source.format);
+
+	int width = m_source.width - xPos;
+	if(width > mcuWidth) width = mcuWidth;
+	int height = m_source.height - yPos;
+	if(height > mcuHeight) height = mcuHeight;
+
+	_replicateEdge(_sourceRow(yPos) + xPos*pixelSize, m_source.stride, width, height, 
+		pixelSize, mcuWidth, mcuHeight, edge);
 }
 
 //-------------------------------------------------------------------------------
-JpegEncoder::~JpegEncoder()
+void JpegEncoder::_gatherBlock(const unsigned char* plane, int stride, int planeWidth, int planeHeight, 
+	int x, int y, int pixelSize, unsigned char* block)
 {
-	//ʱ
-	clean();
+	//MCU中的块可能整个都在平面外面，这时全部重复最后一列(行)
+	if(x >= planeWidth) x = planeWidth - 1;
+	if(y >= planeHeight) y = planeHeight - 1;
+	int width = planeWidth - x;
+	if(width > 8) width = 8;
+	int height = planeHeight - y;
+	if(height > 8) height = 8;
+
+	_replicateEdge(plane + (long long)y * stride + x*pixelSize, stride, width, height, pixelSize, 8, 8, block);
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::clean(void)
+// 图像内的部分每行整段复制，右边补最后一列的像素，下面的行整行复制已经补好的最后一行
+void JpegEncoder::_replicateEdge(const unsigned char* pixels, int stride, int width, int height, 
+	int pixelSize, int outWidth, int outHeight, unsigned char* out)
 {
-	//m_rgbBuffer
-	if(m_rgbBuffer) delete[] m_rgbBuffer;
-	m_rgbBuffer=0;
-
-	m_width=0;
-	m_height=0;
+	int rowSize = outWidth * pixelSize;
+	for(int y=0; y<height; y++)
+	{
+		unsigned char* row = out + y*rowSize;
+		memcpy(row, pixels + (long long)y * stride, width*pixelSize);
+		const unsigned char* last = row + (width-1)*pixelSize;
+		for(int x=width; x<outWidth; x++)
+			memcpy(row + x*pixelSize, last, pixelSize);
+	}
+	for(int y=height; y<outHeight; y++)
+		memcpy(out + y*rowSize, out + (height-1)*rowSize, rowSize);
 }
 
 //-------------------------------------------------------------------------------
-// λͼļϢm_rgbBufferУ洢˳ΪͼĴ£
-bool JpegEncoder::readFromBMP(const char* fileName)
+// 色度平面的尺寸是Y平面的一半(向上取整)，一个16*16的MCU正好对应色度平面中的一个8*8块
+void JpegEncoder::_convertPlanarMcu(int xPos, int yPos, char* yData, char* cbData, char* crData)
 {
-	//ʼʱ
-	clean();
+	const JpegKernels* k = m_kernels;
+	int width = m_source.width, height = m_source.height;
+	int stride = m_source.stride;
+	unsigned char block[8*8*2];
 
-	//BMP ļʽ
-	//BMPʽͼƬļͷ54ֽڣ14ֽڵļͷ40ֽڵλͼϢͷ
-#pragma pack(push, 2)
-	typedef struct {
-			unsigned short	bfType;//ļ
-			unsigned int	bfSize;//bmpļĴС
-			unsigned short	bfReserved1;//ԤֶΣͨΪ0
-			unsigned short	bfReserved2;//ԤֶΣͨΪ0
-			unsigned int	bfOffBits;//ͼƬϢĿʼλ
-	} BITMAPFILEHEADER;
-
-	typedef struct {
-			unsigned int	biSize;//λͼϢͷĴС
-			int				biWidth;//ͼ
-			int				biHeight;//ͼ߶
-			unsigned short	biPlanes;//ɫƽΪ1
-			unsigned short	biBitCount;//ÿöbitʾ
-			unsigned int	biCompression;//úѹʽͨѹBI_RGBӦֵΪ0
-			unsigned int	biSizeImage;//ͼƬСԭʼλͼݵĴС
-			int				biXPelsPerMeter;//ֱʣ/ף
-			int				biYPelsPerMeter;//ֱʣ/ף
-			unsigned int	biClrUsed;//ɫɫͨΪ0ʾûɫ
-			unsigned int	biClrImportant;//ҪɫͨԣͨΪ0ʾÿɫҪ
-	} BITMAPINFOHEADER;
-#pragma pack(pop)
-
-	//ļ
-	FILE* fp = fopen(fileName, "rb");
-	if(fp==0) return false;
-
-	bool successed=false;
-	do
-	{
-		BITMAPFILEHEADER fileHeader;//ļͷ
-		BITMAPINFOHEADER infoHeader;//Ϣͷ
-		//freadصʵԪظ1ʾȡһλĵݴļͷfileHeader,sizeof(fileHeader)
-		if(1 != fread(&fileHeader, sizeof(fileHeader), 1, fp)) break;
-		if(fileHeader.bfType!=0x4D42) break;//ȡļͷϢļͲΪbmp
-
-		if(1 != fread(&infoHeader, sizeof(infoHeader), 1, fp)) break;//ȡϢͷXXX
-		if(infoHeader.biBitCount!=24 || infoHeader.biCompression!=0) break;//ϢͷеλȲΪ24ѹʽΪ0XXX
-		int width = infoHeader.biWidth;//Ϣͷȡͼ
-		int height = infoHeader.biHeight < 0 ? (-infoHeader.biHeight) : infoHeader.biHeight;//Ϣͷȡͼ߶ȣ߶<0÷
-		if((width&7)!=0 || (height&7)!=0) break;	//8ı7ʾλ0111롣8ı3λΪ000ܳ1-7
-
-		int bmpSize = width*height*3;//bufferĳ
-
-		unsigned char* buffer = new unsigned char[bmpSize];
-		if(buffer==0) break;
-
-		fseek(fp, fileHeader.bfOffBits, SEEK_SET);//ļָĵַתļͷеͼƬϢʼλ
-		//BMP洢ֵķʽΪϣңļͷ洢ֽΪͼһеֵ½ǿʼδ洢
-		if(infoHeader.biHeight>0)//ȡ
-		{
-			for(int i=0; i<height; i++)
+	for(int by=0; by<2; by++)
+	{
+		for(int bx=0; bx<2; bx++)
+		{
+			int x = xPos + bx*8, y = yPos + by*8;
+			char* data = yData + (by*2 + bx)*64;
+			if(x + 8 <= width && y + 8 <= height)
 			{
-				//ļΪͼ
-				if(width != fread(buffer+(height-1-i)*width*3, 3, width, fp)) 
-				{
-					delete[] buffer; buffer=0;
-					break;
-				}
+				k->levelShift(_sourceRow(y) + x, stride, data);
+			}
+			else
+			{
+				_gatherBlock(m_source.pixels, stride, width, height, x, y, 1, block);
+				k->levelShift(block, 8, data);
 			}
 		}
+	}
+
+	int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+	int cx = xPos / 2, cy = yPos / 2;
+	bool inside = (cx + 8 <= chromaWidth && cy + 8 <= chromaHeight);
+	const unsigned char* chroma = m_chromaPlane;
+
+	if(m_source.format==JPEG_PIXEL_NV12)
+	{
+		if(inside)
+		{
+			k->splitChroma(chroma + (long long)cy * stride + cx*2, stride, cbData, crData);
+		}
 		else
 		{
-			//߶ֵΪ-ֱֵһԶ
-			if(width*height != fread(buffer, 3, width*height, fp))
+			_gatherBlock(chroma, stride, chromaWidth, chromaHeight, cx, cy, 2, block);
+			k->splitChroma(block, 16, cbData, crData);
+		}
+	}
+	else
+	{
+		int chromaStride = (stride + 1) / 2;
+		const unsigned char* planes[2] = { chroma, chroma + (long long)m_chromaPlaneHeight * chromaStride };
+		char* outputs[2] = { cbData, crData };
+		for(int i=0; i<2; i++)
+		{
+			if(inside)
+			{
+				k->levelShift(planes[i] + (long long)cy * chromaStride + cx, chromaStride, outputs[i]);
+			}
+			else
 			{
-				delete[] buffer; buffer=0;
-				break;
+				_gatherBlock(planes[i], chromaStride, chromaWidth, chromaHeight, cx, cy, 1, block);
+				k->levelShift(block, 8, outputs[i]);
 			}
 		}
+	}
+}
 
-		m_rgbBuffer = buffer;
-		m_width = width;
-		m_height = height;
-		successed=true;
-	}while(false);
+//-------------------------------------------------------------------------------
+struct JpegEncoder::StripeJob
+{
+	JpegEncoder*	encoder;
+	int				mcuCount;
+	int				segmentCount;
+	int				stripeCount;
+	//每个条带各自的输出和统计
+	std::vector< std::vector<unsigned char> >	outputs;
+	JpegEncodeStats*	stats;
+};
 
-	fclose(fp);fp=0;
-	
-	return successed;
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodeStripeTask(void* context, int index)
+{
+	StripeJob* job = (StripeJob*)context;
+	JpegEncoder* encoder = job->encoder;
+	int interval = encoder->m_restartInterval;
+
+	//条带由若干个完整的复位间隔组成，彼此之间没有依赖
+	int firstSegment = (int)((long long)index * job->segmentCount / job->stripeCount);
+	int endSegment = (int)((long long)(index+1) * job->segmentCount / job->stripeCount);
+	int firstMcu = firstSegment * interval;
+	int endMcu = endSegment * interval;
+	if(endMcu > job->mcuCount) endMcu = job->mcuCount;
+
+	unsigned char buffer[4096];
+	JpegVectorOutput output(job->outputs[index]);
+	JpegBitWriter writer(buffer, sizeof(buffer), JpegOutput::writeCallback, &output);
+	short prevDC[3] = { 0, 0, 0 };
+	JpegEncodeStats* stats = &job->stats[index];
+	encoder->_encodeMcus(firstMcu, endMcu, prevDC, &writer, stats);
+	writer.flushBits();
+	writer.flush();
+
+	JPEG_STATS(stats->stuffedBytes += writer.stuffedBytes());
+	JPEG_STATS(stats->outputCycles += writer.outputCycles());
 }
 
 //-------------------------------------------------------------------------------
-bool JpegEncoder::encodeToJPG(const char* fileName, int quality_scale)
+void JpegEncoder::_encodeStripes(int mcuCount, JpegBitWriter* out)
 {
-	//δȡ
-	if(m_rgbBuffer==0 || m_width==0 || m_height==0) return false;
+	StripeJob job;
+	job.encoder = this;
+	job.mcuCount = mcuCount;
+	job.segmentCount = (mcuCount + m_restartInterval - 1) / m_restartInterval;
 
-	//ļ
-	FILE* fp = fopen(fileName, "wb");
-	if(fp==0) return false;
+	//条带数取线程数的几倍，让各线程的负载更均衡
+	job.stripeCount = m_threadPool->threadCount() * 4;
+	if(job.stripeCount > job.segmentCount) job.stripeCount = job.segmentCount;
+	job.outputs.resize(job.stripeCount);
 
-	//ʼ
-	_initQualityTables(quality_scale);
+	m_chunkStats.resize(job.stripeCount);
+	for(int i=0; i<job.stripeCount; i++) m_chunkStats[i].reset();
+	job.stats = &m_chunkStats[0];
 
-	//ļͷ
-	_write_jpeg_header(fp);
+	m_threadPool->parallelFor(job.stripeCount, _encodeStripeTask, &job);
+	for(int i=0; i<job.stripeCount; i++) m_stats.add(m_chunkStats[i]);
 
-	short prev_DC_Y = 0, prev_DC_Cb = 0, prev_DC_Cr = 0;
-	int newByte=0, newBytePos=7;
+	//每个条带已经包含了它开头的RSTn标记，按顺序拼接即可
+	for(int i=0; i<job.stripeCount; i++)
+	{
+		if(!job.outputs[i].empty()) out->writeBytes(&job.outputs[i][0], (int)job.outputs[i].size());
+	}
+}
+
+//-------------------------------------------------------------------------------
+struct JpegEncoder::PipelineJob
+{
+	JpegEncoder*	encoder;
+	int				mcusPerLine;
+	int				rowCount;
+	//变换线程数，第p个线程负责第p、p+producers、p+2*producers...个MCU行，放入rings[p]
+	int				producers;
+	JpegSpscRing*	rings;
+	//第p个线程的队列中序号为i的MCU行在rows + (p*PIPELINE_DEPTH + i%PIPELINE_DEPTH)*rowSize
+	short*			rows;
+	int				rowSize;
+	JpegBitWriter*	out;
+	//每个变换线程各自的统计，熵编码直接计入m_stats
+	JpegEncodeStats*	stats;
+};
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_pipelineTask(void* context, int index)
+{
+	PipelineJob* job = (PipelineJob*)context;
+	JpegEncoder* encoder = job->encoder;
+	int mcuSize = job->rowSize / job->mcusPerLine;
 
-	for(int yPos=0; yPos<m_height; yPos+=8)
+	//任务0为熵编码，按顺序从各个变换线程的队列中轮流取出MCU行
+	if(index==0)
 	{
-		for (int xPos=0; xPos<m_width; xPos+=8)
+		short prevDC[3] = { 0, 0, 0 };
+		for(int row=0; row<job->rowCount; row++)
 		{
-			char yData[64], cbData[64], crData[64];
-			short yQuant[64], cbQuant[64], crQuant[64];
-
-			//תɫռ
-			unsigned char* rgbBuffer = m_rgbBuffer + yPos * m_width * 3 + xPos * 3;
-			_convertColorSpace(rgbBuffer, yData, cbData, crData);
+			int p = row % job->producers;
+			JpegSpscRing& ring = job->rings[p];
+			long long item = ring.waitItem();
+			const short* coef = job->rows + ((long long)p*PIPELINE_DEPTH + item%PIPELINE_DEPTH) * job->rowSize;
+			int firstMcu = row * job->mcusPerLine;
+			encoder->_encodeMcus(firstMcu, firstMcu + job->mcusPerLine, prevDC, job->out, &encoder->m_stats, coef);
+			ring.pop();
+		}
+		return;
+	}
 
-			BitString outputBitString[128];
-			int bitStringCounts;
+	//其余的任务为变换线程，队列满了就等熵编码取走
+	int p = index - 1;
+	JpegSpscRing& ring = job->rings[p];
+	JpegEncodeStats* stats = &job->stats[p];
+	for(int row=p; row<job->rowCount; row+=job->producers)
+	{
+		long long item = ring.waitSpace();
+		short* coef = job->rows + ((long long)p*PIPELINE_DEPTH + item%PIPELINE_DEPTH) * job->rowSize;
+		int firstMcu = row * job->mcusPerLine;
+		for(int i=0; i<job->mcusPerLine; i++)
+		{
+			if(encoder->m_dct)
+				encoder->_requantizeMcu(firstMcu + i, coef + i*mcuSize, stats);
+			else
+				encoder->_transformMcu(firstMcu + i, coef + i*mcuSize, stats);
+		}
+		ring.push();
+	}
+}
 
-			//Yͨѹ
-			_foword_FDC(yData, yQuant, m_YTable);
-			_doHuffmanEncoding(yQuant, prev_DC_Y, m_Y_DC_Huffman_Table, m_Y_AC_Huffman_Table, outputBitString, bitStringCounts); 
-			_write_bitstring_(outputBitString, bitStringCounts, newByte, newBytePos, fp);
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodePipelined(int mcuCount, JpegBitWriter* out)
+{
+	int mcuWidth = m_hSamp*8;
+	PipelineJob job;
+	job.encoder = this;
+	job.mcusPerLine = (m_source.width + mcuWidth - 1) / mcuWidth;
+	job.rowCount = mcuCount / job.mcusPerLine;
+	job.rowSize = job.mcusPerLine * (m_hSamp*m_vSamp + m_componentCount - 1) * 64;
+	job.out = out;
+
+	//任务数不超过线程池的线程数，所有任务都能同时运行，互相等待不会死锁
+	job.producers = m_threadPool->threadCount() - 1;
+	if(job.producers > job.rowCount) job.producers = job.rowCount;
+
+	m_pipelineRows.resize((size_t)job.producers * PIPELINE_DEPTH * job.rowSize);
+	job.rows = &m_pipelineRows[0];
+	job.rings = new JpegSpscRing[job.producers];
+	for(int i=0; i<job.producers; i++) job.rings[i].reset(PIPELINE_DEPTH);
+
+	m_chunkStats.resize(job.producers);
+	for(int i=0; i<job.producers; i++) m_chunkStats[i].reset();
+	job.stats = &m_chunkStats[0];
+
+	m_threadPool->parallelFor(job.producers + 1, _pipelineTask, &job);
+	for(int i=0; i<job.producers; i++) m_stats.add(m_chunkStats[i]);
+
+	delete[] job.rings;
+}
 
-			//Cbͨѹ
-			_foword_FDC(cbData, cbQuant, m_CbCrTable);			
-			_doHuffmanEncoding(cbQuant, prev_DC_Cb, m_CbCr_DC_Huffman_Table, m_CbCr_AC_Huffman_Table, outputBitString, bitStringCounts);
-			_write_bitstring_(outputBitString, bitStringCounts, newByte, newBytePos, fp);
+//-------------------------------------------------------------------------------
+struct JpegEncoder::SegmentJob
+{
+	JpegEncoder*	encoder;
+	int				mcuCount;
+	int				segmentCount;
+	int				chunkCount;
+	const unsigned char*	dirty;
+	std::vector< std::vector<unsigned char> >*	segments;
+	//每段任务各自的统计
+	JpegEncodeStats*	stats;
+};
 
-			//Crͨѹ
-			_foword_FDC(crData, crQuant, m_CbCrTable);			
-			_doHuffmanEncoding(crQuant, prev_DC_Cr, m_CbCr_DC_Huffman_Table, m_CbCr_AC_Huffman_Table, outputBitString, bitStringCounts);
-			_write_bitstring_(outputBitString, bitStringCounts, newByte, newBytePos, fp);
-		}
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodeSegmentTask(void* context, int index)
+{
+	SegmentJob* job = (SegmentJob*)context;
+	JpegEncoder* encoder = job->encoder;
+	int interval = encoder->m_restartInterval;
+	JpegEncodeStats* stats = &job->stats[index];
+
+	int firstSegment = (int)((long long)index * job->segmentCount / job->chunkCount);
+	int endSegment = (int)((long long)(index+1) * job->segmentCount / job->chunkCount);
+	for(int s=firstSegment; s<endSegment; s++)
+	{
+		int firstMcu = s * interval;
+		int endMcu = firstMcu + interval;
+		if(endMcu > job->mcuCount) endMcu = job->mcuCount;
+
+		std::vector<unsigned char>& segment = (*job->segments)[s];
+		bool dirty = segment.empty();
+		for(int mcu=firstMcu; mcu<endMcu && !dirty; mcu++)
+			dirty = job->dirty[mcu]!=0;
+		if(!dirty) continue;
+
+		//与条带相同，每个复位间隔都从字节边界开始，DC的预测值为0，可以单独编码
+		segment.clear();
+		unsigned char buffer[4096];
+		JpegVectorOutput output(segment);
+		JpegBitWriter writer(buffer, sizeof(buffer), JpegOutput::writeCallback, &output);
+		short prevDC[3] = { 0, 0, 0 };
+		encoder->_encodeMcus(firstMcu, endMcu, prevDC, &writer, stats);
+		writer.flushBits();
+		writer.flush();
+
+		JPEG_STATS(stats->stuffedBytes += writer.stuffedBytes());
+		JPEG_STATS(stats->outputCycles += writer.outputCycles());
 	}
-	//flush remain data
-	if(newBytePos!=7){
-		_write_byte_(newByte,fp);
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_encodeSegments(int mcuCount, const unsigned char* dirty, std::vector< std::vector<unsigned char> >& segments, 
+	JpegBitWriter* out)
+{
+	SegmentJob job;
+	job.encoder = this;
+	job.mcuCount = mcuCount;
+	job.segmentCount = (mcuCount + m_restartInterval - 1) / m_restartInterval;
+	job.chunkCount = m_threadPool ? m_threadPool->threadCount() * 4 : 1;
+	if(job.chunkCount > job.segmentCount) job.chunkCount = job.segmentCount;
+	job.dirty = dirty;
+	job.segments = &segments;
+
+	//复位间隔的划分变了，缓存的数据都作废
+	if((int)segments.size() != job.segmentCount)
+	{
+		segments.clear();
+		segments.resize(job.segmentCount);
 	}
-	_write_word_(0xFFD9, fp); //Write End of Image Marker   
-	
-	fclose(fp);
 
-	return true;
+	m_chunkStats.resize(job.chunkCount);
+	for(int i=0; i<job.chunkCount; i++) m_chunkStats[i].reset();
+	job.stats = &m_chunkStats[0];
+
+	if(m_threadPool)
+		m_threadPool->parallelFor(job.chunkCount, _encodeSegmentTask, &job);
+	else
+		_encodeSegmentTask(&job, 0);
+	for(int i=0; i<job.chunkCount; i++) m_stats.add(m_chunkStats[i]);
+
+	for(int s=0; s<job.segmentCount; s++)
+	{
+		if(!segments[s].empty()) out->writeBytes(&segments[s][0], (int)segments[s].size());
+	}
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_initHuffmanTables(void)
+// 每次扫描先统计一遍符号，生成这次扫描用到的表并写在SOS之前，libjpeg输出渐进式JPEG时也总是这样做。
+// 没有用到的表保持上一次的内容不变
+void JpegEncoder::_encodeProgressive(JpegBitWriter* out)
 {
-	memset(&m_Y_DC_Huffman_Table, 0, sizeof(m_Y_DC_Huffman_Table));
-	_computeHuffmanTable(Standard_DC_Luminance_NRCodes, Standard_DC_Luminance_Values, m_Y_DC_Huffman_Table);
+	if(m_optimizedHuffman==0) m_optimizedHuffman = new JpegHuffmanTables(jpeg_std_huffman_tables);
+
+	JPEG_STATS(unsigned long long start = jpeg_cycles());
+	JPEG_STATS(unsigned long long outputStart = out->outputCycles());
+	JPEG_STATS(m_stats.blocks += (long long)m_coefficients.mcuCount() * m_coefficients.blocksPerMcu());
+
+	const JpegScanInfo* script = jpeg_progressive_script;
+	int scanCount = JPEG_PROGRESSIVE_SCAN_COUNT;
+	if(m_componentCount==1)
+	{
+		script = jpeg_progressive_gray_script;
+		scanCount = JPEG_PROGRESSIVE_GRAY_SCAN_COUNT;
+	}
+
+	for(int s=0; s<scanCount; s++)
+	{
+		const JpegScanInfo& scan = script[s];
+		JpegScanEncoder encoder(m_coefficients, scan, m_restartInterval);
+
+		//DC的细化扫描不用霍夫曼表
+		if(scan.Ss!=0 || scan.Ah==0)
+		{
+			long long freq[4][257];
+			memset(freq, 0, sizeof(freq));
+			encoder.gather(freq);
+
+			bool used[4] = { false, false, false, false };
+			for(int i=0; i<scan.componentCount; i++) used[jpeg_scan_table(scan, scan.components[i])] = true;
+			for(int t=0; t<4; t++)
+			{
+				if(used[t]) _buildOptimalHuffmanSpec(freq[t], &m_optimizedHuffman->specs[t]);
+			}
+			jpeg_build_huffman_tables(*m_optimizedHuffman);
 
-	memset(&m_Y_AC_Huffman_Table, 0, sizeof(m_Y_AC_Huffman_Table));
-	_computeHuffmanTable(Standard_AC_Luminance_NRCodes, Standard_AC_Luminance_Values, m_Y_AC_Huffman_Table);
+			_write_huffman_tables(m_optimizedHuffman, used, out);
+		}
 
-	memset(&m_CbCr_DC_Huffman_Table, 0, sizeof(m_CbCr_DC_Huffman_Table));
-	_computeHuffmanTable(Standard_DC_Chrominance_NRCodes, Standard_DC_Chrominance_Values, m_CbCr_DC_Huffman_Table);
+		_write_scan_header(scan, out);
+		encoder.encode(*m_optimizedHuffman, out);
+	}
 
-	memset(&m_CbCr_AC_Huffman_Table, 0, sizeof(m_CbCr_AC_Huffman_Table));
-	_computeHuffmanTable(Standard_AC_Chrominance_NRCodes, Standard_AC_Chrominance_Values, m_CbCr_AC_Huffman_Table);
+	JPEG_STATS(m_stats.entropyCycles += jpeg_cycles() - start - (out->outputCycles() - outputStart));
 }
+
 //-------------------------------------------------------------------------------
-JpegEncoder::BitString JpegEncoder::_getBitCode(int value)
+void JpegEncoder::_optimizeHuffmanTables(int mcuCount)
 {
-	BitString ret;
-	int v = (value>0) ? value : -value;
-	
-	//bit ĳ
-	int length = 0;
-	for(length=0; v; v>>=1) length++;
+	//依次为亮度DC、亮度AC、色度DC、色度AC，与JpegHuffmanTables中的顺序相同
+	JPEG_STATS(unsigned long long start = jpeg_cycles());
 
-	ret.value = value>0 ? value : ((1<<length)+value-1);
-	ret.length = length;
+	long long freq[4][257];
+	memset(freq, 0, sizeof(freq));
 
-	return ret;
-};
+	int yBlocks = m_hSamp*m_vSamp;
+	short prev_DC_Y = 0, prev_DC_Cb = 0, prev_DC_Cr = 0;
+
+	//DC的差值与编码时一样，在复位间隔处重新开始
+	for(int mcu=0; mcu<mcuCount; mcu++)
+	{
+		if(m_restartInterval>0 && mcu%m_restartInterval==0)
+			prev_DC_Y = prev_DC_Cb = prev_DC_Cr = 0;
+
+		const short* coef = m_coefficients.mcu(mcu);
+		for(int i=0; i<yBlocks; i++)
+			_countHuffmanSymbols(coef + i*64, prev_DC_Y, freq[0], freq[1]);
+		if(m_componentCount==3)
+		{
+			_countHuffmanSymbols(coef + yBlocks*64, prev_DC_Cb, freq[2], freq[3]);
+			_countHuffmanSymbols(coef + (yBlocks+1)*64, prev_DC_Cr, freq[2], freq[3]);
+		}
+	}
+
+	if(m_optimizedHuffman==0) m_optimizedHuffman = new JpegHuffmanTables(jpeg_std_huffman_tables);
+	for(int i=0; i<4; i++)
+		_buildOptimalHuffmanSpec(freq[i], &m_optimizedHuffman->specs[i]);
+
+	jpeg_build_huffman_tables(*m_optimizedHuffman);
+	m_huffman = m_optimizedHuffman;
+
+	JPEG_STATS(m_stats.entropyCycles += jpeg_cycles() - start);
+}
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_initQualityTables(int quality_scale)
+// 与_doHuffmanEncoding产生的符号完全一致，只是计数而不输出
+void JpegEncoder::_countHuffmanSymbols(const short* DU, short& prevDC, long long* dcFreq, long long* acFreq)
 {
-	if(quality_scale<=0) quality_scale=1;
-	if(quality_scale>=100) quality_scale=99;
-	//8*8ϵ
-	for(int i=0; i<64; i++)
-	{	
-		//ϵչһά飨->£У
-		int temp = ((int)(Luminance_Quantization_Table[i] * quality_scale + 50) / 100);
-		if (temp<=0) temp = 1;
-		if (temp>0xFF) temp = 0xFF;
-		m_YTable[ZigZag[i]] = (unsigned char)temp;
-		temp = ((int)(Chrominance_Quantization_Table[i] * quality_scale + 50) / 100);
-		if (temp<=0) 	temp = 1;
-		if (temp>0xFF) temp = 0xFF;
-		m_CbCrTable[ZigZag[i]] = (unsigned char)temp;
+	int dcDiff = (int)(DU[0] - prevDC);
+	prevDC = DU[0];
+	dcFreq[jpeg_bit_length(dcDiff<0 ? -dcDiff : dcDiff)]++;
+
+	unsigned long long nonzero = jpeg_nonzero_mask(DU) & ~1ULL;
+	int lastPos = 0;
+	while(nonzero)
+	{
+		int pos = jpeg_ctz64(nonzero);
+		nonzero &= nonzero - 1;
+
+		int zeroCounts = pos - lastPos - 1;
+		lastPos = pos;
+		for(; zeroCounts >= 16; zeroCounts -= 16)
+			acFreq[0xF0]++;
+
+		int value = DU[pos];
+		acFreq[(zeroCounts << 4) | jpeg_bit_length(value<0 ? -value : value)]++;
 	}
+
+	if (lastPos != 63)
+		acFreq[0x00]++;
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_computeHuffmanTable(const char* nr_codes, const unsigned char* std_table, BitString* huffman_table)
+// JPEG标准附录K.2的方法：每次合并频率最小的两个节点，得到每个符号的码长，
+// 再把超过16位的码字逐个调整到16位以内。第256个符号是预留的，保证不会出现全1的码字
+void JpegEncoder::_buildOptimalHuffmanSpec(long long* freq, JpegHuffmanSpec* spec)
 {
-	unsigned char pos_in_table = 0;
-	unsigned short code_value = 0;
+	int codeSize[257];
+	int others[257];
+	for(int i=0; i<257; i++)
+	{
+		codeSize[i] = 0;
+		others[i] = -1;
+	}
+
+	//没有用到的表也要有一个码字，DHT段才是合法的
+	bool used = false;
+	for(int i=0; i<256; i++) used = used || freq[i]>0;
+	if(!used) freq[0] = 1;
+	freq[256] = 1;
+
+	for(;;)
+	{
+		//找出频率最小的两个符号c1、c2，频率相同时取序号大的
+		int c1 = -1, c2 = -1;
+		long long v = -1;
+		for(int i=0; i<=256; i++)
+		{
+			if(freq[i] && (v<0 || freq[i]<=v)) { v = freq[i]; c1 = i; }
+		}
+		v = -1;
+		for(int i=0; i<=256; i++)
+		{
+			if(freq[i] && i!=c1 && (v<0 || freq[i]<=v)) { v = freq[i]; c2 = i; }
+		}
+		if(c2<0) break;
+
+		//合并两棵子树，两边所有符号的码长都加1
+		freq[c1] += freq[c2];
+		freq[c2] = 0;
+
+		codeSize[c1]++;
+		while(others[c1]>=0)
+		{
+			c1 = others[c1];
+			codeSize[c1]++;
+		}
+		others[c1] = c2;
+
+		codeSize[c2]++;
+		while(others[c2]>=0)
+		{
+			c2 = others[c2];
+			codeSize[c2]++;
+		}
+	}
+
+	//每种码长的码字个数
+	int bits[33];
+	memset(bits, 0, sizeof(bits));
+	for(int i=0; i<=256; i++)
+	{
+		if(codeSize[i]) bits[codeSize[i]]++;
+	}
+
+	//超过16位的码字两个一组上移一层，同时把一个较短的码字下移一层来补位
+	for(int i=32; i>16; i--)
+	{
+		while(bits[i]>0)
+		{
+			int j = i - 2;
+			while(bits[j]==0) j--;
 
-	for(int k = 1; k <= 16; k++)
+			bits[i] -= 2;
+			bits[i-1]++;
+			bits[j+1] += 2;
+			bits[j]--;
+		}
+	}
+
+	//去掉预留符号占用的那个最长的码字
+	int longest = 16;
+	while(bits[longest]==0) longest--;
+	bits[longest]--;
+
+	for(int i=0; i<16; i++) spec->nrCodes[i] = (char)bits[i+1];
+
+	//符号按码长从短到长排列，同样码长的按符号值排列
+	spec->valueCount = 0;
+	for(int len=1; len<=32; len++)
 	{
-		for(int j = 1; j <= nr_codes[k-1]; j++)
+		for(int i=0; i<256; i++)
 		{
-			huffman_table[std_table[pos_in_table]].value = code_value;
-			huffman_table[std_table[pos_in_table]].length = k;
-			pos_in_table++;
-			code_value++;
+			if(codeSize[i]==len) spec->values[spec->valueCount++] = (unsigned char)i;
 		}
-		code_value <<= 1;
-	}  
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_beginStats(void)
+{
+	m_stats.reset();
+	JPEG_STATS(m_statsStartCycles = jpeg_cycles());
+	JPEG_STATS(m_statsStartTime = std::chrono::steady_clock::now());
+}
+
+//-------------------------------------------------------------------------------
+// 条带编码时各条带的输出级已经在_encodeStripeTask中累加过，这里只加上最终的输出级
+void JpegEncoder::_endStats(const JpegBitWriter* out)
+{
+#ifndef JPEG_NO_STATS
+	m_stats.stuffedBytes += out->stuffedBytes();
+	m_stats.outputCycles += out->outputCycles();
+	m_stats.bytes = out->outputBytes();
+	m_stats.totalCycles = jpeg_cycles() - m_statsStartCycles;
+	m_stats.totalNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - m_statsStartTime).count();
+#else
+	(void)out;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_initQualityTables(int quality_scale)
+{
+	//量化表、除数表和DQT段只与质量有关，从共享的缓存中取得
+	m_qualityTables = jpeg_get_quality_tables(quality_scale);
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_write_byte_(unsigned char value, FILE* fp)
+void JpegEncoder::_write_byte_(unsigned char value, JpegBitWriter* out)
 {
-	_write_(&value, 1, fp);
+	_write_(&value, 1, out);
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_write_word_(unsigned short value, FILE* fp)
+void JpegEncoder::_write_word_(unsigned short value, JpegBitWriter* out)
 {
 	unsigned short _value = ((value>>8)&0xFF) | ((value&0xFF)<<8);
-	_write_(&_value, 2, fp);
+	_write_(&_value, 2, out);
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_write_(const void* p, int byteSize, FILE* fp)
+void JpegEncoder::_write_(const void* p, int byteSize, JpegBitWriter* out)
 {
-	fwrite(p, 1, byteSize, fp);
+	out->writeBytes(p, byteSize);
 }
 
 //-------------------------------------------------------------------------------
 void JpegEncoder::_doHuffmanEncoding(const short* DU, short& prevDC, const BitString* HTDC, const BitString* HTAC, 
-	BitString* outputBitString, int& bitStringCounts)
+	JpegBitWriter* out, JpegEncodeStats* stats, int component)
 {
 	BitString EOB = HTAC[0x00];
 	BitString SIXTEEN_ZEROS = HTAC[0xF0];
 
-	int index=0;
-
 	// encode DC
+	// 霍夫曼码和幅值的附加位拼成一个码字一次写出，负数的附加位是其反码，即value-1的低位
 	int dcDiff = (int)(DU[0] - prevDC);
 	prevDC = DU[0];
 
-	if (dcDiff == 0) 
-		outputBitString[index++] = HTDC[0];
-	else
-	{
-		BitString bs = _getBitCode(dcDiff);
-
-		outputBitString[index++] = HTDC[bs.length];
-		outputBitString[index++] = bs;
-	}
+	int length = jpeg_bit_length(dcDiff<0 ? -dcDiff : dcDiff);
+	unsigned int bits = (unsigned int)(dcDiff<0 ? dcDiff-1 : dcDiff) & ((1u<<length)-1);
+	out->putBits(((unsigned int)HTDC[length].value << length) | bits, HTDC[length].length + length);
+	JPEG_STATS(stats->dcBits[component] += HTDC[length].length + length);
 
 	// encode ACs
-	int endPos=63; //end0pos = first element in reverse order != 0
-	while((endPos > 0) && (DU[endPos] == 0)) endPos--;
+	// 非0系数的位图，从低位开始依次取出每个非0系数，两个非0系数之间的距离就是0的个数
+	unsigned long long nonzero = jpeg_nonzero_mask(DU) & ~1ULL;
+	int lastPos = 0;
+
+	//统计先记在局部变量中，避免每次写输出缓冲区之后都要重新读取stats
+	JPEG_STATS(int acBits = 0);
+	JPEG_STATS(int zrlCount = 0);
+	JPEG_STATS(stats->blocks++);
+	JPEG_STATS(if(nonzero==0) stats->zeroBlocks++);
 
-	for(int i=1; i<=endPos; )
+	while(nonzero)
 	{
-		int startPos = i;
-		while((DU[i] == 0) && (i <= endPos)) i++;
+		int pos = jpeg_ctz64(nonzero);
+		nonzero &= nonzero - 1;
 
-		int zeroCounts = i - startPos;
-		if (zeroCounts >= 16)
+		int zeroCounts = pos - lastPos - 1;
+		lastPos = pos;
+		for(; zeroCounts >= 16; zeroCounts -= 16)
 		{
-			for (int j=1; j<=zeroCounts/16; j++)
-				outputBitString[index++] = SIXTEEN_ZEROS;
-			zeroCounts = zeroCounts%16;
+			out->putBits(SIXTEEN_ZEROS.value, SIXTEEN_ZEROS.length);
+			JPEG_STATS(acBits += SIXTEEN_ZEROS.length);
+			JPEG_STATS(zrlCount++);
 		}
 
-		BitString bs = _getBitCode(DU[i]);
+		int value = DU[pos];
+		length = jpeg_bit_length(value<0 ? -value : value);
+		bits = (unsigned int)(value<0 ? value-1 : value) & ((1u<<length)-1);
 
-		outputBitString[index++] = HTAC[(zeroCounts << 4) | bs.length];
-		outputBitString[index++] = bs;
-		i++;
+		const BitString& code = HTAC[(zeroCounts << 4) | length];
+		out->putBits(((unsigned int)code.value << length) | bits, code.length + length);
+		JPEG_STATS(acBits += code.length + length);
 	}
 
-	if (endPos != 63)
-		outputBitString[index++] = EOB;
+	if (lastPos != 63)
+	{
+		out->putBits(EOB.value, EOB.length);
+		JPEG_STATS(acBits += EOB.length);
+		JPEG_STATS(stats->eobCount++);
+	}
 
-	bitStringCounts = index;
+	JPEG_STATS(stats->acBits[component] += acBits);
+	JPEG_STATS(stats->zrlCount += zrlCount);
+#ifdef JPEG_NO_STATS
+	(void)stats;
+	(void)component;
+#endif
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_write_bitstring_(const BitString* bs, int counts, int& newByte, int& newBytePos, FILE* fp)
+void JpegEncoder::_convertColorSpace(const unsigned char* pixels, int stride, int xPos, int yPos, 
+	char* yData, char* cbData, char* crData)
 {
-	unsigned short mask[] = {1,2,4,8,16,32,64,128,256,512,1024,2048,4096,8192,16384,32768};
-	
-	for(int i=0; i<counts; i++)
+	JpegConvertFunc convert = m_kernels->convertColor[m_source.format];
+
+	//不抽样时一个MCU就是一个8*8的块
+	if(m_hSamp==1 && m_vSamp==1)
 	{
-		int value = bs[i].value;
-		int posval = bs[i].length - 1;
+		convert(pixels, stride, yData, cbData, crData);
+		return;
+	}
 
-		while (posval >= 0)
+	//每个亮度块按原分辨率转换，同时得到的色度先放在临时数组中，留出一圈边框，再滤波抽样成一个8*8的块
+	//整个过程都在一个MCU之内完成，不需要整幅图像大小的色度平面
+	short cbFull[FULL_CHROMA_STRIDE*FULL_CHROMA_STRIDE];
+	short crFull[FULL_CHROMA_STRIDE*FULL_CHROMA_STRIDE];
+	int pixelSize = jpeg_pixel_size(m_source.format);
+
+	for(int by=0; by<m_vSamp; by++)
+	{
+		for(int bx=0; bx<m_hSamp; bx++)
 		{
-			if ((value & mask[posval]) != 0)
-			{
-				newByte = newByte  | mask[newBytePos];
-			}
-			posval--;
-			newBytePos--;
-			if (newBytePos < 0)
+			char cb[64], cr[64];
+			convert(pixels + by*8*stride + bx*8*pixelSize, stride, yData + (by*m_hSamp + bx)*64, cb, cr);
+
+			for(int y=0; y<8; y++)
 			{
-				// Write to stream
-				_write_byte_((unsigned char)(newByte), fp);
-				if (newByte == 0xFF)
+				short* cbRow = cbFull + (by*8 + y + 1)*FULL_CHROMA_STRIDE + bx*8 + 1;
+				short* crRow = crFull + (by*8 + y + 1)*FULL_CHROMA_STRIDE + bx*8 + 1;
+				for(int x=0; x<8; x++)
 				{
-					// Handle special case
-					_write_byte_((unsigned char)(0x00), fp);
+					cbRow[x] = cb[y*8 + x];
+					crRow[x] = cr[y*8 + x];
 				}
-
-				// Reinitialize
-				newBytePos = 7;
-				newByte = 0;
 			}
 		}
 	}
+
+	if(m_chromaFilter==CHROMA_TRIANGLE) _fillChromaBorder(xPos, yPos, cbFull, crFull);
+
+	_downsampleChroma(cbFull, cbData);
+	_downsampleChroma(crFull, crData);
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_convertColorSpace(const unsigned char* rgbBuffer, char* yData, char* cbData, char* crData)
+void JpegEncoder::_fillChromaBorder(int xPos, int yPos, short* cbFull, short* crFull)
 {
-	for (int y=0; y<8; y++)
+	int mcuWidth = m_hSamp*8, mcuHeight = m_vSamp*8;
+	int pixelSize = jpeg_pixel_size(m_source.format);
+
+	for(int y=-1; y<=mcuHeight; y++)
 	{
-		const unsigned char* p = rgbBuffer + y*m_width*3;
-		for (int x=0; x<8; x++)
+		int sy = yPos + y;
+		if(sy<0) sy = 0;
+		if(sy>=m_source.height) sy = m_source.height - 1;
+		const unsigned char* row = _sourceRow(sy);
+
+		//第一行和最后一行整行都在边框上，中间的行只有左右两个像素
+		int step = (y<0 || y==mcuHeight) ? 1 : (mcuWidth + 1);
+		for(int x=-1; x<=mcuWidth; x+=step)
 		{
-			unsigned char B = *p++;
-			unsigned char G = *p++;
-			unsigned char R = *p++;
+			int sx = xPos + x;
+			if(sx<0) sx = 0;
+			if(sx>=m_source.width) sx = m_source.width - 1;
+
+			char yValue, cb, cr;
+			jpeg_convert_pixel(row + sx*pixelSize, m_source.format, &yValue, &cb, &cr);
 
-			yData[y*8+x] = (char)(0.299f * R + 0.587f * G + 0.114f * B - 128);
-			cbData[y*8+x] = (char)(-0.1687f * R - 0.3313f * G + 0.5f * B );
-			crData[y*8+x] = (char)(0.5f * R - 0.4187f * G - 0.0813f * B);
+			int k = (y + 1)*FULL_CHROMA_STRIDE + x + 1;
+			cbFull[k] = cb;
+			crFull[k] = cr;
 		}
 	}
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_foword_FDC(const char* channel_data, short* fdc_data, const unsigned char* quant_table)
+// full中(x,y)处的色度在full[(y+1)*FULL_CHROMA_STRIDE + x+1]，抽样后第(u,v)个值的中心在(2u+0.5, 2v+0.5)
+// BOX取覆盖的2个或4个值的平均，舍入的偏置交替使用，避免整体偏向一边
+// TRIANGLE用1-3-3-1的权重，还要用到两侧各一个相邻的值
+void JpegEncoder::_downsampleChroma(const short* full, char* data)
 {
-	const float PI = 3.1415926f;
+	static const int weight[4] = { 1, 3, 3, 1 };
+	const short* origin = full + FULL_CHROMA_STRIDE + 1;
+
 	for(int v=0; v<8; v++)
 	{
 		for(int u=0; u<8; u++)
 		{
-			float alpha_u = (u==0) ? 1.f/sqrt(8.0f) : 0.5f;
-			float alpha_v = (v==0) ? 1.f/sqrt(8.0f) : 0.5f;
-
-			float temp = 0.f;
-			for(int x=0; x<8; x++)
+			int value;
+			if(m_vSamp==2)
 			{
-				for(int y=0; y<8; y++)
+				const short* p = origin + 2*v*FULL_CHROMA_STRIDE + 2*u;
+				if(m_chromaFilter==CHROMA_TRIANGLE)
 				{
-					float data = channel_data[y*8+x];
-
-					data *= cosf((2*x+1)*u*PI/16.0f);
-					data *= cosf((2*y+1)*v*PI/16.0f);
-
-					temp += data;
+					int sum = 0;
+					for(int j=0; j<4; j++)
+					{
+						const short* row = p + (j - 1)*FULL_CHROMA_STRIDE - 1;
+						sum += weight[j] * (row[0] + 3*row[1] + 3*row[2] + row[3]);
+					}
+					value = (sum + 32) >> 6;
+				}
+				else
+				{
+					value = (p[0] + p[1] + p[FULL_CHROMA_STRIDE] + p[FULL_CHROMA_STRIDE + 1] + 1 + (u&1)) >> 2;
 				}
 			}
-			int zigZagIndex = ZigZag[v * 8 + u];
-
-			//
-			temp *= alpha_u*alpha_v/ quant_table[zigZagIndex];
-			fdc_data[zigZagIndex] = (short) ((short)(temp + 16384.5) - 16384);
+			else
+			{
+				const short* p = origin + v*FULL_CHROMA_STRIDE + 2*u;
+				if(m_chromaFilter==CHROMA_TRIANGLE)
+					value = (p[-1] + 3*p[0] + 3*p[1] + p[2] + 4) >> 3;
+				else
+					value = (p[0] + p[1] + (u&1)) >> 1;
+			}
+			data[v*8 + u] = (char)value;
 		}
 	}
 }
 
 //-------------------------------------------------------------------------------
-void JpegEncoder::_write_jpeg_header(FILE* fp)
+void JpegEncoder::_foword_FDC(const char* channel_data, short* fdc_data, const JpegQuantDivisors* divisors)
+{
+	m_fdctQuant(channel_data, fdc_data, divisors);
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_write_jpeg_header(JpegBitWriter* out)
 {
 	//SOI
-	_write_word_(0xFFD8, fp);		// marker = 0xFFD8
+	_write_word_(0xFFD8, out);		// marker = 0xFFD8
 
 	//APPO
-	_write_word_(0xFFE0,fp);		// marker = 0xFFE0
-	_write_word_(16, fp);			// length = 16 for usual JPEG, no thumbnail
-	_write_("JFIF", 5, fp);			// 'JFIF\0'
-	_write_byte_(1, fp);			// version_hi
-	_write_byte_(1, fp);			// version_low
-	_write_byte_(0, fp);			// xyunits = 0 no units, normal density
-	_write_word_(1, fp);			// xdensity
-	_write_word_(1, fp);			// ydensity
-	_write_byte_(0, fp);			// thumbWidth
-	_write_byte_(0, fp);			// thumbHeight
-
-	//DQT
-	_write_word_(0xFFDB, fp);		//marker = 0xFFDB
-	_write_word_(132, fp);			//size=132
-	_write_byte_(0, fp);			//QTYinfo== 0:  bit 0..3: number of QT = 0 (table for Y) 
-									//				bit 4..7: precision of QT
-									//				bit 8	: 0
-	_write_(m_YTable, 64, fp);		//YTable
-	_write_byte_(1, fp);			//QTCbinfo = 1 (quantization table for Cb,Cr)
-	_write_(m_CbCrTable, 64, fp);	//CbCrTable
-
-	//SOFO
-	_write_word_(0xFFC0, fp);			//marker = 0xFFC0
-	_write_word_(17, fp);				//length = 17 for a truecolor YCbCr JPG
-	_write_byte_(8, fp);				//precision = 8: 8 bits/sample 
-	_write_word_(m_height&0xFFFF, fp);	//height
-	_write_word_(m_width&0xFFFF, fp);	//width
-	_write_byte_(3, fp);				//nrofcomponents = 3: We encode a truecolor JPG
-
-	_write_byte_(1, fp);				//IdY = 1
-	_write_byte_(0x11, fp);				//HVY sampling factors for Y (bit 0-3 vert., 4-7 hor.)(SubSamp 1x1)
-	_write_byte_(0, fp);				//QTY  Quantization Table number for Y = 0
-
-	_write_byte_(2, fp);				//IdCb = 2
-	_write_byte_(0x11, fp);				//HVCb = 0x11(SubSamp 1x1)
-	_write_byte_(1, fp);				//QTCb = 1
-
-	_write_byte_(3, fp);				//IdCr = 3
-	_write_byte_(0x11, fp);				//HVCr = 0x11 (SubSamp 1x1)
-	_write_byte_(1, fp);				//QTCr Normally equal to QTCb = 1
+	_write_word_(0xFFE0, out);		// marker = 0xFFE0
+	_write_word_(16, out);			// length = 16 for usual JPEG, no thumbnail
+	_write_("JFIF", 5, out);			// 'JFIF\0'
+	_write_byte_(1, out);			// version_hi
+	_write_byte_(1, out);			// version_low
+	_write_byte_(0, out);			// xyunits = 0 no units, normal density
+	_write_word_(1, out);			// xdensity
+	_write_word_(1, out);			// ydensity
+	_write_byte_(0, out);			// thumbWidth
+	_write_byte_(0, out);			// thumbHeight
+
+	//DQT，按质量缓存的表中已经序列化好了，灰度图像只写亮度的表
+	if(m_componentCount==3)
+	{
+		_write_(m_qualityTables->dqt, sizeof(m_qualityTables->dqt), out);
+	}
+	else
+	{
+		_write_word_(0xFFDB, out);		//marker = 0xFFDB
+		_write_word_(67, out);			//length = 67 for one table
+		_write_(m_qualityTables->dqt + 4, 65, out);
+	}
+
+	//SOFO，渐进式为SOF2，内容相同
+	_write_word_(m_progressive ? 0xFFC2 : 0xFFC0, out);	//marker = 0xFFC0 or 0xFFC2
+	_write_word_((unsigned short)(8 + 3*m_componentCount), out);	//length = 17 for a truecolor YCbCr JPG, 11 for gray
+	_write_byte_(8, out);				//precision = 8: 8 bits/sample 
+	_write_word_(m_source.height&0xFFFF, out);	//height
+	_write_word_(m_source.width&0xFFFF, out);	//width
+	_write_byte_((unsigned char)m_componentCount, out);	//nrofcomponents = 3: We encode a truecolor JPG, 1 for gray
+
+	_write_byte_(1, out);				//IdY = 1
+	_write_byte_((unsigned char)((m_hSamp<<4) | m_vSamp), out);	//HVY sampling factors for Y (bit 0-3 vert., 4-7 hor.)
+																//0x11 for 4:4:4, 0x21 for 4:2:2, 0x22 for 4:2:0
+	_write_byte_(0, out);				//QTY  Quantization Table number for Y = 0
+
+	if(m_componentCount==3)
+	{
+		_write_byte_(2, out);				//IdCb = 2
+		_write_byte_(0x11, out);				//HVCb = 0x11(SubSamp 1x1)
+		_write_byte_(1, out);				//QTCb = 1
+
+		_write_byte_(3, out);				//IdCr = 3
+		_write_byte_(0x11, out);				//HVCr = 0x11 (SubSamp 1x1)
+		_write_byte_(1, out);				//QTCr Normally equal to QTCb = 1
+	}
 	
-	//DHT
-	_write_word_(0xFFC4, fp);		//marker = 0xFFC4
-	_write_word_(0x01A2, fp);		//length = 0x01A2
-	_write_byte_(0, fp);			//HTYDCinfo bit 0..3	: number of HT (0..3), for Y =0
-									//			bit 4		: type of HT, 0 = DC table,1 = AC table
-									//			bit 5..7	: not used, must be 0
-	_write_(Standard_DC_Luminance_NRCodes, sizeof(Standard_DC_Luminance_NRCodes), fp);	//DC_L_NRC
-	_write_(Standard_DC_Luminance_Values, sizeof(Standard_DC_Luminance_Values), fp);		//DC_L_VALUE
-	_write_byte_(0x10, fp);			//HTYACinfo
-	_write_(Standard_AC_Luminance_NRCodes, sizeof(Standard_AC_Luminance_NRCodes), fp);
-	_write_(Standard_AC_Luminance_Values, sizeof(Standard_AC_Luminance_Values), fp); //we'll use the standard Huffman tables
-	_write_byte_(0x01, fp);			//HTCbDCinfo
-	_write_(Standard_DC_Chrominance_NRCodes, sizeof(Standard_DC_Chrominance_NRCodes), fp);
-	_write_(Standard_DC_Chrominance_Values, sizeof(Standard_DC_Chrominance_Values), fp);
-	_write_byte_(0x11, fp);			//HTCbACinfo
-	_write_(Standard_AC_Chrominance_NRCodes, sizeof(Standard_AC_Chrominance_NRCodes), fp);
-	_write_(Standard_AC_Chrominance_Values, sizeof(Standard_AC_Chrominance_Values), fp);
+	//DHT，标准表的DHT段在编译期已经生成，灰度图像只写亮度的两张表。渐进式的DHT和SOS在每次扫描之前写出
+	if(!m_progressive)
+	{
+		if(m_componentCount==3)
+		{
+			_write_(m_huffman->dht, m_huffman->dhtSize, out);
+		}
+		else
+		{
+			static const bool lumaTables[4] = { true, true, false, false };
+			_write_huffman_tables(m_huffman, lumaTables, out);
+		}
+	}
+
+	//DRI
+	if(m_restartInterval>0)
+	{
+		_write_word_(0xFFDD, out);		//marker = 0xFFDD
+		_write_word_(4, out);			//length = 4
+		_write_word_((unsigned short)m_restartInterval, out);	//restart interval, MCUs
+	}
 
 	//SOS
-	_write_word_(0xFFDA, fp);		//marker = 0xFFC4
-	_write_word_(12, fp);			//length = 12
-	_write_byte_(3, fp);			//nrofcomponents, Should be 3: truecolor JPG
-
-	_write_byte_(1, fp);			//Idy=1
-	_write_byte_(0, fp);			//HTY	bits 0..3: AC table (0..3)
-									//		bits 4..7: DC table (0..3)
-	_write_byte_(2, fp);			//IdCb
-	_write_byte_(0x11, fp);			//HTCb
-
-	_write_byte_(3, fp);			//IdCr
-	_write_byte_(0x11, fp);			//HTCr
-
-	_write_byte_(0, fp);			//Ss not interesting, they should be 0,63,0
-	_write_byte_(0x3F, fp);			//Se
-	_write_byte_(0, fp);			//Bf
+	if(!m_progressive)
+	{
+		static const JpegScanInfo baseline = { 3, { 0, 1, 2 }, 0, 63, 0, 0 };
+		static const JpegScanInfo baselineGray = { 1, { 0, 0, 0 }, 0, 63, 0, 0 };
+		_write_scan_header(m_componentCount==3 ? baseline : baselineGray, out);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_write_huffman_tables(const JpegHuffmanTables* tables, const bool* used, JpegBitWriter* out)
+{
+	const unsigned char info[4] = { 0x00, 0x10, 0x01, 0x11 };	//bit 0..3: number of HT, bit 4: 0 = DC table, 1 = AC table
+
+	int length = 2;
+	for(int t=0; t<4; t++)
+	{
+		if(used[t]) length += 17 + tables->specs[t].valueCount;
+	}
+
+	_write_word_(0xFFC4, out);		//marker = 0xFFC4
+	_write_word_((unsigned short)length, out);
+	for(int t=0; t<4; t++)
+	{
+		if(!used[t]) continue;
+		_write_byte_(info[t], out);
+		_write_(tables->specs[t].nrCodes, 16, out);
+		_write_(tables->specs[t].values, tables->specs[t].valueCount, out);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegEncoder::_write_scan_header(const JpegScanInfo& scan, JpegBitWriter* out)
+{
+	_write_word_(0xFFDA, out);		//marker = 0xFFDA
+	_write_word_((unsigned short)(6 + 2*scan.componentCount), out);	//length = 12 for a truecolor JPG
+	_write_byte_((unsigned char)scan.componentCount, out);	//nrofcomponents
+
+	for(int i=0; i<scan.componentCount; i++)
+	{
+		//亮度用0号表，色度用1号表。DC的表只在包含DC的扫描中有意义，AC的表只在包含AC的扫描中有意义
+		int component = scan.components[i];
+		int table = (component>0) ? 1 : 0;
+		int dcTable = (scan.Ss==0) ? table : 0;
+		int acTable = (scan.Se>0) ? table : 0;
+		_write_byte_((unsigned char)(component + 1), out);		//Id, 1 = Y, 2 = Cb, 3 = Cr
+		_write_byte_((unsigned char)((dcTable<<4) | acTable), out);	//bits 0..3: AC table (0..3)
+																		//bits 4..7: DC table (0..3)
+	}
+
+	_write_byte_((unsigned char)scan.Ss, out);		//Ss, 0 for baseline
+	_write_byte_((unsigned char)scan.Se, out);		//Se, 63 for baseline
+	_write_byte_((unsigned char)((scan.Ah<<4) | scan.Al), out);	//Ah, Al, 0 for baseline
 }
@@ -1,66 +1,354 @@
 #ifndef __JPEG_ENCODER_HEADER__
 #define __JPEG_ENCODER_HEADER__
 
-// BMPʽͼתΪJPEGʽ
+#include "jpeg_dct.h"
+#include "jpeg_simd.h"
+#include "jpeg_bitwriter.h"
+#include "jpeg_stats.h"
+#include "jpeg_thread_pool.h"
+#include "jpeg_image.h"
+#include "jpeg_output.h"
+#include "jpeg_async_output.h"
+#include "jpeg_bmp.h"
+#include "jpeg_tables.h"
+#include "jpeg_coefficients.h"
+#include "jpeg_progressive.h"
+#include "jpeg_trellis.h"
+
+// 将BMP格式的图像转化为JPEG格式
 class JpegEncoder
 {
 
 
-	//洢õķ
+	//存储供调用的方法
 public:
-	/**  */
+	/** 清理数据 */
 	void clean(void);
 
-	/** BMPļжȡļ֧24bitͼĳߴ糤ȱ8ıļ */
+	/** 从BMP文件中读取文件，支持不压缩的24bit、32bit和灰度调色板的8bit格式，尺寸任意。
+	 *  文件只是映射到内存中，编码时直接读取，在clean或者下一次读取之前不能修改这个文件 */
 	bool readFromBMP(const char* fileName);
 
-	/** ѹjpgļУquality_scaleʾȡֵΧ(0,100), ԽѹԽ*/
+	/** 压缩到jpg文件中，quality_scale表示质量，取值范围(0,100), 数字越大压缩比例越高。
+	 *  文件通过fileOutput()异步写入，编码不会因为写文件而停顿 */
 	bool encodeToJPG(const char* fileName, int quality_scale);
+	/** encodeToJPG使用的文件输出，可以在编码之前设置缓冲区大小、O_DIRECT和fsync策略 */
+	JpegAsyncFileOutput& fileOutput(void) { return m_fileOutput; }
+
+	/** 直接编码调用者内存中的图像，结果写入output，不经过文件。
+	 *  pixels不会被复制，stride为相邻两行的字节差(可以为负)。
+	 *  宽高任意(1~65535)，不足一个MCU的边缘在取块时重复最后一行和最后一列的像素，SOF中写的是实际的宽高。
+	 *  灰度输入编码为只有一个分量的JPEG；YUV平面格式不做颜色转换，总是编码为4:2:0，不受setSubsampling影响 */
+	bool encode(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+		int quality_scale, JpegOutput& output);
+
+	/** 只编码image中从(x,y)开始的width*height的矩形区域，直接从image的内存中读取，不复制像素。
+	 *  区域按一幅独立的图像编码，边缘重复区域自己的最后一行和最后一列。平面格式的x、y必须是偶数 */
+	bool encodeRegion(const JpegImageView& image, int x, int y, int width, int height, 
+		int quality_scale, JpegOutput& output);
+
+	/** 码率控制：在quality_scale的1~99之间二分查找，输出不超过maxBytes字节的文件中质量最好的一个。
+	 *  颜色转换和DCT只做一次，未量化的系数保存在内存中(每个像素最多6字节，浮点DCT为12字节)，每次尝试只重新量化并做熵编码，
+	 *  数出字节数。渐进式、最优霍夫曼表等设置照常生效。quality_scale不为0时返回选中的质量，
+	 *  输出与用这个质量直接调用encode的结果完全相同。质量最低时也放不下则返回false，不写入output */
+	bool encodeToSize(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+		int maxBytes, JpegOutput& output, int* quality_scale = 0);
+	/** 码率控制：输出亮度PSNR不低于minPsnr(分贝)的文件中最小的一个。PSNR是估计值，由未量化和量化后的DCT系数算出，
+	 *  再加上解码器把像素取整的误差(MSE加1/12)，不需要解码，也不需要每次都做熵编码。参照的是编码器颜色转换得到的Y，
+	 *  不包括颜色转换和色度抽样本身的误差，这部分与质量无关。估计偏保守，但不同解码器的IDCT精度不同，不能保证每个解码器都达标。
+	 *  取整误差使估计值最高约58.9dB，更高的目标总是返回false */
+	bool encodeToPsnr(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+		double minPsnr, JpegOutput& output, int* quality_scale = 0);
+
+	/** 同一幅图像输出多种质量(缩略图、不同网络条件的版本)时，先用transform做一次颜色转换和DCT，
+	 *  未量化的系数连同分量数、抽样因子和DCT方式存入store，之后每个质量调用一次encodeCoefficients，
+	 *  只做量化和熵编码。store可以交给其他JpegEncoder实例使用，多个线程同时读取同一个store是安全的 */
+	bool transform(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+		JpegDctStore& store);
+	/** 用store中的系数编码一个质量，渐进式、最优霍夫曼表、trellis、复位间隔和线程数照常生效，
+	 *  DCT方式和色度抽样沿用transform时的设置。输出与用同样的参数直接调用encode的结果完全相同 */
+	bool encodeCoefficients(const JpegDctStore& store, int quality_scale, JpegOutput& output);
+
+	/** 流式编码：begin写出文件头，之后用writeRows从上到下分批送入像素，最后调用finish。
+	 *  编码器只缓存一个MCU行(8或16行，另加上下各一行供色度滤波使用)，凑满一行MCU就立即编码输出，
+	 *  内存占用只与宽度有关，与高度无关。流式编码不使用多线程；最优霍夫曼表和渐进式都需要先看到整幅图像，设置了其中之一时begin返回false。
+	 *  只支持打包的像素格式，YUV平面格式begin返回false */
+	bool begin(int width, int height, JpegPixelFormat format, int quality_scale, JpegOutput& output);
+	/** 送入rows行像素，stride为相邻两行的字节差(可以为负)，送入的总行数超过图像高度时返回false */
+	bool writeRows(const unsigned char* pixels, int rows, int stride);
+	/** 结束流式编码，写出文件尾。送入的行数不足或者输出失败时返回false */
+	bool finish(void);
+
+	/** DCT变换的实现方式，定点(ISLOW)或浮点(FLOAT)，两者结果与标准DCT的误差都不超过±1 */
+	enum DctMethod
+	{
+		DCT_ISLOW,
+		DCT_FLOAT
+	};
+	/** 选择DCT变换的实现方式，默认为DCT_ISLOW */
+	void setDctMethod(DctMethod method);
+
+	/** 色度抽样方式，4:2:2水平方向减半，MCU为16*8；4:2:0水平和垂直方向都减半，MCU为16*16 */
+	enum Subsampling
+	{
+		SUBSAMPLE_444,
+		SUBSAMPLE_422,
+		SUBSAMPLE_420
+	};
+	/** 色度抽样的滤波器，BOX为相邻像素取平均，TRIANGLE为1-3-3-1的三角滤波，更平滑但要多转换MCU周围一圈像素 */
+	enum ChromaFilter
+	{
+		CHROMA_BOX,
+		CHROMA_TRIANGLE
+	};
+	/** 设置色度抽样方式，默认为4:4:4，即不抽样。灰度和YUV平面格式的输入不受影响 */
+	void setSubsampling(Subsampling mode, ChromaFilter filter = CHROMA_BOX);
+
+	/** 强制使用指定的指令集，默认在构造时选择CPU支持的最宽指令集，CPU不支持或者没有编译进来时返回false */
+	bool setSimdLevel(JpegSimdLevel level);
+	JpegSimdLevel getSimdLevel(void) const { return m_kernels->level; }
+
+	/** 设置复位间隔，以MCU为单位，写入DRI标记并在每个间隔之间插入RSTn标记，0表示不使用 */
+	void setRestartInterval(int mcus);
+
+	/** 两遍编码，第一遍统计每个符号出现的次数，生成这幅图像专用的最优霍夫曼表，文件一般能再小5%~10%
+	 *  第一遍的量化结果保存在内存中(每个像素最多6字节)，第二遍只做熵编码，默认关闭 */
+	void setOptimizeHuffman(bool enable) { m_optimizeHuffman = enable; }
+
+	/** 渐进式JPEG(SOF2)：先输出所有块的DC和低频的粗略值，再逐步补齐高频和低位，网络传输时可以先显示模糊的全图。
+	 *  整幅图像的量化结果先保存在内存中，每次扫描都生成专用的最优霍夫曼表，文件一般比基线编码小几个百分点，默认关闭 */
+	void setProgressive(bool enable) { m_progressive = enable; }
+
+	/** 率失真优化的量化(trellis量化)：按霍夫曼表的码长估计位数，每个块的AC系数一起选择，使失真 + lambda*位数 最小。
+	 *  失真为像素的误差平方和，色度块按抽样后覆盖的像素面积加权；lambda以亮度量化表AC部分步长平方的平均值为单位，
+	 *  整幅图像的亮度和色度使用同一个值。lambda越大文件越小、失真越大，0表示关闭(默认)，一般取0.002~0.05。
+	 *  DCT改用标量实现并逐块做动态规划，编码慢几倍，适合存档。
+	 *  位数按编码DCT时使用的霍夫曼表(标准表)计算，同时生成最优霍夫曼表时，最优表由优化后的系数生成 */
+	void setTrellisLambda(float lambda) { m_trellisLambda = lambda>0 ? lambda : 0; }
+
+	/** 平坦块的快速路径，默认打开：颜色转换后最大值与最小值之差小到AC系数量化后一定为0的块(上限随质量变化，压缩越多越大)
+	 *  跳过DCT，直接由像素之和算出DC；每一行都相同、或者每一行的8个像素都相同的块只做一维DCT(只用于定点DCT)。
+	 *  输出与完整的DCT完全相同，截图、文档这类大片纯色的图像编码更快，块数见stats()的flatBlocks和reducedBlocks。
+	 *  关闭只用于比较速度 */
+	void setFastBlocks(bool enable) { m_fastBlocks = enable; }
+
+	/** 设置编码线程数，大于1并且设置了复位间隔时，图像按复位间隔分成若干条带并行编码 */
+	void setThreadCount(int threads);
+
+	/** 流水线编码，线程数大于1时对没有复位间隔的基线编码生效：调用线程只做熵编码，其余线程按MCU行轮流做颜色转换、DCT和量化，
+	 *  结果通过每个线程各自的无锁队列(每个队列4个MCU行)按顺序交给熵编码。输出与单线程编码完全相同，
+	 *  速度受熵编码一个线程的限制，一般2~3个线程就够了。设置了复位间隔时仍按条带并行，两遍编码和渐进式编码的变换本来就是并行的。默认关闭 */
+	void setPipelined(bool enable) { m_pipelined = enable; }
+
+	/** 最近一次编码的统计，每次encode或begin时清零，流式编码的统计在finish之后完整。
+	 *  编译时定义了JPEG_NO_STATS时全部为0 */
+	const JpegEncodeStats& stats(void) const { return m_stats; }
 
 private:
-	//˽б
-	//ͼ
+	//定义私有变量
+	//图像宽高像素数
 	int				m_width;
 	int				m_height;
-	//洢BMPļȡRGBʽ
-	unsigned char*	m_rgbBuffer;
-	//洢׼ȷ
-	unsigned char	m_YTable[64];
-	//洢׼ɫ
-	unsigned char	m_CbCrTable[64];
-	// 洢ʾcodewordlengthʾλȣvalue
-	struct BitString
-	{
-		int length;	
-		int value;
-	};
+	//映射到内存中的BMP文件，像素不复制
+	JpegBmpFile		m_bmpFile;
+	//当前正在编码的图像
+	JpegImageView	m_source;
+	//m_source.pixels对应的图像行号，流式编码时指向条带缓冲区，其他时候为0
+	int				m_sourceTop;
+	//平面格式的色度平面中与m_source.pixels对应的位置，一般紧接在Y平面之后，编码区域时指向区域的左上角。
+	//I420的V平面在U平面之后m_chromaPlaneHeight行
+	const unsigned char*	m_chromaPlane;
+	int				m_chromaPlaneHeight;
+	//当前质量的量化表、除数表和DQT段，所有实例共享的缓存中的一项
+	const JpegQualityTables*	m_qualityTables;
+	//当前指令集的内核函数表，以及使用的DCT+量化实现
+	const JpegKernels*	m_kernels;
+	DctMethod			m_dctMethod;
+	JpegFdctQuantFunc	m_fdctQuant;
+	// 存储表示霍夫曼编码的codeword。length表示位长度，value
+	typedef JpegHuffmanCode BitString;
+
+	//当前使用的霍夫曼表，通常指向编译期生成的标准表
+	const JpegHuffmanTables*	m_huffman;
+	//最优霍夫曼表，第一次使用时分配
+	JpegHuffmanTables*			m_optimizedHuffman;
+	//是否生成最优霍夫曼表
+	bool			m_optimizeHuffman;
+	//是否输出渐进式JPEG
+	bool			m_progressive;
+	//trellis量化的lambda，0表示普通的四舍五入
+	float			m_trellisLambda;
+	//是否使用平坦块的快速路径
+	bool			m_fastBlocks;
+	//两遍编码和渐进式编码时整幅图像的量化结果，第一次使用时分配，之后重复使用
+	JpegCoefficientStore	m_coefficients;
+	//m_coefficients中是否为当前图像的量化结果，是的话编码时直接使用
+	bool			m_coefficientsReady;
+	//码率控制时整幅图像未量化的DCT系数
+	JpegDctStore	m_dctStore;
+	//TRANSFORM_RAW写入的系数，以及TRANSFORM_REQUANTIZE和_lumaPsnr读取的系数，码率控制时都指向m_dctStore
+	JpegDctStore*		m_dctOutput;
+	const JpegDctStore*	m_dct;
+
+	//输出缓冲区，第一次编码时分配，之后重复使用
+	unsigned char*	m_outputBuffer;
+	//encodeToJPG的文件输出，缓冲区和io_uring在第一次使用时创建，之后重复使用
+	JpegAsyncFileOutput	m_fileOutput;
+
+	//设置的色度抽样方式
+	Subsampling		m_subsampling;
+	ChromaFilter	m_chromaFilter;
+	//当前图像的亮度分量的水平、垂直抽样因子，色度分量固定为1，即MCU为(8*m_hSamp)*(8*m_vSamp)个像素。
+	//一般由m_subsampling决定，灰度图像固定为1，YUV平面格式固定为2
+	int				m_hSamp;
+	int				m_vSamp;
+	//当前图像的分量数，灰度为1，其他为3
+	int				m_componentCount;
 
-	BitString m_Y_DC_Huffman_Table[12];
-	BitString m_Y_AC_Huffman_Table[256];
+	//复位间隔(MCU个数)，0表示不使用
+	int				m_restartInterval;
+	//流式编码的状态，begin时创建输出，finish时释放
+	JpegBitWriter*	m_streamWriter;
+	//一个MCU行的像素，上下各多一行
+	std::vector<unsigned char>	m_band;
+	//已经收到的行数
+	int				m_streamRows;
+	//跨条带延续的DC预测值
+	short			m_streamDC[3];
 
-	BitString m_CbCr_DC_Huffman_Table[12];
-	BitString m_CbCr_AC_Huffman_Table[256];
+	//并行编码用的线程池，单线程时为0
+	JpegThreadPool*	m_threadPool;
+	//是否使用流水线编码，以及流水线中各个变换线程的MCU行缓冲区，第一次使用时分配
+	bool			m_pipelined;
+	std::vector<short>	m_pipelineRows;
+
+	//当前或最近一次编码的统计，以及开始编码时的时间
+	JpegEncodeStats	m_stats;
+	//多线程编码时每段任务各自的统计，最后合并到m_stats中
+	std::vector<JpegEncodeStats>	m_chunkStats;
+	unsigned long long	m_statsStartCycles;
+	std::chrono::steady_clock::time_point	m_statsStartTime;
 
 private:
-	void _initHuffmanTables(void);
 	void _initQualityTables(int quality);
-	void _computeHuffmanTable(const char* nr_codes, const unsigned char* std_table, BitString* huffman_table);
-	BitString _getBitCode(int value);
+	static bool _checkImage(int width, int height, JpegPixelFormat format);
+	//设置要编码的图像，并按像素格式确定分量数和抽样因子，平面格式的stride不合法时返回false
+	bool _setSource(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format);
+	//已经_setSource之后，编码整幅图像
+	bool _encodeSource(int quality_scale, JpegOutput& output);
+	//从系数准备好之后开始，写出整个文件：文件头、熵编码的数据和文件尾。dirty和segments见_encodeSegments
+	bool _writeImage(int mcuCount, JpegOutput& output, 
+		const unsigned char* dirty = 0, std::vector< std::vector<unsigned char> >* segments = 0);
+	//码率控制的公共部分，psnrTarget为false时target为字节数，否则为PSNR
+	bool _encodeToTarget(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format, 
+		bool psnrTarget, double target, JpegOutput& output, int* quality_scale);
+	//已经_setSource之后，只重新变换dirty中标出的MCU，其余沿用m_coefficients中上一次的量化结果，再写出整个文件。
+	//segments不为0时按复位间隔缓存熵编码的结果，见_encodeSegments
+	bool _encodeDirty(int quality_scale, const unsigned char* dirty, std::vector< std::vector<unsigned char> >* segments, 
+		JpegOutput& output);
+	//m_coefficients相对于m_dct的亮度PSNR的估计值，包括解码时取整的误差
+	double _lumaPsnr(void);
+	//图像第y行的起始地址
+	const unsigned char* _sourceRow(int y) const { return m_source.pixels + (long long)(y - m_sourceTop) * m_source.stride; }
+	//流式编码时，编码条带缓冲区中已经完整的一行MCU
+	void _encodeBand(void);
+
+	//统计所有MCU中每个符号出现的次数，生成最优霍夫曼表
+	void _optimizeHuffmanTables(int mcuCount);
+	void _countHuffmanSymbols(const short* DU, short& prevDC, long long* dcFreq, long long* acFreq);
+	//由符号的频率生成码长不超过16位的最优霍夫曼表，freq有257项，会被修改
+	static void _buildOptimalHuffmanSpec(long long* freq, JpegHuffmanSpec* spec);
 
-	void _convertColorSpace(const unsigned char* rgbBuffer, char* yData, char* cbData, char* crData);
-	void _foword_FDC(const char* channel_data, short* fdc_data, const unsigned char* quant_table);
+	//转换一个MCU的颜色空间，色度抽样也在这里完成。yData依次存放MCU中的每个亮度块
+	void _convertColorSpace(const unsigned char* pixels, int stride, int xPos, int yPos, 
+		char* yData, char* cbData, char* crData);
+	//图像右边或下边不足一个MCU时，复制到edge中并重复边缘的像素
+	void _copyEdgeMcu(int xPos, int yPos, unsigned char* edge);
+	//YUV平面格式：直接从各个平面取出一个MCU的亮度块和色度块，只减去128
+	void _convertPlanarMcu(int xPos, int yPos, char* yData, char* cbData, char* crData);
+	//平面中从(x,y)开始的8*8个像素(每个pixelSize字节)，超出平面的部分重复边缘的像素，结果的行距为8*pixelSize
+	static void _gatherBlock(const unsigned char* plane, int stride, int planeWidth, int planeHeight, 
+		int x, int y, int pixelSize, unsigned char* block);
+	//把pixels开始的width*height个像素复制到outWidth*outHeight的out中，多出的列和行重复最后一列和最后一行
+	static void _replicateEdge(const unsigned char* pixels, int stride, int width, int height, 
+		int pixelSize, int outWidth, int outHeight, unsigned char* out);
+	//三角滤波需要MCU外面一圈像素的色度，超出图像的部分取最近的边缘像素
+	void _fillChromaBorder(int xPos, int yPos, short* cbFull, short* crFull);
+	void _downsampleChroma(const short* full, char* data);
+	void _foword_FDC(const char* channel_data, short* fdc_data, const JpegQuantDivisors* divisors);
+	//component为分量序号(0~2)，统计时用
 	void _doHuffmanEncoding(const short* DU, short& prevDC, const BitString* HTDC, const BitString* HTAC, 
-		BitString* outputBitString, int& bitStringCounts);
+		JpegBitWriter* out, JpegEncodeStats* stats, int component);
+
+	//一个MCU的颜色转换，包括边缘MCU的复制
+	void _convertMcu(int mcu, char* yData, char* cbData, char* crData);
+	//一个MCU的颜色转换、DCT和量化，结果依次为所有亮度块、Cb块、Cr块，各阶段的耗时累加到stats中
+	void _transformMcu(int mcu, short* coef, JpegEncodeStats* stats);
+	//一个块的DCT，不量化，自然顺序，定点DCT的结果也存为float，用于trellis量化
+	void _dctRaw(const char* data, float* raw);
+	//平坦的块跳过DCT，只有一个方向变化的块只做一维DCT，结果与完整的DCT完全相同，不是这两种块时返回false。
+	//coef和raw只有一个不为0：coef为量化后的系数，与_foword_FDC相同；raw为未量化的系数，与_dctRaw相同
+	bool _fastDct(const char* data, int component, short* coef, float* raw, JpegEncodeStats* stats);
+	//一个MCU的颜色转换和DCT，不量化，结果存入m_dctOutput
+	void _transformMcuRaw(int mcu, JpegEncodeStats* stats);
+	//用当前的量化表把m_dct中的一个MCU量化到coef中，与_foword_FDC的结果完全相同，耗时计入stats的DCT
+	void _requantizeMcu(int mcu, short* coef, JpegEncodeStats* stats);
+	//量化一个块未量化的DCT系数，component为0时用亮度的量化表和霍夫曼表，否则用色度的，打开了trellis量化时在这里优化。
+	//floatDct表示raw是jpeg_fdct_float的输出，否则是jpeg_fdct_islow的输出，两者的舍入方式不同
+	void _quantizeBlock(const float* raw, short* coef, int component, bool floatDct);
+
+	//_transformAll对每个MCU做的事
+	enum TransformMode
+	{
+		TRANSFORM_QUANTIZED,	//颜色转换、DCT和量化，结果存入m_coefficients
+		TRANSFORM_RAW,			//颜色转换和DCT，结果存入m_dctOutput
+		TRANSFORM_REQUANTIZE	//从m_dct重新量化到m_coefficients
+	};
+	//两遍编码的第一遍，把所有MCU的量化结果存入m_coefficients，有线程池时并行执行。
+	//dirty不为0时只处理dirty[mcu]不为0的MCU，其余保留m_coefficients中原来的结果
+	void _transformAll(int mcuCount, TransformMode mode = TRANSFORM_QUANTIZED, const unsigned char* dirty = 0);
+	struct TransformJob;
+	static void _transformTask(void* context, int index);
+
+	//编码[firstMcu, endMcu)范围内的MCU，prevDC为三个分量的DC预测值，编码后更新。
+	//多线程时每个线程使用各自的stats，最后再合并。coef不为0时是这些MCU已经量化好的系数，依次存放
+	void _encodeMcus(int firstMcu, int endMcu, short* prevDC, JpegBitWriter* out, JpegEncodeStats* stats, 
+		const short* coef = 0);
+	//按复位间隔分成条带，用线程池并行编码后依次写出
+	void _encodeStripes(int mcuCount, JpegBitWriter* out);
+	struct StripeJob;
+	static void _encodeStripeTask(void* context, int index);
+	//流水线编码：变换线程按MCU行轮流变换，调用线程按顺序从各个线程的队列中取出并做熵编码
+	void _encodePipelined(int mcuCount, JpegBitWriter* out);
+	struct PipelineJob;
+	static void _pipelineTask(void* context, int index);
+	//基线编码的帧间缓存：每个复位间隔熵编码的数据(包括开头的RSTn标记)存在segments中，
+	//间隔中没有dirty标记的MCU时直接沿用上一帧的数据，否则重新编码。有线程池时并行编码
+	void _encodeSegments(int mcuCount, const unsigned char* dirty, std::vector< std::vector<unsigned char> >& segments, 
+		JpegBitWriter* out);
+	struct SegmentJob;
+	static void _encodeSegmentTask(void* context, int index);
+	//按扫描脚本依次输出渐进式JPEG的每次扫描
+	void _encodeProgressive(JpegBitWriter* out);
+
+	//开始一次编码的统计；结束时记下总时间，并加上输出级的统计
+	void _beginStats(void);
+	void _endStats(const JpegBitWriter* out);
 
 private:
-	void _write_jpeg_header(FILE* fp);
-	void _write_byte_(unsigned char value, FILE* fp);
-	void _write_word_(unsigned short value, FILE* fp);
-	void _write_bitstring_(const BitString* bs, int counts, int& newByte, int& newBytePos, FILE* fp);
-	void _write_(const void* p, int byteSize, FILE* fp);
+	void _write_jpeg_header(JpegBitWriter* out);
+	//DHT段，只包含used中为true的表
+	void _write_huffman_tables(const JpegHuffmanTables* tables, const bool* used, JpegBitWriter* out);
+	void _write_scan_header(const JpegScanInfo& scan, JpegBitWriter* out);
+	void _write_byte_(unsigned char value, JpegBitWriter* out);
+	void _write_word_(unsigned short value, JpegBitWriter* out);
+	void _write_(const void* p, int byteSize, JpegBitWriter* out);
+
+	//帧间缓存的编码器直接使用_setSource、_encodeDirty和编码参数
+	friend class JpegSequenceEncoder;
 
 public:
-	//췽~
+	//构造方法~
 	JpegEncoder();
 	~JpegEncoder();
 };
@@ -0,0 +1,69 @@
+#ifndef __JPEG_IMAGE_HEADER__
+#define __JPEG_IMAGE_HEADER__
+
+/** 输入像素格式 */
+enum JpegPixelFormat
+{
+	JPEG_PIXEL_BGR,			//每像素3字节，B G R顺序，即BMP文件的格式
+	JPEG_PIXEL_RGB,			//每像素3字节，R G B顺序
+	JPEG_PIXEL_BGRA,		//每像素4字节，B G R A顺序，A被忽略
+	JPEG_PIXEL_RGBA,		//每像素4字节，R G B A顺序，A被忽略
+	JPEG_PIXEL_BGRX,		//每像素4字节，第4个字节没有使用，即32位BMP文件的格式
+	JPEG_PIXEL_RGBX,
+	JPEG_PIXEL_GRAY,		//每像素1字节的灰度，编码为只有一个分量的JPEG
+	//下面两种是YUV 4:2:0的平面格式，Y平面之后紧接着色度平面，stride为Y平面相邻两行的字节差，必须为正数。
+	//数值按JFIF的全范围YCbCr处理，不做颜色转换，总是编码为4:2:0
+	JPEG_PIXEL_I420,		//Y平面，之后是U平面和V平面，每个(width+1)/2 * (height+1)/2，行距为(stride+1)/2
+	JPEG_PIXEL_NV12,		//Y平面，之后是U、V交错的平面，(height+1)/2行，行距与Y平面相同，宽度为奇数时stride至少为width+1
+	JPEG_PIXEL_FORMAT_COUNT
+};
+
+/** 每个像素的字节数，平面格式为Y平面中每个像素的字节数 */
+inline int jpeg_pixel_size(JpegPixelFormat format)
+{
+	switch(format)
+	{
+	case JPEG_PIXEL_BGR:
+	case JPEG_PIXEL_RGB:	return 3;
+	case JPEG_PIXEL_BGRA:
+	case JPEG_PIXEL_RGBA:
+	case JPEG_PIXEL_BGRX:
+	case JPEG_PIXEL_RGBX:	return 4;
+	case JPEG_PIXEL_GRAY:
+	case JPEG_PIXEL_I420:
+	case JPEG_PIXEL_NV12:	return 1;
+	default:				return 0;
+	}
+}
+
+/** 是否为YUV平面格式，这时像素不是逐个打包存放的，不能流式编码 */
+inline bool jpeg_pixel_planar(JpegPixelFormat format)
+{
+	return format==JPEG_PIXEL_I420 || format==JPEG_PIXEL_NV12;
+}
+
+/** 编码出的JPEG的分量数，灰度为1，其他为3 */
+inline int jpeg_pixel_components(JpegPixelFormat format)
+{
+	return format==JPEG_PIXEL_GRAY ? 1 : 3;
+}
+
+/** 一幅width*height的图像中像素数据的字节数，不包括行尾的填充 */
+inline long long jpeg_pixel_bytes(JpegPixelFormat format, int width, int height)
+{
+	long long bytes = (long long)width * height * jpeg_pixel_size(format);
+	if(jpeg_pixel_planar(format)) bytes += 2LL * ((width+1)/2) * ((height+1)/2);
+	return bytes;
+}
+
+/** 调用者内存中的一幅图像，不拥有像素数据。stride为相邻两行起始地址的字节差，可以为负数 */
+struct JpegImageView
+{
+	const unsigned char*	pixels;		//第一行(图像最上面一行)的起始地址
+	int						width;
+	int						height;
+	int						stride;
+	JpegPixelFormat			format;
+};
+
+#endif
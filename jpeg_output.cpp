@@ -0,0 +1,48 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <string.h>
+
+#include "jpeg_output.h"
+
+//-------------------------------------------------------------------------------
+bool JpegOutput::writeCallback(void* context, const unsigned char* data, int size)
+{
+	return ((JpegOutput*)context)->write(data, size);
+}
+
+//-------------------------------------------------------------------------------
+JpegBufferOutput::JpegBufferOutput(unsigned char* buffer, int capacity)
+	: m_buffer(buffer)
+	, m_capacity(capacity)
+	, m_size(0)
+	, m_overflow(false)
+{
+}
+
+//-------------------------------------------------------------------------------
+bool JpegBufferOutput::write(const unsigned char* data, int size)
+{
+	if(m_overflow || size > m_capacity - m_size)
+	{
+		m_overflow = true;
+		return false;
+	}
+	memcpy(m_buffer + m_size, data, size);
+	m_size += size;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegVectorOutput::write(const unsigned char* data, int size)
+{
+	m_data.insert(m_data.end(), data, data + size);
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegFileOutput::write(const unsigned char* data, int size)
+{
+	return fwrite(data, 1, size, m_fp) == (size_t)size;
+}
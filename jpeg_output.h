@@ -0,0 +1,97 @@
+#ifndef __JPEG_OUTPUT_HEADER__
+#define __JPEG_OUTPUT_HEADER__
+
+#include <stdio.h>
+#include <vector>
+
+#include "jpeg_bitwriter.h"
+
+// 编码结果的输出目标。编码器先把数据攒在自己的缓冲区中，满了才调用一次write
+class JpegOutput
+{
+public:
+	virtual ~JpegOutput() {}
+
+	/** 写入数据，失败时返回false，编码会以失败结束 */
+	virtual bool write(const unsigned char* data, int size) = 0;
+
+	/** 作为JpegBitWriter的输出回调，context为JpegOutput* */
+	static bool writeCallback(void* context, const unsigned char* data, int size);
+};
+
+/** 写入调用者提供的固定大小的缓冲区，放不下时编码失败 */
+class JpegBufferOutput : public JpegOutput
+{
+public:
+	JpegBufferOutput(unsigned char* buffer, int capacity);
+
+	virtual bool write(const unsigned char* data, int size);
+
+	/** 已经写入的字节数 */
+	int size(void) const { return m_size; }
+	/** 是否因为空间不足而失败过 */
+	bool overflowed(void) const { return m_overflow; }
+	/** 从头开始重新写入 */
+	void reset(void) { m_size = 0; m_overflow = false; }
+
+private:
+	unsigned char*	m_buffer;
+	int				m_capacity;
+	int				m_size;
+	bool			m_overflow;
+};
+
+/** 追加到一个可以增长的vector中，vector由调用者持有 */
+class JpegVectorOutput : public JpegOutput
+{
+public:
+	explicit JpegVectorOutput(std::vector<unsigned char>& data) : m_data(data) {}
+
+	virtual bool write(const unsigned char* data, int size);
+
+	std::vector<unsigned char>& data(void) { return m_data; }
+
+private:
+	std::vector<unsigned char>& m_data;
+};
+
+/** 每次写入都转交给调用者的回调函数，比如直接发送到socket */
+class JpegCallbackOutput : public JpegOutput
+{
+public:
+	JpegCallbackOutput(JpegWriteFunc write, void* context) : m_write(write), m_context(context) {}
+
+	virtual bool write(const unsigned char* data, int size) { return m_write(m_context, data, size); }
+
+private:
+	JpegWriteFunc	m_write;
+	void*			m_context;
+};
+
+/** 只数字节数，数据直接丢掉，用来预先知道编码结果的大小 */
+class JpegCountingOutput : public JpegOutput
+{
+public:
+	JpegCountingOutput() : m_size(0) {}
+
+	virtual bool write(const unsigned char* data, int size) { (void)data; m_size += size; return true; }
+
+	long long size(void) const { return m_size; }
+
+private:
+	long long	m_size;
+};
+
+/** 写入已经打开的文件，不负责关闭 */
+class JpegFileOutput : public JpegOutput
+{
+public:
+	explicit JpegFileOutput(FILE* fp) : m_fp(fp) {}
+
+	virtual bool write(const unsigned char* data, int size);
+
+private:
+	FILE*	m_fp;
+};
+
+#endif
@@ -0,0 +1,308 @@
+#include "jpeg_progressive.h"
+
+//-------------------------------------------------------------------------------
+const JpegScanInfo jpeg_progressive_script[JPEG_PROGRESSIVE_SCAN_COUNT] =
+{
+	{ 3, { 0, 1, 2 },  0,  0, 0, 1 },	//所有分量的DC，去掉最低位
+	{ 1, { 0, 0, 0 },  1,  5, 0, 2 },	//亮度最低的几个频率，去掉最低两位
+	{ 1, { 2, 0, 0 },  1, 63, 0, 1 },	//色度的数据量小，不再细分频谱
+	{ 1, { 1, 0, 0 },  1, 63, 0, 1 },
+	{ 1, { 0, 0, 0 },  6, 63, 0, 2 },	//亮度其余的频率
+	{ 1, { 0, 0, 0 },  1, 63, 2, 1 },	//亮度AC的倒数第二位
+	{ 3, { 0, 1, 2 },  0,  0, 1, 0 },	//DC的最低位
+	{ 1, { 2, 0, 0 },  1, 63, 1, 0 },	//色度AC的最低位
+	{ 1, { 1, 0, 0 },  1, 63, 1, 0 },
+	{ 1, { 0, 0, 0 },  1, 63, 1, 0 },	//亮度AC的最低位，通常是最大的一次扫描，放在最后
+};
+
+//-------------------------------------------------------------------------------
+const JpegScanInfo jpeg_progressive_gray_script[JPEG_PROGRESSIVE_GRAY_SCAN_COUNT] =
+{
+	{ 1, { 0, 0, 0 },  0,  0, 0, 1 },
+	{ 1, { 0, 0, 0 },  1,  5, 0, 2 },
+	{ 1, { 0, 0, 0 },  6, 63, 0, 2 },
+	{ 1, { 0, 0, 0 },  1, 63, 2, 1 },
+	{ 1, { 0, 0, 0 },  0,  0, 1, 0 },
+	{ 1, { 0, 0, 0 },  1, 63, 1, 0 },
+};
+
+//-------------------------------------------------------------------------------
+JpegScanEncoder::JpegScanEncoder(const JpegCoefficientStore& store, const JpegScanInfo& scan, int restartInterval)
+	: m_store(store)
+	, m_scan(scan)
+	, m_restartInterval(restartInterval)
+	, m_freq(0)
+	, m_tables(0)
+	, m_out(0)
+	, m_acTable(jpeg_scan_table(scan, scan.components[0]))
+	, m_eobrun(0)
+	, m_correctionCount(0)
+{
+	m_lastDC[0] = m_lastDC[1] = m_lastDC[2] = 0;
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::gather(long long (*freq)[257])
+{
+	m_freq = freq;
+	m_tables = 0;
+	m_out = 0;
+	_run();
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::encode(const JpegHuffmanTables& tables, JpegBitWriter* out)
+{
+	m_tables = &tables;
+	m_out = out;
+	_run();
+	out->flushBits();
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_run(void)
+{
+	m_lastDC[0] = m_lastDC[1] = m_lastDC[2] = 0;
+	m_eobrun = 0;
+	m_correctionCount = 0;
+
+	if(m_scan.componentCount>1)
+	{
+		//交错扫描(只用于DC)按MCU的顺序，MCU中的块与JpegCoefficientStore中的排列相同
+		int yBlocks = m_store.hSamp()*m_store.vSamp();
+		int mcuCount = m_store.mcuCount();
+		for(int mcu=0; mcu<mcuCount; mcu++)
+		{
+			if(m_restartInterval>0 && mcu>0 && mcu%m_restartInterval==0)
+				_restart((mcu/m_restartInterval - 1) & 7);
+
+			const short* coef = m_store.mcu(mcu);
+			for(int i=0; i<m_scan.componentCount; i++)
+			{
+				int component = m_scan.components[i];
+				if(component==0)
+				{
+					for(int k=0; k<yBlocks; k++) _encodeBlock(coef + k*64, 0);
+				}
+				else
+				{
+					_encodeBlock(coef + (yBlocks + component - 1)*64, component);
+				}
+			}
+		}
+	}
+	else
+	{
+		//非交错扫描中每个块就是一个MCU，按分量自己的分辨率从左到右、从上到下
+		int component = m_scan.components[0];
+		int blocksWide = m_store.blocksWide(component);
+		int blocksHigh = m_store.blocksHigh(component);
+		for(int by=0; by<blocksHigh; by++)
+		{
+			for(int bx=0; bx<blocksWide; bx++)
+			{
+				int index = by*blocksWide + bx;
+				if(m_restartInterval>0 && index>0 && index%m_restartInterval==0)
+					_restart((index/m_restartInterval - 1) & 7);
+
+				_encodeBlock(m_store.block(component, bx, by), component);
+			}
+		}
+	}
+
+	_emitEobrun();
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_restart(int number)
+{
+	_emitEobrun();
+
+	if(m_out)
+	{
+		unsigned char marker[2] = { 0xFF, (unsigned char)(0xD0 + number) };
+		m_out->flushBits();
+		m_out->writeBytes(marker, 2);
+	}
+
+	m_lastDC[0] = m_lastDC[1] = m_lastDC[2] = 0;
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_encodeBlock(const short* block, int component)
+{
+	if(m_scan.Ss==0)
+	{
+		//DC的细化扫描每块只有一位，不用霍夫曼编码
+		if(m_scan.Ah==0)
+			_encodeDcFirst(block, component);
+		else
+			_emitBits((block[0] >> m_scan.Al) & 1, 1);
+	}
+	else
+	{
+		if(m_scan.Ah==0)
+			_encodeAcFirst(block);
+		else
+			_encodeAcRefine(block);
+	}
+}
+
+//-------------------------------------------------------------------------------
+// 与基线编码的DC相同，只是差分的对象是右移Al位之后的值
+void JpegScanEncoder::_encodeDcFirst(const short* block, int component)
+{
+	int value = block[0] >> m_scan.Al;
+	int diff = value - m_lastDC[component];
+	m_lastDC[component] = value;
+
+	int length = jpeg_bit_length(diff<0 ? -diff : diff);
+	_emitSymbol(jpeg_scan_table(m_scan, component), length);
+	if(length) _emitBits((unsigned int)(diff<0 ? diff-1 : diff) & ((1u<<length)-1), length);
+}
+
+//-------------------------------------------------------------------------------
+// 频谱范围内的系数除以2^Al(向0取整)后按基线的方式编码，只是块末尾的EOB不立即输出，
+// 连续的EOB合并成一个EOBRUN符号
+void JpegScanEncoder::_encodeAcFirst(const short* block)
+{
+	int run = 0;
+	for(int k=m_scan.Ss; k<=m_scan.Se; k++)
+	{
+		int value = block[k];
+		int bits = value;
+		if(value<0)
+		{
+			value = (-value) >> m_scan.Al;
+			bits = ~value;
+		}
+		else
+		{
+			value >>= m_scan.Al;
+			bits = value;
+		}
+
+		if(value==0)
+		{
+			run++;
+			continue;
+		}
+
+		_emitEobrun();
+		for(; run>15; run-=16) _emitSymbol(m_acTable, 0xF0);
+
+		int length = jpeg_bit_length(value);
+		_emitSymbol(m_acTable, (run<<4) | length);
+		_emitBits((unsigned int)bits & ((1u<<length)-1), length);
+		run = 0;
+	}
+
+	//EOBRUN最多0x7FFF，对应码长最大的EOB14符号
+	if(run>0 && ++m_eobrun==0x7FFF) _emitEobrun();
+}
+
+//-------------------------------------------------------------------------------
+// 细化扫描输出每个系数的第Al位。之前已经非0的系数只输出一个修正位，缓存起来跟在下一个符号后面；
+// 这一次才变成非0的系数(绝对值为1)按游程编码，再跟一位符号位。规则与JPEG标准G.1.2.3以及libjpeg相同
+void JpegScanEncoder::_encodeAcRefine(const short* block)
+{
+	int absValues[64];
+	int lastNewNonzero = 0;
+	for(int k=m_scan.Ss; k<=m_scan.Se; k++)
+	{
+		int value = block[k];
+		value = (value<0 ? -value : value) >> m_scan.Al;
+		absValues[k] = value;
+		if(value==1) lastNewNonzero = k;
+	}
+
+	//这一块的修正位接在之前缓存的修正位后面
+	char* pending = m_correctionBits + m_correctionCount;
+	int pendingCount = 0;
+
+	int run = 0;
+	for(int k=m_scan.Ss; k<=m_scan.Se; k++)
+	{
+		int value = absValues[k];
+		if(value==0)
+		{
+			run++;
+			continue;
+		}
+
+		//后面还有新的非0系数时，16个0要用ZRL输出；否则留给EOB
+		while(run>15 && k<=lastNewNonzero)
+		{
+			_emitEobrun();
+			_emitSymbol(m_acTable, 0xF0);
+			run -= 16;
+			_emitBufferedBits(pending, pendingCount);
+			pending = m_correctionBits;
+			pendingCount = 0;
+		}
+
+		if(value>1)
+		{
+			pending[pendingCount++] = (char)(value & 1);
+			continue;
+		}
+
+		_emitEobrun();
+		_emitSymbol(m_acTable, (run<<4) | 1);
+		_emitBits(block[k]<0 ? 0 : 1, 1);
+		_emitBufferedBits(pending, pendingCount);
+		pending = m_correctionBits;
+		pendingCount = 0;
+		run = 0;
+	}
+
+	if(run>0 || pendingCount>0)
+	{
+		m_eobrun++;
+		m_correctionCount += pendingCount;
+		//缓存满之前先输出，保证下一块的修正位放得下
+		if(m_eobrun==0x7FFF || m_correctionCount>MAX_CORRECTION_BITS-64+1) _emitEobrun();
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_emitSymbol(int table, int symbol)
+{
+	if(m_out)
+	{
+		const JpegHuffmanCode& code = m_tables->codes[table][symbol];
+		m_out->putBits(code.value, code.length);
+	}
+	else
+	{
+		m_freq[table][symbol]++;
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_emitBits(unsigned int bits, int length)
+{
+	if(m_out) m_out->putBits(bits, length);
+}
+
+//-------------------------------------------------------------------------------
+void JpegScanEncoder::_emitBufferedBits(const char* bits, int count)
+{
+	if(m_out==0) return;
+	for(int i=0; i<count; i++) m_out->putBits(bits[i], 1);
+}
+
+//-------------------------------------------------------------------------------
+// EOBRUN为n时输出符号(r<<4)，r为n的最高位的位置，后面跟n的低r位
+void JpegScanEncoder::_emitEobrun(void)
+{
+	if(m_eobrun==0) return;
+
+	int length = jpeg_bit_length(m_eobrun) - 1;
+	_emitSymbol(m_acTable, length<<4);
+	if(length) _emitBits(m_eobrun & ((1u<<length)-1), length);
+	m_eobrun = 0;
+
+	_emitBufferedBits(m_correctionBits, m_correctionCount);
+	m_correctionCount = 0;
+}
@@ -0,0 +1,86 @@
+#ifndef __JPEG_PROGRESSIVE_HEADER__
+#define __JPEG_PROGRESSIVE_HEADER__
+
+#include "jpeg_bitwriter.h"
+#include "jpeg_tables.h"
+#include "jpeg_coefficients.h"
+
+/** 渐进式JPEG的一次扫描：参与的分量，频谱范围[Ss,Se]，逐次逼近的上一次和这一次的位置Ah、Al */
+struct JpegScanInfo
+{
+	int		componentCount;
+	int		components[3];
+	int		Ss;
+	int		Se;
+	int		Ah;
+	int		Al;
+};
+
+/** 与libjpeg的jpeg_simple_progression相同的扫描脚本：先是DC和亮度低频的粗略值，
+ *  再补齐其余的频谱，最后逐位细化 */
+extern const JpegScanInfo jpeg_progressive_script[];
+const int JPEG_PROGRESSIVE_SCAN_COUNT = 10;
+/** 灰度图像的扫描脚本，同样与libjpeg相同 */
+extern const JpegScanInfo jpeg_progressive_gray_script[];
+const int JPEG_PROGRESSIVE_GRAY_SCAN_COUNT = 6;
+
+/** 扫描中分量component使用的霍夫曼表，序号与JpegHuffmanTables中的四张表相同 */
+inline int jpeg_scan_table(const JpegScanInfo& scan, int component)
+{
+	return (scan.Ss==0 ? 0 : 1) + (component>0 ? 2 : 0);
+}
+
+// 渐进式JPEG中一次扫描的熵编码，系数来自JpegCoefficientStore。
+// 统计符号频率和实际输出走同一段代码，保证生成的霍夫曼表正好覆盖输出时用到的符号
+class JpegScanEncoder
+{
+public:
+	/** restartInterval与DRI段中的相同，非交错扫描中按块计数 */
+	JpegScanEncoder(const JpegCoefficientStore& store, const JpegScanInfo& scan, int restartInterval);
+
+	/** 统计每个符号出现的次数，累加到freq中，四张表与JpegHuffmanTables中的顺序相同 */
+	void gather(long long (*freq)[257]);
+	/** 用tables中的码表编码整个扫描，包括RSTn标记，最后补齐到字节边界 */
+	void encode(const JpegHuffmanTables& tables, JpegBitWriter* out);
+
+private:
+	void _run(void);
+	void _restart(int number);
+	void _encodeBlock(const short* block, int component);
+	void _encodeDcFirst(const short* block, int component);
+	void _encodeAcFirst(const short* block);
+	void _encodeAcRefine(const short* block);
+
+	//out为0时只统计，否则输出
+	void _emitSymbol(int table, int symbol);
+	void _emitBits(unsigned int bits, int length);
+	void _emitBufferedBits(const char* bits, int count);
+	//输出攒下来的连续EOB(EOBRUN)，以及这些块中缓存的修正位
+	void _emitEobrun(void);
+
+private:
+	//AC细化扫描中跟在EOBRUN后面输出的修正位最多缓存的个数
+	enum { MAX_CORRECTION_BITS = 1000 };
+
+	const JpegCoefficientStore&	m_store;
+	const JpegScanInfo&			m_scan;
+	int							m_restartInterval;
+
+	long long					(*m_freq)[257];
+	const JpegHuffmanTables*	m_tables;
+	JpegBitWriter*				m_out;
+
+	int							m_lastDC[3];
+	//AC扫描用到的霍夫曼表
+	int							m_acTable;
+	//还没有输出的连续全0块(在这次扫描的频谱范围内)的个数
+	int							m_eobrun;
+	char						m_correctionBits[MAX_CORRECTION_BITS];
+	int							m_correctionCount;
+
+private:
+	JpegScanEncoder(const JpegScanEncoder&);
+	JpegScanEncoder& operator=(const JpegScanEncoder&);
+};
+
+#endif
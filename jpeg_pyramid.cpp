@@ -0,0 +1,227 @@
+#include <string.h>
+#include <chrono>
+
+#include "jpeg_pyramid.h"
+
+//-------------------------------------------------------------------------------
+JpegPyramidEncoder::JpegPyramidEncoder(int threadCount)
+	: m_threadPool(threadCount)
+	, m_tileSize(256)
+	, m_overlap(0)
+	, m_levelIndex(0)
+	, m_columns(0)
+	, m_quality(0)
+	, m_nextPixels(0)
+	, m_callback(0)
+	, m_context(0)
+{
+	if(threadCount<1) threadCount = 1;
+	for(int i=0; i<threadCount; i++)
+	{
+		Worker* worker = new Worker;
+		worker->tiles = worker->failed = worker->outputBytes = 0;
+		m_workers.push_back(worker);
+	}
+	memset(&m_stats, 0, sizeof(m_stats));
+	memset(&m_level, 0, sizeof(m_level));
+	memset(&m_next, 0, sizeof(m_next));
+}
+
+//-------------------------------------------------------------------------------
+JpegPyramidEncoder::~JpegPyramidEncoder()
+{
+	for(size_t i=0; i<m_workers.size(); i++) delete m_workers[i];
+	m_workers.clear();
+}
+
+//-------------------------------------------------------------------------------
+bool JpegPyramidEncoder::setTileSize(int tileSize, int overlap)
+{
+	//瓦片的边界要落在偶数上，缩小时每个瓦片才正好对应下一层中不重叠的一块
+	if(tileSize<2 || (tileSize&1) || overlap<0 || overlap>=tileSize) return false;
+	m_tileSize = tileSize;
+	m_overlap = overlap;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::setDctMethod(JpegEncoder::DctMethod method)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setDctMethod(method);
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setSubsampling(mode, filter);
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::setOptimizeHuffman(bool enable)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setOptimizeHuffman(enable);
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::setProgressive(bool enable)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setProgressive(enable);
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::setTrellisLambda(float lambda)
+{
+	for(size_t i=0; i<m_workers.size(); i++) m_workers[i]->encoder.setTrellisLambda(lambda);
+}
+
+//-------------------------------------------------------------------------------
+int JpegPyramidEncoder::levelCount(int width, int height)
+{
+	int levels = 1;
+	while(width>1 || height>1)
+	{
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+		levels++;
+	}
+	return levels;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegPyramidEncoder::encode(const JpegImageView& image, int quality_scale, JpegTileFunc callback, void* context)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+	if(image.pixels==0 || image.width<=0 || image.height<=0 || callback==0) return false;
+	if(image.format<0 || image.format>=JPEG_PIXEL_FORMAT_COUNT || jpeg_pixel_planar(image.format)) return false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	for(size_t i=0; i<m_workers.size(); i++)
+	{
+		Worker* w = m_workers[i];
+		w->tiles = w->failed = w->outputBytes = 0;
+	}
+
+	m_quality = quality_scale;
+	m_callback = callback;
+	m_context = context;
+	m_level = image;
+
+	int pixelSize = jpeg_pixel_size(image.format);
+	int levels = levelCount(image.width, image.height);
+	for(int level=0; level<levels; level++)
+	{
+		//下一层写入另一个缓冲区，第0层的下一层写入第一个
+		if(level < levels-1)
+		{
+			m_next.width = (m_level.width + 1) / 2;
+			m_next.height = (m_level.height + 1) / 2;
+			m_next.stride = m_next.width * pixelSize;
+			m_next.format = image.format;
+			std::vector<unsigned char>& buffer = m_buffers[level & 1];
+			buffer.resize((size_t)m_next.stride * m_next.height);
+			m_nextPixels = &buffer[0];
+			m_next.pixels = m_nextPixels;
+		}
+		else
+		{
+			m_nextPixels = 0;
+			m_next.pixels = 0;
+		}
+
+		m_levelIndex = level;
+		m_columns = (m_level.width + m_tileSize - 1) / m_tileSize;
+		int rows = (m_level.height + m_tileSize - 1) / m_tileSize;
+		m_threadPool.parallelForStealing(m_columns * rows, _tileTask, this);
+
+		m_level = m_next;
+	}
+
+	m_callback = 0;
+	m_context = 0;
+	memset(&m_level, 0, sizeof(m_level));
+	memset(&m_next, 0, sizeof(m_next));
+
+	m_stats.levels = levels;
+	for(size_t i=0; i<m_workers.size(); i++)
+	{
+		Worker* w = m_workers[i];
+		m_stats.tiles += w->tiles;
+		m_stats.failed += w->failed;
+		m_stats.outputBytes += w->outputBytes;
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	m_stats.seconds = elapsed.count();
+
+	return m_stats.failed==0;
+}
+
+//-------------------------------------------------------------------------------
+void JpegPyramidEncoder::_tileTask(void* context, int index, int worker)
+{
+	JpegPyramidEncoder* self = (JpegPyramidEncoder*)context;
+	Worker* w = self->m_workers[worker];
+	const JpegImageView& level = self->m_level;
+	int tileSize = self->m_tileSize, overlap = self->m_overlap;
+
+	//瓦片本身的范围，以及加上重叠之后实际编码的范围
+	int column = index % self->m_columns, row = index / self->m_columns;
+	int x0 = column * tileSize, y0 = row * tileSize;
+	int x1 = x0 + tileSize, y1 = y0 + tileSize;
+	if(x1 > level.width) x1 = level.width;
+	if(y1 > level.height) y1 = level.height;
+
+	int left = x0 - overlap, top = y0 - overlap, right = x1 + overlap, bottom = y1 + overlap;
+	if(left < 0) left = 0;
+	if(top < 0) top = 0;
+	if(right > level.width) right = level.width;
+	if(bottom > level.height) bottom = level.height;
+
+	w->output.clear();
+	JpegVectorOutput output(w->output);
+	bool successed = w->encoder.encodeRegion(level, left, top, right - left, bottom - top, self->m_quality, output);
+	if(successed)
+		successed = self->m_callback(self->m_context, self->m_levelIndex, column, row, &w->output[0], (int)w->output.size());
+
+	w->tiles++;
+	if(!successed) w->failed++;
+	w->outputBytes += w->output.size();
+
+	//刚编码过的像素还在缓存中，接着缩小到下一层。各个瓦片在下一层中的范围互不重叠
+	if(self->m_next.pixels) self->_downsample(x0, y0, x1, y1);
+}
+
+//-------------------------------------------------------------------------------
+// 下一层的(x,y)为这一层(2x,2y)开始的2*2个像素的平均，宽高为奇数时最后一列(行)与自己平均
+void JpegPyramidEncoder::_downsample(int x0, int y0, int x1, int y1)
+{
+	const JpegImageView& level = m_level;
+	int pixelSize = jpeg_pixel_size(level.format);
+
+	for(int y=y0/2; y<(y1+1)/2; y++)
+	{
+		int sy = 2*y;
+		const unsigned char* row0 = level.pixels + (long long)sy * level.stride;
+		const unsigned char* row1 = (sy+1 < level.height) ? row0 + level.stride : row0;
+		unsigned char* dst = m_nextPixels + (long long)y * m_next.stride;
+
+		//瓦片的边界都是偶数，只有宽度为奇数时最右边的瓦片会剩下一列，单独处理，其余的不用判断边界
+		for(int x=x0/2; x<x1/2; x++)
+		{
+			const unsigned char* a = row0 + 2*x*pixelSize;
+			const unsigned char* b = row1 + 2*x*pixelSize;
+			unsigned char* d = dst + x*pixelSize;
+			for(int c=0; c<pixelSize; c++)
+				d[c] = (unsigned char)((a[c] + a[c+pixelSize] + b[c] + b[c+pixelSize] + 2) >> 2);
+		}
+		if(x1 & 1)
+		{
+			int x = x1/2;
+			const unsigned char* a = row0 + 2*x*pixelSize;
+			const unsigned char* b = row1 + 2*x*pixelSize;
+			unsigned char* d = dst + x*pixelSize;
+			for(int c=0; c<pixelSize; c++)
+				d[c] = (unsigned char)((a[c] + b[c] + 1) >> 1);
+		}
+	}
+}
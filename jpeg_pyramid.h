@@ -0,0 +1,93 @@
+#ifndef __JPEG_PYRAMID_HEADER__
+#define __JPEG_PYRAMID_HEADER__
+
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+/** 一个瓦片编码完成后的回调，level为0时是原图大小，每增加1宽高减半。在各个工作线程中同时调用，需要自己保证线程安全。
+ *  返回false表示这个瓦片保存失败，计入统计 */
+typedef bool (*JpegTileFunc)(void* context, int level, int column, int row, const unsigned char* data, int size);
+
+/** 瓦片金字塔的统计 */
+struct JpegPyramidStats
+{
+	int			levels;			//层数，最后一层为1*1
+	long long	tiles;			//编码的瓦片数，包括失败的
+	long long	failed;			//编码或者回调失败的瓦片数
+	long long	outputBytes;	//所有瓦片的字节数
+	double		seconds;		//encode调用的总时间，包括缩小
+};
+
+// Deep Zoom这类瓦片金字塔的编码。每一层切成tileSize*tileSize的瓦片(右边和下边可能小一些)，
+// 瓦片直接用JpegEncoder::encodeRegion从这一层的图像中编码，不复制像素。
+// 一层的所有瓦片由线程池并行编码，每个瓦片编码之后立即把它覆盖的像素按2*2平均缩小到下一层，
+// 这时像素还在缓存中，每一层的像素只从内存中读一遍。第0层直接读调用者的图像，其余各层在两个缓冲区之间轮换。
+// 只支持打包的像素格式和灰度
+class JpegPyramidEncoder
+{
+public:
+	/** threadCount为参与编码的线程总数，包括调用encode的线程 */
+	explicit JpegPyramidEncoder(int threadCount);
+	~JpegPyramidEncoder();
+
+	/** 瓦片的边长(必须是偶数，默认256)，以及相邻瓦片重叠的像素数(默认0，Deep Zoom常用1) */
+	bool setTileSize(int tileSize, int overlap = 0);
+
+	/** 编码参数，对每个线程的编码器都生效 */
+	void setDctMethod(JpegEncoder::DctMethod method);
+	void setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter = JpegEncoder::CHROMA_BOX);
+	void setOptimizeHuffman(bool enable);
+	void setProgressive(bool enable);
+	void setTrellisLambda(float lambda);
+
+	/** 编码整个金字塔，每个瓦片完成后调用callback，全部成功时返回true */
+	bool encode(const JpegImageView& image, int quality_scale, JpegTileFunc callback, void* context);
+
+	/** 宽高为width*height的图像的层数 */
+	static int levelCount(int width, int height);
+
+	/** 最近一次encode的统计 */
+	const JpegPyramidStats& stats(void) const { return m_stats; }
+
+private:
+	//每个线程各自的编码器、输出缓冲区和统计，分别分配
+	struct Worker
+	{
+		JpegEncoder					encoder;
+		std::vector<unsigned char>	output;
+		long long					tiles;
+		long long					failed;
+		long long					outputBytes;
+	};
+
+	static void _tileTask(void* context, int index, int worker);
+	//把这一层中[x0,x1)*[y0,y1)的像素缩小到下一层，x0、y0为偶数
+	void _downsample(int x0, int y0, int x1, int y1);
+
+private:
+	std::vector<Worker*>	m_workers;
+	JpegThreadPool			m_threadPool;
+	int						m_tileSize;
+	int						m_overlap;
+	JpegPyramidStats		m_stats;
+
+	//encode期间的状态：当前层的图像、下一层的图像(最后一层时pixels为0)、列数
+	JpegImageView			m_level;
+	JpegImageView			m_next;
+	int						m_levelIndex;
+	int						m_columns;
+	int						m_quality;
+	//m_next.pixels的可写版本
+	unsigned char*			m_nextPixels;
+	JpegTileFunc			m_callback;
+	void*					m_context;
+	//第1层起的图像在这两个缓冲区之间轮换
+	std::vector<unsigned char>	m_buffers[2];
+
+private:
+	JpegPyramidEncoder(const JpegPyramidEncoder&);
+	JpegPyramidEncoder& operator=(const JpegPyramidEncoder&);
+};
+
+#endif
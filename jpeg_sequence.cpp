@@ -0,0 +1,238 @@
+#include <string.h>
+#include <chrono>
+
+#include "jpeg_sequence.h"
+
+//-------------------------------------------------------------------------------
+JpegSequenceEncoder::JpegSequenceEncoder()
+	: m_width(0)
+	, m_height(0)
+	, m_format(JPEG_PIXEL_BGR)
+	, m_quality(0)
+	, m_cacheValid(false)
+	, m_lastMcuCount(0)
+	, m_lastCachedMcus(0)
+{
+	resetStats();
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setDctMethod(JpegEncoder::DctMethod method)
+{
+	m_encoder.setDctMethod(method);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter)
+{
+	m_encoder.setSubsampling(mode, filter);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setOptimizeHuffman(bool enable)
+{
+	m_encoder.setOptimizeHuffman(enable);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setProgressive(bool enable)
+{
+	m_encoder.setProgressive(enable);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setRestartInterval(int mcus)
+{
+	m_encoder.setRestartInterval(mcus);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::setTrellisLambda(float lambda)
+{
+	m_encoder.setTrellisLambda(lambda);
+	m_cacheValid = false;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::resetStats(void)
+{
+	m_stats.frames = m_stats.mcus = m_stats.cachedMcus = 0;
+	m_stats.seconds = 0;
+}
+
+//-------------------------------------------------------------------------------
+bool JpegSequenceEncoder::encodeFrame(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format,
+	int quality_scale, JpegOutput& output)
+{
+	if(pixels==0 || !JpegEncoder::_checkImage(width, height, format)) return false;
+	if(m_encoder.m_streamWriter) return false;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	m_stats.frames++;
+
+	//_setSource确定了抽样因子之后才能划分MCU
+	if(!m_encoder._setSource(pixels, width, height, stride, format)) return false;
+
+	const JpegImageView& image = m_encoder.m_source;
+	int mcuWidth = m_encoder.m_hSamp*8, mcuHeight = m_encoder.m_vSamp*8;
+	int mcuCount = ((width + mcuWidth - 1) / mcuWidth) * ((height + mcuHeight - 1) / mcuHeight);
+
+	if(m_cacheValid && width==m_width && height==m_height && format==m_format && quality_scale==m_quality)
+	{
+		_compareFrame(image);
+	}
+	else
+	{
+		_copyFrame(image);
+		m_segments.clear();
+		m_width = width;
+		m_height = height;
+		m_format = format;
+		m_quality = quality_scale;
+	}
+
+	int cached = 0;
+	for(int i=0; i<mcuCount; i++)
+		if(!m_dirty[i]) cached++;
+
+	//最优霍夫曼表和渐进式的码表每帧不同，熵编码的结果不能沿用
+	bool segmented = m_encoder.m_restartInterval>0 && !m_encoder.m_optimizeHuffman && !m_encoder.m_progressive;
+	bool successed = m_encoder._encodeDirty(quality_scale, &m_dirty[0], segmented ? &m_segments : 0, output);
+	//失败时m_coefficients中可能只有一部分是这一帧的，下一帧整帧重新编码
+	m_cacheValid = successed;
+
+	m_lastMcuCount = mcuCount;
+	m_lastCachedMcus = cached;
+	m_stats.mcus += mcuCount;
+	m_stats.cachedMcus += cached;
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	m_stats.seconds += elapsed.count();
+
+	return successed;
+}
+
+//-------------------------------------------------------------------------------
+int JpegSequenceEncoder::_getPlanes(const JpegImageView& image, Plane* planes)
+{
+	int chromaWidth = (image.width + 1) / 2, chromaHeight = (image.height + 1) / 2;
+	const unsigned char* chroma = image.pixels + (long long)image.height * image.stride;
+
+	Plane first = { image.pixels, image.stride, image.width, image.height, jpeg_pixel_size(image.format), 0 };
+	planes[0] = first;
+
+	if(image.format==JPEG_PIXEL_NV12)
+	{
+		Plane uv = { chroma, image.stride, chromaWidth, chromaHeight, 2, 1 };
+		planes[1] = uv;
+		return 2;
+	}
+	if(image.format==JPEG_PIXEL_I420)
+	{
+		int chromaStride = (image.stride + 1) / 2;
+		Plane u = { chroma, chromaStride, chromaWidth, chromaHeight, 1, 1 };
+		Plane v = { chroma + (long long)chromaHeight * chromaStride, chromaStride, chromaWidth, chromaHeight, 1, 1 };
+		planes[1] = u;
+		planes[2] = v;
+		return 3;
+	}
+	return 1;
+}
+
+//-------------------------------------------------------------------------------
+void JpegSequenceEncoder::_copyFrame(const JpegImageView& image)
+{
+	Plane planes[3];
+	int planeCount = _getPlanes(image, planes);
+
+	size_t size = 0;
+	for(int i=0; i<planeCount; i++)
+		size += (size_t)planes[i].width * planes[i].pixelSize * planes[i].height;
+	m_previous.resize(size);
+
+	unsigned char* previous = &m_previous[0];
+	for(int i=0; i<planeCount; i++)
+	{
+		const Plane& p = planes[i];
+		int rowSize = p.width * p.pixelSize;
+		for(int y=0; y<p.height; y++, previous += rowSize)
+			memcpy(previous, p.pixels + (long long)y * p.stride, rowSize);
+	}
+
+	int mcuWidth = m_encoder.m_hSamp*8, mcuHeight = m_encoder.m_vSamp*8;
+	int mcuCount = ((image.width + mcuWidth - 1) / mcuWidth) * ((image.height + mcuHeight - 1) / mcuHeight);
+	m_dirty.assign(mcuCount, 1);
+}
+
+//-------------------------------------------------------------------------------
+// MCU在各个平面中的范围互不重叠，比较出不同时立即把这一块复制到m_previous中，不影响其他MCU的比较
+void JpegSequenceEncoder::_compareFrame(const JpegImageView& image)
+{
+	Plane planes[3];
+	int planeCount = _getPlanes(image, planes);
+	unsigned char* previous[3];
+	previous[0] = &m_previous[0];
+	for(int i=1; i<planeCount; i++)
+		previous[i] = previous[i-1] + (size_t)planes[i-1].width * planes[i-1].pixelSize * planes[i-1].height;
+
+	int mcuWidth = m_encoder.m_hSamp*8, mcuHeight = m_encoder.m_vSamp*8;
+	int mcusPerLine = (image.width + mcuWidth - 1) / mcuWidth;
+	int mcuRows = (image.height + mcuHeight - 1) / mcuHeight;
+	m_changed.assign((size_t)mcusPerLine * mcuRows, 0);
+
+	for(int my=0; my<mcuRows; my++)
+	{
+		for(int mx=0; mx<mcusPerLine; mx++)
+		{
+			bool changed = false;
+			for(int i=0; i<planeCount; i++)
+			{
+				const Plane& p = planes[i];
+				int x0 = (mx*mcuWidth) >> p.shift, y0 = (my*mcuHeight) >> p.shift;
+				int x1 = ((mx+1)*mcuWidth) >> p.shift, y1 = ((my+1)*mcuHeight) >> p.shift;
+				if(x1 > p.width) x1 = p.width;
+				if(y1 > p.height) y1 = p.height;
+				int rowSize = p.width * p.pixelSize;
+				int spanSize = (x1 - x0) * p.pixelSize;
+
+				const unsigned char* src = p.pixels + (long long)y0 * p.stride + x0 * p.pixelSize;
+				unsigned char* dst = previous[i] + (size_t)y0 * rowSize + x0 * p.pixelSize;
+				int y = y0;
+				for(; y<y1; y++, src += p.stride, dst += rowSize)
+				{
+					if(memcmp(src, dst, spanSize)!=0) break;
+				}
+				//前面相同的行不用再复制
+				if(y < y1) changed = true;
+				for(; y<y1; y++, src += p.stride, dst += rowSize)
+					memcpy(dst, src, spanSize);
+			}
+			m_changed[my*mcusPerLine + mx] = changed;
+		}
+	}
+
+	//三角滤波抽样色度时要用到MCU外面一圈像素，相邻的MCU改变了，这个MCU的色度也可能改变
+	bool triangle = m_encoder.m_chromaFilter==JpegEncoder::CHROMA_TRIANGLE && !jpeg_pixel_planar(image.format)
+		&& m_encoder.m_componentCount==3 && m_encoder.m_hSamp*m_encoder.m_vSamp>1;
+	m_dirty = m_changed;
+	if(!triangle) return;
+
+	for(int my=0; my<mcuRows; my++)
+	{
+		for(int mx=0; mx<mcusPerLine; mx++)
+		{
+			if(!m_changed[my*mcusPerLine + mx]) continue;
+			for(int y=my-1; y<=my+1; y++)
+			{
+				for(int x=mx-1; x<=mx+1; x++)
+				{
+					if(x>=0 && x<mcusPerLine && y>=0 && y<mcuRows) m_dirty[y*mcusPerLine + x] = 1;
+				}
+			}
+		}
+	}
+}
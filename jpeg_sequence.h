@@ -0,0 +1,105 @@
+#ifndef __JPEG_SEQUENCE_HEADER__
+#define __JPEG_SEQUENCE_HEADER__
+
+#include <vector>
+
+#include "jpeg_encoder.h"
+
+/** 序列编码的累计统计 */
+struct JpegSequenceStats
+{
+	long long	frames;			//编码的帧数，包括失败的
+	long long	mcus;			//所有帧的MCU总数
+	long long	cachedMcus;		//与上一帧相同、沿用缓存系数的MCU
+	double		seconds;		//encodeFrame调用的总时间，包括比较像素
+
+	/** 缓存命中率，0~1 */
+	double hitRate(void) const { return mcus>0 ? (double)cachedMcus/mcus : 0; }
+	double framesPerSecond(void) const { return seconds>0 ? frames/seconds : 0; }
+};
+
+// 屏幕录制、监控视频等连续帧的编码。保存上一帧的像素和每个MCU量化后的系数，
+// 新的一帧逐个MCU与上一帧比较，没有变化的MCU跳过颜色转换、DCT和量化，直接沿用缓存的系数。
+// DC系数是差分编码的，熵编码总要对整幅图像重新做一遍(复位间隔之间没有依赖，见setRestartInterval)，
+// 输出与直接调用JpegEncoder::encode完全相同。
+// 尺寸、像素格式、质量或者影响系数的参数(DCT、色度抽样、trellis)改变时，整帧重新编码
+class JpegSequenceEncoder
+{
+public:
+	JpegSequenceEncoder();
+
+	/** 编码参数，与JpegEncoder的同名方法相同 */
+	void setDctMethod(JpegEncoder::DctMethod method);
+	void setSubsampling(JpegEncoder::Subsampling mode, JpegEncoder::ChromaFilter filter = JpegEncoder::CHROMA_BOX);
+	void setOptimizeHuffman(bool enable);
+	void setProgressive(bool enable);
+	void setTrellisLambda(float lambda);
+	/** 设置了复位间隔的基线编码还按间隔缓存熵编码的结果，整个间隔都没有变化时直接复制上一帧的数据，
+	 *  静态画面的编码开销主要就只剩比较像素。最优霍夫曼表和渐进式每帧的码表不同，只缓存系数 */
+	void setRestartInterval(int mcus);
+	void setThreadCount(int threads) { m_encoder.setThreadCount(threads); }
+
+	/** 编码一帧，参数与JpegEncoder::encode相同。像素在返回后就可以修改，需要比较的部分已经复制下来 */
+	bool encodeFrame(const unsigned char* pixels, int width, int height, int stride, JpegPixelFormat format,
+		int quality_scale, JpegOutput& output);
+
+	/** 丢弃缓存，下一帧整帧重新编码 */
+	void reset(void) { m_cacheValid = false; }
+
+	/** 最近一帧的MCU总数，以及其中沿用缓存的个数 */
+	int lastMcuCount(void) const { return m_lastMcuCount; }
+	int lastCachedMcus(void) const { return m_lastCachedMcus; }
+	/** 最近一帧的编码统计，只包括重新变换的MCU的颜色转换和DCT，以及重新熵编码的复位间隔 */
+	const JpegEncodeStats& encodeStats(void) const { return m_encoder.stats(); }
+
+	/** 从创建或者上一次resetStats以来的累计统计 */
+	const JpegSequenceStats& stats(void) const { return m_stats; }
+	void resetStats(void);
+
+private:
+	//参与比较的一个像素平面，打包格式只有一个，I420有三个，NV12有两个。
+	//色度平面的分辨率是一半，MCU在平面中的范围要右移shift位
+	struct Plane
+	{
+		const unsigned char*	pixels;
+		int						stride;
+		int						width;
+		int						height;
+		int						pixelSize;
+		int						shift;
+	};
+	static int _getPlanes(const JpegImageView& image, Plane* planes);
+
+	//逐个MCU比较并更新m_previous，结果存入m_dirty
+	void _compareFrame(const JpegImageView& image);
+	//整帧复制到m_previous，所有MCU都要重新变换
+	void _copyFrame(const JpegImageView& image);
+
+private:
+	JpegEncoder		m_encoder;
+
+	//上一帧的尺寸、格式和质量，m_cacheValid为false时下一帧整帧编码
+	int				m_width;
+	int				m_height;
+	JpegPixelFormat	m_format;
+	int				m_quality;
+	bool			m_cacheValid;
+
+	//上一帧的像素，每个平面的行紧密排列，依次存放
+	std::vector<unsigned char>	m_previous;
+	//每个MCU是否需要重新变换，以及像素是否改变(三角滤波时相邻MCU改变也要重新变换)
+	std::vector<unsigned char>	m_dirty;
+	std::vector<unsigned char>	m_changed;
+	//每个复位间隔熵编码的结果
+	std::vector< std::vector<unsigned char> >	m_segments;
+
+	int				m_lastMcuCount;
+	int				m_lastCachedMcus;
+	JpegSequenceStats	m_stats;
+
+private:
+	JpegSequenceEncoder(const JpegSequenceEncoder&);
+	JpegSequenceEncoder& operator=(const JpegSequenceEncoder&);
+};
+
+#endif
@@ -0,0 +1,765 @@
+#ifdef _MSC_VER
+#define _CRT_SECURE_NO_WARNINGS
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jpeg_simd.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define JPEG_SIMD_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define JPEG_SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+namespace {
+//-------------------------------------------------------------------------------
+inline void _convert_pixel(const unsigned char* p, int bIndex, char* yData, char* cbData, char* crData)
+{
+	unsigned char B = p[bIndex];
+	unsigned char G = p[1];
+	unsigned char R = p[2-bIndex];
+
+	*yData = (char)(int)(0.299f * R + 0.587f * G + 0.114f * B - 128);
+	*cbData = (char)(int)(-0.1687f * R - 0.3313f * G + 0.5f * B );
+	*crData = (char)(int)(0.5f * R - 0.4187f * G - 0.0813f * B);
+}
+
+//-------------------------------------------------------------------------------
+// 标量版本，也是其他内核的参照
+// bIndex为B在每个像素中的位置，BGR为0，RGB为2；pixelSize为每个像素的字节数，第4个字节不使用
+inline void _convert_scalar(const unsigned char* rgb, int stride, int bIndex, int pixelSize, char* yData, char* cbData, char* crData)
+{
+	for (int y=0; y<8; y++)
+	{
+		const unsigned char* p = rgb + y*stride;
+		for (int x=0; x<8; x++, p+=pixelSize)
+		{
+			_convert_pixel(p, bIndex, yData + y*8+x, cbData + y*8+x, crData + y*8+x);
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+void _convert_bgr_scalar(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	_convert_scalar(rgb, stride, 0, 3, yData, cbData, crData);
+}
+
+//-------------------------------------------------------------------------------
+void _convert_rgb_scalar(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	_convert_scalar(rgb, stride, 2, 3, yData, cbData, crData);
+}
+
+//-------------------------------------------------------------------------------
+void _convert_bgra_scalar(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	_convert_scalar(rgb, stride, 0, 4, yData, cbData, crData);
+}
+
+//-------------------------------------------------------------------------------
+void _convert_rgba_scalar(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	_convert_scalar(rgb, stride, 2, 4, yData, cbData, crData);
+}
+
+//-------------------------------------------------------------------------------
+// 无符号字节减去128就是最高位取反，一行8个字节作为一个64位整数一次处理，已经和向量指令一样快，所有指令集共用
+void _level_shift(const unsigned char* plane, int stride, char* data)
+{
+	for(int y=0; y<8; y++)
+	{
+		unsigned long long row;
+		memcpy(&row, plane + (long long)y*stride, 8);
+		row ^= 0x8080808080808080ULL;
+		memcpy(data + y*8, &row, 8);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void _convert_gray(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	(void)cbData;
+	(void)crData;
+	_level_shift(rgb, stride, yData);
+}
+
+//-------------------------------------------------------------------------------
+void _split_chroma_scalar(const unsigned char* uv, int stride, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+	{
+		const unsigned char* p = uv + (long long)y*stride;
+		for(int x=0; x<8; x++)
+		{
+			cbData[y*8 + x] = (char)(p[x*2] ^ 0x80);
+			crData[y*8 + x] = (char)(p[x*2 + 1] ^ 0x80);
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------
+void _fdct_islow_scalar(const char* block, short* data)
+{
+	int natural[64];
+	jpeg_fdct_islow(block, natural);
+	for(int i=0; i<64; i++) data[jpeg_zigzag[i]] = (short)natural[i];
+}
+
+//-------------------------------------------------------------------------------
+void _fdct_float_scalar(const char* block, float* data)
+{
+	float natural[64];
+	jpeg_fdct_float(block, natural);
+	for(int i=0; i<64; i++) data[jpeg_zigzag[i]] = natural[i];
+}
+
+//-------------------------------------------------------------------------------
+const JpegKernels Scalar_Kernels =
+{
+	JPEG_SIMD_SCALAR, "scalar", 
+	{ _convert_bgr_scalar, _convert_rgb_scalar, _convert_bgra_scalar, _convert_rgba_scalar, _convert_bgra_scalar, _convert_rgba_scalar, _convert_gray, 0, 0 },
+	_level_shift, _split_chroma_scalar, jpeg_fdct_quant_islow, jpeg_fdct_quant_float, 
+	_fdct_islow_scalar, _fdct_float_scalar, jpeg_quant_islow, jpeg_quant_float
+};
+}
+
+#ifdef JPEG_SIMD_X86
+//-------------------------------------------------------------------------------
+// SSE2：每个8通道向量由两个128位寄存器组成
+namespace sse2 {
+
+struct VI { __m128i lo, hi; };
+struct VF { __m128 lo, hi; };
+
+inline VI _vi(__m128i lo, __m128i hi) { VI r; r.lo = lo; r.hi = hi; return r; }
+inline VF _vf(__m128 lo, __m128 hi) { VF r; r.lo = lo; r.hi = hi; return r; }
+
+//SSE2没有32位的低位乘法，用两次32x32->64的乘法拼出来
+inline __m128i _mullo(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+inline VI operator+(VI a, VI b) { return _vi(_mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi)); }
+inline VI operator-(VI a, VI b) { return _vi(_mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi)); }
+inline VI operator*(VI a, VI b) { return _vi(_mullo(a.lo, b.lo), _mullo(a.hi, b.hi)); }
+inline VI operator*(VI a, int c) { __m128i k = _mm_set1_epi32(c); return _vi(_mullo(a.lo, k), _mullo(a.hi, k)); }
+inline VI _slli(VI a, int n) { return _vi(_mm_slli_epi32(a.lo, n), _mm_slli_epi32(a.hi, n)); }
+inline VI _srai(VI a, int n) { return _vi(_mm_srai_epi32(a.lo, n), _mm_srai_epi32(a.hi, n)); }
+inline VI _set_i(int c) { return _vi(_mm_set1_epi32(c), _mm_set1_epi32(c)); }
+inline VI _load_i(const int* p) { return _vi(_mm_loadu_si128((const __m128i*)p), _mm_loadu_si128((const __m128i*)(p+4))); }
+
+inline VF operator+(VF a, VF b) { return _vf(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+inline VF operator-(VF a, VF b) { return _vf(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+inline VF operator*(VF a, VF b) { return _vf(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+inline VF _set_f(float c) { return _vf(_mm_set1_ps(c), _mm_set1_ps(c)); }
+inline VF _load_f(const float* p) { return _vf(_mm_loadu_ps(p), _mm_loadu_ps(p+4)); }
+inline void _store_f(float* p, VF a) { _mm_storeu_ps(p, a.lo); _mm_storeu_ps(p+4, a.hi); }
+inline VF _to_float(VI a) { return _vf(_mm_cvtepi32_ps(a.lo), _mm_cvtepi32_ps(a.hi)); }
+inline VI _trunc(VF a) { return _vi(_mm_cvttps_epi32(a.lo), _mm_cvttps_epi32(a.hi)); }
+
+//8个有符号字节扩展为8个int32
+inline VI _load_row(const char* p)
+{
+	__m128i b = _mm_loadl_epi64((const __m128i*)p);
+	__m128i w = _mm_srai_epi16(_mm_unpacklo_epi8(b, b), 8);
+	return _vi(_mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16), _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16));
+}
+
+//8个short扩展为8个int32
+inline VI _load_short(const short* p)
+{
+	__m128i w = _mm_loadu_si128((const __m128i*)p);
+	return _vi(_mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16), _mm_srai_epi32(_mm_unpackhi_epi16(w, w), 16));
+}
+
+inline void _store_short(short* p, VI a)
+{
+	_mm_storeu_si128((__m128i*)p, _mm_packs_epi32(a.lo, a.hi));
+}
+
+inline void _store_char(char* p, VI a)
+{
+	__m128i w = _mm_packs_epi32(a.lo, a.hi);
+	_mm_storel_epi64((__m128i*)p, _mm_packs_epi16(w, w));
+}
+
+//SSE2没有字节重排指令，交织的BGR先用标量拆开，计算部分仍然是向量化的
+inline void _load_bgr(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	int b[8], g[8], r[8];
+	for(int x=0; x<8; x++)
+	{
+		b[x] = p[x*3];
+		g[x] = p[x*3+1];
+		r[x] = p[x*3+2];
+	}
+	B = _to_float(_load_i(b));
+	G = _to_float(_load_i(g));
+	R = _to_float(_load_i(r));
+}
+
+//4字节的像素正好占一个32位通道，用与和移位取出三个通道
+inline void _load_bgra(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)p);
+	__m128i hi = _mm_loadu_si128((const __m128i*)(p+16));
+	__m128i mask = _mm_set1_epi32(0xFF);
+	B = _to_float(_vi(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+	G = _to_float(_vi(_mm_and_si128(_mm_srli_epi32(lo, 8), mask), _mm_and_si128(_mm_srli_epi32(hi, 8), mask)));
+	R = _to_float(_vi(_mm_and_si128(_mm_srli_epi32(lo, 16), mask), _mm_and_si128(_mm_srli_epi32(hi, 16), mask)));
+}
+
+//U、V交错的16个字节，偶数字节是U，奇数字节是V，拆开后再减去128
+inline void _split_chroma_row(const unsigned char* p, char* cb, char* cr)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i mask = _mm_set1_epi16(0xFF);
+	__m128i uv = _mm_packus_epi16(_mm_and_si128(v, mask), _mm_srli_epi16(v, 8));
+	uv = _mm_xor_si128(uv, _mm_set1_epi8((char)0x80));
+	_mm_storel_epi64((__m128i*)cb, uv);
+	_mm_storel_epi64((__m128i*)cr, _mm_srli_si128(uv, 8));
+}
+
+inline void _transpose4(__m128i& a, __m128i& b, __m128i& c, __m128i& d)
+{
+	__m128i t0 = _mm_unpacklo_epi32(a, b);
+	__m128i t1 = _mm_unpacklo_epi32(c, d);
+	__m128i t2 = _mm_unpackhi_epi32(a, b);
+	__m128i t3 = _mm_unpackhi_epi32(c, d);
+	a = _mm_unpacklo_epi64(t0, t1);
+	b = _mm_unpackhi_epi64(t0, t1);
+	c = _mm_unpacklo_epi64(t2, t3);
+	d = _mm_unpackhi_epi64(t2, t3);
+}
+
+//8*8转置 = 四个4*4块各自转置，再交换右上和左下两块
+inline void _transpose(VI* d)
+{
+	_transpose4(d[0].lo, d[1].lo, d[2].lo, d[3].lo);
+	_transpose4(d[0].hi, d[1].hi, d[2].hi, d[3].hi);
+	_transpose4(d[4].lo, d[5].lo, d[6].lo, d[7].lo);
+	_transpose4(d[4].hi, d[5].hi, d[6].hi, d[7].hi);
+	for(int i=0; i<4; i++)
+	{
+		__m128i t = d[i].hi;
+		d[i].hi = d[i+4].lo;
+		d[i+4].lo = t;
+	}
+}
+
+inline void _transpose(VF* d)
+{
+	VI t[8];
+	for(int i=0; i<8; i++) t[i] = _vi(_mm_castps_si128(d[i].lo), _mm_castps_si128(d[i].hi));
+	_transpose(t);
+	for(int i=0; i<8; i++) d[i] = _vf(_mm_castsi128_ps(t[i].lo), _mm_castsi128_ps(t[i].hi));
+}
+
+#include "jpeg_simd_impl.h"
+
+const JpegKernels Kernels =
+{
+	JPEG_SIMD_SSE2, "sse2", 
+	{ convert_bgr, convert_rgb, convert_bgra, convert_rgba, convert_bgra, convert_rgba, _convert_gray, 0, 0 },
+	_level_shift, split_chroma, fdct_quant_islow, fdct_quant_float, fdct_islow, fdct_float, quant_islow, quant_float
+};
+}
+
+//-------------------------------------------------------------------------------
+// AVX2：一个256位寄存器正好是8个通道，这一段代码单独按AVX2编译，不需要额外的编译选项
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to=function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace avx2 {
+
+struct VI { __m256i v; };
+struct VF { __m256 v; };
+
+inline VI _vi(__m256i v) { VI r; r.v = v; return r; }
+inline VF _vf(__m256 v) { VF r; r.v = v; return r; }
+
+inline VI operator+(VI a, VI b) { return _vi(_mm256_add_epi32(a.v, b.v)); }
+inline VI operator-(VI a, VI b) { return _vi(_mm256_sub_epi32(a.v, b.v)); }
+inline VI operator*(VI a, VI b) { return _vi(_mm256_mullo_epi32(a.v, b.v)); }
+inline VI operator*(VI a, int c) { return _vi(_mm256_mullo_epi32(a.v, _mm256_set1_epi32(c))); }
+inline VI _slli(VI a, int n) { return _vi(_mm256_slli_epi32(a.v, n)); }
+inline VI _srai(VI a, int n) { return _vi(_mm256_srai_epi32(a.v, n)); }
+inline VI _set_i(int c) { return _vi(_mm256_set1_epi32(c)); }
+inline VI _load_i(const int* p) { return _vi(_mm256_loadu_si256((const __m256i*)p)); }
+
+inline VF operator+(VF a, VF b) { return _vf(_mm256_add_ps(a.v, b.v)); }
+inline VF operator-(VF a, VF b) { return _vf(_mm256_sub_ps(a.v, b.v)); }
+inline VF operator*(VF a, VF b) { return _vf(_mm256_mul_ps(a.v, b.v)); }
+inline VF _set_f(float c) { return _vf(_mm256_set1_ps(c)); }
+inline VF _load_f(const float* p) { return _vf(_mm256_loadu_ps(p)); }
+inline void _store_f(float* p, VF a) { _mm256_storeu_ps(p, a.v); }
+inline VF _to_float(VI a) { return _vf(_mm256_cvtepi32_ps(a.v)); }
+inline VI _trunc(VF a) { return _vi(_mm256_cvttps_epi32(a.v)); }
+
+inline VI _load_row(const char* p)
+{
+	return _vi(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+}
+
+inline VI _load_short(const short* p)
+{
+	return _vi(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)p)));
+}
+
+inline void _store_short(short* p, VI a)
+{
+	_mm_storeu_si128((__m128i*)p, _mm_packs_epi32(_mm256_castsi256_si128(a.v), _mm256_extracti128_si256(a.v, 1)));
+}
+
+inline void _store_char(char* p, VI a)
+{
+	__m128i w = _mm_packs_epi32(_mm256_castsi256_si128(a.v), _mm256_extracti128_si256(a.v, 1));
+	_mm_storel_epi64((__m128i*)p, _mm_packs_epi16(w, w));
+}
+
+//一行8个像素共24字节，分成前16字节和后8字节两次读取，用pshufb拆出三个通道
+inline void _load_bgr(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	__m128i lo = _mm_loadu_si128((const __m128i*)p);
+	__m128i hi = _mm_loadl_epi64((const __m128i*)(p+16));
+
+	__m128i b = _mm_or_si128(
+		_mm_shuffle_epi8(lo, _mm_setr_epi8(0,3,6,9,12,15,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1)),
+		_mm_shuffle_epi8(hi, _mm_setr_epi8(-1,-1,-1,-1,-1,-1,2,5, -1,-1,-1,-1,-1,-1,-1,-1)));
+	__m128i g = _mm_or_si128(
+		_mm_shuffle_epi8(lo, _mm_setr_epi8(1,4,7,10,13,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1)),
+		_mm_shuffle_epi8(hi, _mm_setr_epi8(-1,-1,-1,-1,-1,0,3,6, -1,-1,-1,-1,-1,-1,-1,-1)));
+	__m128i r = _mm_or_si128(
+		_mm_shuffle_epi8(lo, _mm_setr_epi8(2,5,8,11,14,-1,-1,-1, -1,-1,-1,-1,-1,-1,-1,-1)),
+		_mm_shuffle_epi8(hi, _mm_setr_epi8(-1,-1,-1,-1,-1,1,4,7, -1,-1,-1,-1,-1,-1,-1,-1)));
+
+	B = _vf(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b)));
+	G = _vf(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(g)));
+	R = _vf(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(r)));
+}
+
+//8个4字节的像素正好一个寄存器
+inline void _load_bgra(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i*)p);
+	__m256i mask = _mm256_set1_epi32(0xFF);
+	B = _vf(_mm256_cvtepi32_ps(_mm256_and_si256(v, mask)));
+	G = _vf(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 8), mask)));
+	R = _vf(_mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(v, 16), mask)));
+}
+
+//一行只有16个字节，用pshufb一次拆开
+inline void _split_chroma_row(const unsigned char* p, char* cb, char* cr)
+{
+	__m128i v = _mm_loadu_si128((const __m128i*)p);
+	__m128i uv = _mm_shuffle_epi8(v, _mm_setr_epi8(0,2,4,6,8,10,12,14, 1,3,5,7,9,11,13,15));
+	uv = _mm_xor_si128(uv, _mm_set1_epi8((char)0x80));
+	_mm_storel_epi64((__m128i*)cb, uv);
+	_mm_storel_epi64((__m128i*)cr, _mm_srli_si128(uv, 8));
+}
+
+inline void _transpose(VI* d)
+{
+	__m256i t0 = _mm256_unpacklo_epi32(d[0].v, d[1].v);
+	__m256i t1 = _mm256_unpackhi_epi32(d[0].v, d[1].v);
+	__m256i t2 = _mm256_unpacklo_epi32(d[2].v, d[3].v);
+	__m256i t3 = _mm256_unpackhi_epi32(d[2].v, d[3].v);
+	__m256i t4 = _mm256_unpacklo_epi32(d[4].v, d[5].v);
+	__m256i t5 = _mm256_unpackhi_epi32(d[4].v, d[5].v);
+	__m256i t6 = _mm256_unpacklo_epi32(d[6].v, d[7].v);
+	__m256i t7 = _mm256_unpackhi_epi32(d[6].v, d[7].v);
+
+	__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+	__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+	__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+	__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+	__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+	__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+	__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+	__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+	d[0].v = _mm256_permute2x128_si256(u0, u4, 0x20);
+	d[1].v = _mm256_permute2x128_si256(u1, u5, 0x20);
+	d[2].v = _mm256_permute2x128_si256(u2, u6, 0x20);
+	d[3].v = _mm256_permute2x128_si256(u3, u7, 0x20);
+	d[4].v = _mm256_permute2x128_si256(u0, u4, 0x31);
+	d[5].v = _mm256_permute2x128_si256(u1, u5, 0x31);
+	d[6].v = _mm256_permute2x128_si256(u2, u6, 0x31);
+	d[7].v = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+inline void _transpose(VF* d)
+{
+	VI t[8];
+	for(int i=0; i<8; i++) t[i] = _vi(_mm256_castps_si256(d[i].v));
+	_transpose(t);
+	for(int i=0; i<8; i++) d[i] = _vf(_mm256_castsi256_ps(t[i].v));
+}
+
+#include "jpeg_simd_impl.h"
+
+const JpegKernels Kernels =
+{
+	JPEG_SIMD_AVX2, "avx2", 
+	{ convert_bgr, convert_rgb, convert_bgra, convert_rgba, convert_bgra, convert_rgba, _convert_gray, 0, 0 },
+	_level_shift, split_chroma, fdct_quant_islow, fdct_quant_float, fdct_islow, fdct_float, quant_islow, quant_float
+};
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+#endif
+
+#ifdef JPEG_SIMD_ARM
+//-------------------------------------------------------------------------------
+// NEON：与SSE2一样，每个8通道向量由两个128位寄存器组成
+namespace neon {
+
+struct VI { int32x4_t lo, hi; };
+struct VF { float32x4_t lo, hi; };
+
+inline VI _vi(int32x4_t lo, int32x4_t hi) { VI r; r.lo = lo; r.hi = hi; return r; }
+inline VF _vf(float32x4_t lo, float32x4_t hi) { VF r; r.lo = lo; r.hi = hi; return r; }
+
+inline VI operator+(VI a, VI b) { return _vi(vaddq_s32(a.lo, b.lo), vaddq_s32(a.hi, b.hi)); }
+inline VI operator-(VI a, VI b) { return _vi(vsubq_s32(a.lo, b.lo), vsubq_s32(a.hi, b.hi)); }
+inline VI operator*(VI a, VI b) { return _vi(vmulq_s32(a.lo, b.lo), vmulq_s32(a.hi, b.hi)); }
+inline VI operator*(VI a, int c) { return _vi(vmulq_n_s32(a.lo, c), vmulq_n_s32(a.hi, c)); }
+//移位量不是编译期常数，用vshlq，负数表示算术右移
+inline VI _slli(VI a, int n) { int32x4_t k = vdupq_n_s32(n); return _vi(vshlq_s32(a.lo, k), vshlq_s32(a.hi, k)); }
+inline VI _srai(VI a, int n) { int32x4_t k = vdupq_n_s32(-n); return _vi(vshlq_s32(a.lo, k), vshlq_s32(a.hi, k)); }
+inline VI _set_i(int c) { return _vi(vdupq_n_s32(c), vdupq_n_s32(c)); }
+inline VI _load_i(const int* p) { return _vi(vld1q_s32(p), vld1q_s32(p+4)); }
+
+inline VF operator+(VF a, VF b) { return _vf(vaddq_f32(a.lo, b.lo), vaddq_f32(a.hi, b.hi)); }
+inline VF operator-(VF a, VF b) { return _vf(vsubq_f32(a.lo, b.lo), vsubq_f32(a.hi, b.hi)); }
+inline VF operator*(VF a, VF b) { return _vf(vmulq_f32(a.lo, b.lo), vmulq_f32(a.hi, b.hi)); }
+inline VF _set_f(float c) { return _vf(vdupq_n_f32(c), vdupq_n_f32(c)); }
+inline VF _load_f(const float* p) { return _vf(vld1q_f32(p), vld1q_f32(p+4)); }
+inline void _store_f(float* p, VF a) { vst1q_f32(p, a.lo); vst1q_f32(p+4, a.hi); }
+inline VF _to_float(VI a) { return _vf(vcvtq_f32_s32(a.lo), vcvtq_f32_s32(a.hi)); }
+inline VI _trunc(VF a) { return _vi(vcvtq_s32_f32(a.lo), vcvtq_s32_f32(a.hi)); }
+
+inline VI _load_row(const char* p)
+{
+	int16x8_t w = vmovl_s8(vld1_s8((const int8_t*)p));
+	return _vi(vmovl_s16(vget_low_s16(w)), vmovl_s16(vget_high_s16(w)));
+}
+
+inline VI _load_short(const short* p)
+{
+	int16x8_t w = vld1q_s16(p);
+	return _vi(vmovl_s16(vget_low_s16(w)), vmovl_s16(vget_high_s16(w)));
+}
+
+inline void _store_short(short* p, VI a)
+{
+	vst1q_s16(p, vcombine_s16(vqmovn_s32(a.lo), vqmovn_s32(a.hi)));
+}
+
+inline void _store_char(char* p, VI a)
+{
+	vst1_s8((int8_t*)p, vqmovn_s16(vcombine_s16(vqmovn_s32(a.lo), vqmovn_s32(a.hi))));
+}
+
+inline VF _widen_u8(uint8x8_t v)
+{
+	uint16x8_t w = vmovl_u8(v);
+	return _vf(vcvtq_f32_u32(vmovl_u16(vget_low_u16(w))), vcvtq_f32_u32(vmovl_u16(vget_high_u16(w))));
+}
+
+inline void _load_bgr(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	uint8x8x3_t bgr = vld3_u8(p);
+	B = _widen_u8(bgr.val[0]);
+	G = _widen_u8(bgr.val[1]);
+	R = _widen_u8(bgr.val[2]);
+}
+
+inline void _load_bgra(const unsigned char* p, VF& B, VF& G, VF& R)
+{
+	uint8x8x4_t bgra = vld4_u8(p);
+	B = _widen_u8(bgra.val[0]);
+	G = _widen_u8(bgra.val[1]);
+	R = _widen_u8(bgra.val[2]);
+}
+
+inline void _split_chroma_row(const unsigned char* p, char* cb, char* cr)
+{
+	uint8x8x2_t uv = vld2_u8(p);
+	uint8x8_t bias = vdup_n_u8(0x80);
+	vst1_u8((uint8_t*)cb, veor_u8(uv.val[0], bias));
+	vst1_u8((uint8_t*)cr, veor_u8(uv.val[1], bias));
+}
+
+inline void _transpose4(int32x4_t& a, int32x4_t& b, int32x4_t& c, int32x4_t& d)
+{
+	int32x4x2_t ab = vtrnq_s32(a, b);
+	int32x4x2_t cd = vtrnq_s32(c, d);
+	a = vcombine_s32(vget_low_s32(ab.val[0]), vget_low_s32(cd.val[0]));
+	b = vcombine_s32(vget_low_s32(ab.val[1]), vget_low_s32(cd.val[1]));
+	c = vcombine_s32(vget_high_s32(ab.val[0]), vget_high_s32(cd.val[0]));
+	d = vcombine_s32(vget_high_s32(ab.val[1]), vget_high_s32(cd.val[1]));
+}
+
+inline void _transpose(VI* d)
+{
+	_transpose4(d[0].lo, d[1].lo, d[2].lo, d[3].lo);
+	_transpose4(d[0].hi, d[1].hi, d[2].hi, d[3].hi);
+	_transpose4(d[4].lo, d[5].lo, d[6].lo, d[7].lo);
+	_transpose4(d[4].hi, d[5].hi, d[6].hi, d[7].hi);
+	for(int i=0; i<4; i++)
+	{
+		int32x4_t t = d[i].hi;
+		d[i].hi = d[i+4].lo;
+		d[i+4].lo = t;
+	}
+}
+
+inline void _transpose(VF* d)
+{
+	VI t[8];
+	for(int i=0; i<8; i++) t[i] = _vi(vreinterpretq_s32_f32(d[i].lo), vreinterpretq_s32_f32(d[i].hi));
+	_transpose(t);
+	for(int i=0; i<8; i++) d[i] = _vf(vreinterpretq_f32_s32(t[i].lo), vreinterpretq_f32_s32(t[i].hi));
+}
+
+#include "jpeg_simd_impl.h"
+
+const JpegKernels Kernels =
+{
+	JPEG_SIMD_NEON, "neon", 
+	{ convert_bgr, convert_rgb, convert_bgra, convert_rgba, convert_bgra, convert_rgba, _convert_gray, 0, 0 },
+	_level_shift, split_chroma, fdct_quant_islow, fdct_quant_float, fdct_islow, fdct_float, quant_islow, quant_float
+};
+}
+#endif
+
+//-------------------------------------------------------------------------------
+JpegSimdLevel jpeg_detect_simd(void)
+{
+#if defined(JPEG_SIMD_ARM)
+	return JPEG_SIMD_NEON;
+#elif defined(JPEG_SIMD_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int maxId = info[0];
+	__cpuid(info, 1);
+	bool sse2 = ((info[3] >> 26) & 1) != 0;
+	bool osxsave = ((info[2] >> 27) & 1) != 0;
+	bool avx = ((info[2] >> 28) & 1) != 0;
+	//AVX2还需要操作系统保存YMM寄存器
+	if(maxId >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if((info[1] >> 5) & 1) return JPEG_SIMD_AVX2;
+	}
+	if(sse2) return JPEG_SIMD_SSE2;
+	return JPEG_SIMD_SCALAR;
+#elif defined(JPEG_SIMD_X86)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) return JPEG_SIMD_AVX2;
+	if(__builtin_cpu_supports("sse2")) return JPEG_SIMD_SSE2;
+	return JPEG_SIMD_SCALAR;
+#else
+	return JPEG_SIMD_SCALAR;
+#endif
+}
+
+//-------------------------------------------------------------------------------
+const JpegKernels* jpeg_get_kernels(JpegSimdLevel level)
+{
+	switch(level)
+	{
+	case JPEG_SIMD_SCALAR:	return &Scalar_Kernels;
+#ifdef JPEG_SIMD_X86
+	case JPEG_SIMD_SSE2:	return &sse2::Kernels;
+	case JPEG_SIMD_AVX2:	return &avx2::Kernels;
+#endif
+#ifdef JPEG_SIMD_ARM
+	case JPEG_SIMD_NEON:	return &neon::Kernels;
+#endif
+	default:				return 0;
+	}
+}
+
+//-------------------------------------------------------------------------------
+void jpeg_convert_pixel(const unsigned char* p, JpegPixelFormat format, char* yData, char* cbData, char* crData)
+{
+	switch(format)
+	{
+	case JPEG_PIXEL_GRAY:
+		*yData = (char)(p[0] ^ 0x80);
+		*cbData = *crData = 0;
+		break;
+	case JPEG_PIXEL_RGB:
+	case JPEG_PIXEL_RGBA:
+	case JPEG_PIXEL_RGBX:
+		_convert_pixel(p, 2, yData, cbData, crData);
+		break;
+	default:
+		_convert_pixel(p, 0, yData, cbData, crData);
+		break;
+	}
+}
+
+namespace {
+//-------------------------------------------------------------------------------
+// 平坦块快速路径的一维DCT与完整的二维DCT逐位相同，像素包括负数
+bool _self_test_reduced(void)
+{
+	srand(0x4A504547);
+	for(int n=0; n<2000; n++)
+	{
+		char line[8], rows[64], columns[64];
+		for(int i=0; i<8; i++) line[i] = (char)((n%3==0) ? ((i&1) ? 127 : -128) : (rand()%256 - 128));
+		for(int i=0; i<64; i++)
+		{
+			rows[i] = line[i&7];
+			columns[i] = line[i>>3];
+		}
+
+		int full[64], reduced[8];
+		jpeg_fdct_islow(rows, full);
+		jpeg_fdct_islow_row(rows, reduced);
+		for(int i=0; i<64; i++)
+		{
+			if(full[i] != (i<8 ? reduced[i] : 0)) return false;
+		}
+		jpeg_fdct_islow(columns, full);
+		jpeg_fdct_islow_column(columns, reduced);
+		for(int i=0; i<64; i++)
+		{
+			if(full[i] != ((i&7)==0 ? reduced[i>>3] : 0)) return false;
+		}
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+// 用随机数据将一种内核与标量版本对比，种子固定，每种内核单独测试时结果也可以复现
+bool _self_test_kernels(const JpegKernels* ref, const JpegKernels* k)
+{
+	srand(0x4A504547);
+
+	for(int n=0; n<2000; n++)
+	{
+		//颜色空间转换，一行之间留出空隙检验stride
+		unsigned char rgb[8*32];
+		for(int i=0; i<(int)sizeof(rgb); i++) rgb[i] = (unsigned char)((n&1) ? rand() : ((i&1) ? 0xFF : 0));
+
+		for(int format=0; format<JPEG_PIXEL_FORMAT_COUNT; format++)
+		{
+			if(ref->convertColor[format]==0) continue;
+			char y0[64], cb0[64], cr0[64], y1[64], cb1[64], cr1[64];
+			ref->convertColor[format](rgb, 32, y0, cb0, cr0);
+			k->convertColor[format](rgb, 32, y1, cb1, cr1);
+			for(int i=0; i<64; i++)
+			{
+				if(abs(y0[i]-y1[i])>1 || abs(cb0[i]-cb1[i])>1 || abs(cr0[i]-cr1[i])>1) return false;
+			}
+		}
+
+		//NV12的色度拆分，结果必须完全一致
+		{
+			char cb0[64], cr0[64], cb1[64], cr1[64];
+			ref->splitChroma(rgb, 32, cb0, cr0);
+			k->splitChroma(rgb, 32, cb1, cr1);
+			if(memcmp(cb0, cb1, 64)!=0 || memcmp(cr0, cr1, 64)!=0) return false;
+		}
+
+		//DCT+量化，量化表从1到255都要覆盖
+		unsigned char quant[64];
+		for(int i=0; i<64; i++) quant[i] = (unsigned char)(1 + rand()%((n%4==0) ? 2 : 255));
+		JpegQuantDivisors divisors;
+		jpeg_init_divisors(quant, &divisors);
+
+		char block[64];
+		for(int i=0; i<64; i++) block[i] = (char)((n%3==0) ? ((i&1) ? 127 : -128) : (rand()%256 - 128));
+
+		short c0[64], c1[64];
+		ref->fdctQuantIslow(block, c0, &divisors);
+		k->fdctQuantIslow(block, c1, &divisors);
+		for(int i=0; i<64; i++)
+		{
+			if(c0[i]!=c1[i]) return false;
+		}
+
+		ref->fdctQuantFloat(block, c0, &divisors);
+		k->fdctQuantFloat(block, c1, &divisors);
+		for(int i=0; i<64; i++)
+		{
+			if(abs(c0[i]-c1[i])>1) return false;
+		}
+
+		//只做DCT，与DCT+量化一样，定点必须完全一致，浮点允许很小的误差
+		short islow[64], islow1[64];
+		float fdct[64], fdct1[64];
+		ref->fdctIslow(block, islow);
+		k->fdctIslow(block, islow1);
+		if(memcmp(islow, islow1, sizeof(islow))!=0) return false;
+		ref->fdctFloat(block, fdct);
+		k->fdctFloat(block, fdct1);
+		for(int i=0; i<64; i++)
+		{
+			if(fabsf(fdct[i]-fdct1[i]) > 0.01f*(1+fabsf(fdct[i]))) return false;
+		}
+
+		//只量化，输入为同一份DCT输出，整数和浮点都必须完全一致
+
+		ref->quantIslow(islow, c0, &divisors);
+		k->quantIslow(islow, c1, &divisors);
+		if(memcmp(c0, c1, sizeof(c0))!=0) return false;
+
+		ref->quantFloat(fdct, c0, &divisors);
+		k->quantFloat(fdct, c1, &divisors);
+		if(memcmp(c0, c1, sizeof(c0))!=0) return false;
+	}
+	return true;
+}
+}
+
+//-------------------------------------------------------------------------------
+bool jpeg_simd_self_test(void)
+{
+	if(!_self_test_reduced()) return false;
+
+	JpegSimdLevel best = jpeg_detect_simd();
+	for(int level=JPEG_SIMD_SSE2; level<=JPEG_SIMD_NEON; level++)
+	{
+		const JpegKernels* k = jpeg_get_kernels((JpegSimdLevel)level);
+		if(k==0 || level>best) continue;
+		if(!_self_test_kernels(&Scalar_Kernels, k)) return false;
+	}
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+bool jpeg_simd_self_test_level(JpegSimdLevel level)
+{
+	const JpegKernels* k = jpeg_get_kernels(level);
+	if(k==0 || level>jpeg_detect_simd()) return false;
+	return _self_test_reduced() && _self_test_kernels(&Scalar_Kernels, k);
+}
@@ -0,0 +1,126 @@
+#ifndef __JPEG_SIMD_HEADER__
+#define __JPEG_SIMD_HEADER__
+
+#include "jpeg_dct.h"
+#include "jpeg_image.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JPEG_HAVE_SSE2_INLINE
+#endif
+
+// 向量化的计算内核：颜色空间转换、DCT、量化
+// 每种指令集一张函数表，编码器构造时根据CPU支持的最宽指令集选择一次
+
+/** 指令集等级，数值越大越宽 */
+enum JpegSimdLevel
+{
+	JPEG_SIMD_SCALAR,
+	JPEG_SIMD_SSE2,
+	JPEG_SIMD_AVX2,
+	JPEG_SIMD_NEON
+};
+
+/** 将一个8*8的像素块转换为YCbCr，stride为相邻两行的字节差。灰度只写yData */
+typedef void (*JpegConvertFunc)(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData);
+/** 平面中8*8个字节减去128，即YUV平面格式和灰度的"颜色转换" */
+typedef void (*JpegLevelShiftFunc)(const unsigned char* plane, int stride, char* data);
+/** NV12中U、V交错的8*8个色度拆成两块，同时减去128 */
+typedef void (*JpegSplitChromaFunc)(const unsigned char* uv, int stride, char* cbData, char* crData);
+
+/** 一种指令集的内核函数表 */
+struct JpegKernels
+{
+	JpegSimdLevel		level;
+	const char*			name;
+	JpegConvertFunc		convertColor[JPEG_PIXEL_FORMAT_COUNT];	//按像素格式索引，平面格式为0
+	JpegLevelShiftFunc	levelShift;
+	JpegSplitChromaFunc	splitChroma;
+	JpegFdctQuantFunc	fdctQuantIslow;
+	JpegFdctQuantFunc	fdctQuantFloat;
+	JpegFdctIslowFunc	fdctIslow;
+	JpegFdctFloatFunc	fdctFloat;
+	JpegQuantIslowFunc	quantIslow;
+	JpegQuantFloatFunc	quantFloat;
+};
+
+/** 64个系数中非0系数的位图，第i位对应coef[i] */
+inline unsigned long long jpeg_nonzero_mask(const short* coef)
+{
+#ifdef JPEG_HAVE_SSE2_INLINE
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long long zeros = 0;
+	for(int i=0; i<64; i+=16)
+	{
+		__m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(coef + i)), zero);
+		__m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(coef + i + 8)), zero);
+		zeros |= (unsigned long long)(unsigned int)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << i;
+	}
+	return ~zeros;
+#else
+	unsigned long long mask = 0;
+	for(int i=0; i<64; i++)
+	{
+		if(coef[i]) mask |= 1ULL << i;
+	}
+	return mask;
+#endif
+}
+
+/** 颜色转换后的8*8个有符号像素的最大值与最小值之差，sum返回64个像素之和，用来判断平坦的块 */
+inline int jpeg_block_range(const char* data, int* sum)
+{
+#ifdef JPEG_HAVE_SSE2_INLINE
+	//异或0x80之后按无符号数比较和求和，和再减去64*128
+	const __m128i bias = _mm_set1_epi8((char)0x80);
+	__m128i a = _mm_xor_si128(_mm_loadu_si128((const __m128i*)data), bias);
+	__m128i b = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 16)), bias);
+	__m128i c = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 32)), bias);
+	__m128i d = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 48)), bias);
+	__m128i lo = _mm_min_epu8(_mm_min_epu8(a, b), _mm_min_epu8(c, d));
+	__m128i hi = _mm_max_epu8(_mm_max_epu8(a, b), _mm_max_epu8(c, d));
+
+	//最小值取反后与最大值一起折半，最后两个字节分别是最大值和255-最小值
+	lo = _mm_xor_si128(lo, _mm_set1_epi8((char)0xFF));
+	__m128i m = _mm_unpacklo_epi8(hi, lo);
+	m = _mm_max_epu8(m, _mm_unpackhi_epi8(hi, lo));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 8));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 4));
+	m = _mm_max_epu8(m, _mm_srli_si128(m, 2));
+	int packed = _mm_cvtsi128_si32(m);
+
+	const __m128i zero = _mm_setzero_si128();
+	__m128i s = _mm_add_epi64(_mm_add_epi64(_mm_sad_epu8(a, zero), _mm_sad_epu8(b, zero)), 
+		_mm_add_epi64(_mm_sad_epu8(c, zero), _mm_sad_epu8(d, zero)));
+	s = _mm_add_epi64(s, _mm_srli_si128(s, 8));
+	*sum = _mm_cvtsi128_si32(s) - 64*128;
+	return (packed & 0xFF) - (255 - ((packed >> 8) & 0xFF));
+#else
+	int lo = (signed char)data[0], hi = lo, total = 0;
+	for(int i=0; i<64; i++)
+	{
+		int v = (signed char)data[i];
+		if(v < lo) lo = v;
+		if(v > hi) hi = v;
+		total += v;
+	}
+	*sum = total;
+	return hi - lo;
+#endif
+}
+
+/** 转换单个像素，与标量内核的结果一致，用于色度滤波时MCU边界外的零散像素。只支持打包的格式 */
+void jpeg_convert_pixel(const unsigned char* p, JpegPixelFormat format, char* yData, char* cbData, char* crData);
+
+/** 检测当前CPU支持的最宽指令集 */
+JpegSimdLevel jpeg_detect_simd(void);
+
+/** 取得指定指令集的内核函数表，该指令集没有编译进来时返回0 */
+const JpegKernels* jpeg_get_kernels(JpegSimdLevel level);
+
+/** 用随机数据将当前CPU支持的每一种内核与标量版本对比，整数内核要求完全一致，浮点内核允许±1的误差 */
+bool jpeg_simd_self_test(void);
+/** 只对比level这一种内核，标量内核与自身对比，用于在UBSan等检查工具下逐个运行每一种内核。当前CPU不支持时返回false */
+bool jpeg_simd_self_test_level(JpegSimdLevel level);
+
+#endif
@@ -0,0 +1,273 @@
+// 与指令集无关的内核实现，没有头文件保护，由jpeg_simd.cpp在每个指令集的namespace中各包含一次
+// 包含之前需要定义好8个int32的向量类型VI、8个float的向量类型VF，以及下面用到的基本操作
+
+//-------------------------------------------------------------------------------
+inline VI _descale(VI x, int n)
+{
+	return _srai(x + _set_i(1 << (n-1)), n);
+}
+
+//-------------------------------------------------------------------------------
+// Loeffler算法的一维变换，8个向量同时做8次变换，与jpeg_dct.cpp中的标量版本逐位一致
+inline void _fdct_islow_1d(VI* d, int pass)
+{
+	VI tmp0 = d[0] + d[7];
+	VI tmp7 = d[0] - d[7];
+	VI tmp1 = d[1] + d[6];
+	VI tmp6 = d[1] - d[6];
+	VI tmp2 = d[2] + d[5];
+	VI tmp5 = d[2] - d[5];
+	VI tmp3 = d[3] + d[4];
+	VI tmp4 = d[3] - d[4];
+
+	//偶数部分
+	VI tmp10 = tmp0 + tmp3;
+	VI tmp13 = tmp0 - tmp3;
+	VI tmp11 = tmp1 + tmp2;
+	VI tmp12 = tmp1 - tmp2;
+
+	int shift = pass ? (JPEG_CONST_BITS + JPEG_PASS1_BITS) : (JPEG_CONST_BITS - JPEG_PASS1_BITS);
+	if(pass)
+	{
+		d[0] = _descale(tmp10 + tmp11, JPEG_PASS1_BITS);
+		d[4] = _descale(tmp10 - tmp11, JPEG_PASS1_BITS);
+	}
+	else
+	{
+		d[0] = _slli(tmp10 + tmp11, JPEG_PASS1_BITS);
+		d[4] = _slli(tmp10 - tmp11, JPEG_PASS1_BITS);
+	}
+
+	VI z1 = (tmp12 + tmp13) * FIX_0_541196100;
+	d[2] = _descale(z1 + tmp13 * FIX_0_765366865, shift);
+	d[6] = _descale(z1 - tmp12 * FIX_1_847759065, shift);
+
+	//奇数部分
+	z1 = tmp4 + tmp7;
+	VI z2 = tmp5 + tmp6;
+	VI z3 = tmp4 + tmp6;
+	VI z4 = tmp5 + tmp7;
+	VI z5 = (z3 + z4) * FIX_1_175875602;
+
+	tmp4 = tmp4 * FIX_0_298631336;
+	tmp5 = tmp5 * FIX_2_053119869;
+	tmp6 = tmp6 * FIX_3_072711026;
+	tmp7 = tmp7 * FIX_1_501321110;
+	z1 = z1 * -FIX_0_899976223;
+	z2 = z2 * -FIX_2_562915447;
+	z3 = z3 * -FIX_1_961570560 + z5;
+	z4 = z4 * -FIX_0_390180644 + z5;
+
+	d[7] = _descale(tmp4 + z1 + z3, shift);
+	d[5] = _descale(tmp5 + z2 + z4, shift);
+	d[3] = _descale(tmp6 + z2 + z3, shift);
+	d[1] = _descale(tmp7 + z1 + z4, shift);
+}
+
+//-------------------------------------------------------------------------------
+// AAN算法的一维变换
+inline void _fdct_float_1d(VF* d)
+{
+	VF tmp0 = d[0] + d[7];
+	VF tmp7 = d[0] - d[7];
+	VF tmp1 = d[1] + d[6];
+	VF tmp6 = d[1] - d[6];
+	VF tmp2 = d[2] + d[5];
+	VF tmp5 = d[2] - d[5];
+	VF tmp3 = d[3] + d[4];
+	VF tmp4 = d[3] - d[4];
+
+	//偶数部分
+	VF tmp10 = tmp0 + tmp3;
+	VF tmp13 = tmp0 - tmp3;
+	VF tmp11 = tmp1 + tmp2;
+	VF tmp12 = tmp1 - tmp2;
+
+	d[0] = tmp10 + tmp11;
+	d[4] = tmp10 - tmp11;
+
+	VF z1 = (tmp12 + tmp13) * _set_f(0.707106781f);
+	d[2] = tmp13 + z1;
+	d[6] = tmp13 - z1;
+
+	//奇数部分
+	tmp10 = tmp4 + tmp5;
+	tmp11 = tmp5 + tmp6;
+	tmp12 = tmp6 + tmp7;
+
+	VF z5 = (tmp10 - tmp12) * _set_f(0.382683433f);
+	VF z2 = _set_f(0.541196100f) * tmp10 + z5;
+	VF z4 = _set_f(1.306562965f) * tmp12 + z5;
+	VF z3 = tmp11 * _set_f(0.707106781f);
+
+	VF z11 = tmp7 + z3;
+	VF z13 = tmp7 - z3;
+
+	d[5] = z13 + z2;
+	d[3] = z13 - z2;
+	d[1] = z11 + z4;
+	d[7] = z11 - z4;
+}
+
+//-------------------------------------------------------------------------------
+// 量化后的系数先按自然顺序写到临时数组，再按zigzag顺序分散到输出
+inline void _scatter_zigzag(const short* natural, short* coef)
+{
+	for(int i=0; i<64; i++) coef[jpeg_zigzag[i]] = natural[i];
+}
+
+//-------------------------------------------------------------------------------
+// 一个块的二维变换，结果的d[v]为第v行
+inline void _fdct_islow_2d(const char* block, VI* d)
+{
+	for(int y=0; y<8; y++) d[y] = _load_row(block + y*8);
+
+	//先转置再做行变换，这样每个向量的8个通道分别对应8行
+	_transpose(d);
+	_fdct_islow_1d(d, 0);
+	_transpose(d);
+	_fdct_islow_1d(d, 1);
+}
+
+//-------------------------------------------------------------------------------
+inline void _fdct_float_2d(const char* block, VF* d)
+{
+	for(int y=0; y<8; y++) d[y] = _to_float(_load_row(block + y*8));
+
+	_transpose(d);
+	_fdct_float_1d(d);
+	_transpose(d);
+	_fdct_float_1d(d);
+}
+
+//-------------------------------------------------------------------------------
+void fdct_quant_islow(const char* block, short* coef, const JpegQuantDivisors* divisors)
+{
+	VI d[8];
+	_fdct_islow_2d(block, d);
+
+	short natural[64];
+	VI round = _set_i(1<<15);
+	for(int v=0; v<8; v++)
+		_store_short(natural + v*8, _srai(d[v] * _load_i(divisors->recip + v*8) + round, 16));
+
+	_scatter_zigzag(natural, coef);
+}
+
+//-------------------------------------------------------------------------------
+void fdct_quant_float(const char* block, short* coef, const JpegQuantDivisors* divisors)
+{
+	VF d[8];
+	_fdct_float_2d(block, d);
+
+	short natural[64];
+	VF round = _set_f(16384.5f);
+	VI offset = _set_i(16384);
+	for(int v=0; v<8; v++)
+		_store_short(natural + v*8, _trunc(d[v] * _load_f(divisors->fdiv + v*8) + round) - offset);
+
+	_scatter_zigzag(natural, coef);
+}
+
+//-------------------------------------------------------------------------------
+// 只做DCT，不量化，保存下来之后可以用不同的量化表反复量化。
+// 按zigzag顺序保存，重新量化时就不用再重排，每种质量只剩下乘法和舍入
+void fdct_islow(const char* block, short* data)
+{
+	VI d[8];
+	_fdct_islow_2d(block, d);
+
+	short natural[64];
+	for(int v=0; v<8; v++) _store_short(natural + v*8, d[v]);
+	_scatter_zigzag(natural, data);
+}
+
+//-------------------------------------------------------------------------------
+void fdct_float(const char* block, float* data)
+{
+	VF d[8];
+	_fdct_float_2d(block, d);
+
+	float natural[64];
+	for(int v=0; v<8; v++) _store_f(natural + v*8, d[v]);
+	for(int i=0; i<64; i++) data[jpeg_zigzag[i]] = natural[i];
+}
+
+//-------------------------------------------------------------------------------
+// 只量化，舍入方式与fdct_quant_islow、fdct_quant_float的最后一步相同，数据和除数都是zigzag顺序，不用重排
+void quant_islow(const short* data, short* coef, const JpegQuantDivisors* divisors)
+{
+	VI round = _set_i(1<<15);
+	for(int i=0; i<64; i+=8)
+		_store_short(coef + i, _srai(_load_short(data + i) * _load_i(divisors->recipZigzag + i) + round, 16));
+}
+
+//-------------------------------------------------------------------------------
+void quant_float(const float* data, short* coef, const JpegQuantDivisors* divisors)
+{
+	VF round = _set_f(16384.5f);
+	VI offset = _set_i(16384);
+	for(int i=0; i<64; i+=8)
+		_store_short(coef + i, _trunc(_load_f(data + i) * _load_f(divisors->fdivZigzag + i) + round) - offset);
+}
+
+//-------------------------------------------------------------------------------
+// 每行8个像素拆成B、G、R三个向量后计算，RGB顺序的输入只是交换B和R
+inline void _convert_row(VF B, VF G, VF R, char* yData, char* cbData, char* crData)
+{
+	_store_char(yData, _trunc(_set_f(0.299f) * R + _set_f(0.587f) * G + _set_f(0.114f) * B - _set_f(128.f)));
+	_store_char(cbData, _trunc(_set_f(-0.1687f) * R - _set_f(0.3313f) * G + _set_f(0.5f) * B));
+	_store_char(crData, _trunc(_set_f(0.5f) * R - _set_f(0.4187f) * G - _set_f(0.0813f) * B));
+}
+
+//-------------------------------------------------------------------------------
+void convert_bgr(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+	{
+		VF B, G, R;
+		_load_bgr(rgb + y*stride, B, G, R);
+		_convert_row(B, G, R, yData + y*8, cbData + y*8, crData + y*8);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void convert_rgb(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+	{
+		VF B, G, R;
+		_load_bgr(rgb + y*stride, R, G, B);
+		_convert_row(B, G, R, yData + y*8, cbData + y*8, crData + y*8);
+	}
+}
+
+//-------------------------------------------------------------------------------
+// 4字节的像素，第4个字节(A或X)不使用
+void convert_bgra(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+	{
+		VF B, G, R;
+		_load_bgra(rgb + y*stride, B, G, R);
+		_convert_row(B, G, R, yData + y*8, cbData + y*8, crData + y*8);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void convert_rgba(const unsigned char* rgb, int stride, char* yData, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+	{
+		VF B, G, R;
+		_load_bgra(rgb + y*stride, R, G, B);
+		_convert_row(B, G, R, yData + y*8, cbData + y*8, crData + y*8);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void split_chroma(const unsigned char* uv, int stride, char* cbData, char* crData)
+{
+	for(int y=0; y<8; y++)
+		_split_chroma_row(uv + (long long)y*stride, cbData + y*8, crData + y*8);
+}
@@ -0,0 +1,105 @@
+#ifndef __JPEG_STATS_HEADER__
+#define __JPEG_STATS_HEADER__
+
+#include <chrono>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define JPEG_HAS_RDTSC
+#elif defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define JPEG_HAS_RDTSC
+#endif
+
+// 编码过程的统计。默认编译进来，开销是每块几次加法，以及平均每JPEG_STATS_SAMPLE_INTERVAL个MCU读几次时间戳计数器；
+// 编译时定义JPEG_NO_STATS则统计代码完全去掉，JpegEncodeStats中的数据都为0
+#ifndef JPEG_NO_STATS
+#define JPEG_STATS(statement) statement
+#else
+#define JPEG_STATS(statement)
+#endif
+
+/** 逐个MCU交替进行的几个阶段，平均每这么多个MCU测量一次耗时，乘以这个数作为估计值。
+ *  读时间戳计数器本身要几纳秒到几十纳秒(虚拟机中)，每个MCU都读的话开销与颜色转换相当 */
+const int JPEG_STATS_SAMPLE_INTERVAL = 16;
+
+/** 第index个MCU是否测量耗时。用乘法散列打乱抽样的位置，避免总是抽到每行开头等固定位置的MCU */
+inline bool jpeg_stats_sampled(int index)
+{
+	return (((unsigned int)index * 2654435761u) >> 28) == 0;
+}
+
+/** 时间戳计数器，x86上为TSC的周期数，其他平台为纳秒 */
+inline unsigned long long jpeg_cycles(void)
+{
+#ifdef JPEG_HAS_RDTSC
+	return __rdtsc();
+#else
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/** 一次编码的统计 */
+struct JpegEncodeStats
+{
+	//各阶段的周期数(jpeg_cycles)，多线程编码时是所有线程之和。颜色转换、DCT和基线的熵编码是抽样估计的
+	long long	colorCycles;		//颜色转换和色度抽样，包括边缘MCU的复制
+	long long	dctCycles;			//DCT和量化
+	long long	entropyCycles;		//霍夫曼编码(包括两遍编码时统计符号、渐进式的所有扫描)，不包括输出回调
+	long long	outputCycles;		//输出回调中的时间，即写文件、写内存等
+	//整个编码从开始到结束的周期数和纳秒数，用来换算
+	long long	totalCycles;
+	long long	totalNs;
+
+	//每个分量(Y、Cb、Cr)的DC和AC用了多少位，包括附加位，不包括0xFF后补的0和字节对齐。渐进式编码不统计
+	long long	dcBits[3];
+	long long	acBits[3];
+	long long	stuffedBytes;		//0xFF后面补的0x00的个数
+	long long	eobCount;			//EOB符号
+	long long	zrlCount;			//ZRL(16个0)符号
+	long long	blocks;				//编码的块数
+	long long	zeroBlocks;			//AC系数全为0的块
+	long long	flatBlocks;			//颜色转换后判断为平坦、跳过DCT直接算出DC的块
+	long long	reducedBlocks;		//只有一个方向有变化、只做一维DCT的块
+	long long	bytes;				//输出的字节数
+
+	JpegEncodeStats() { reset(); }
+
+	void reset(void)
+	{
+		colorCycles = dctCycles = entropyCycles = outputCycles = totalCycles = totalNs = 0;
+		for(int i=0; i<3; i++) dcBits[i] = acBits[i] = 0;
+		stuffedBytes = eobCount = zrlCount = blocks = zeroBlocks = flatBlocks = reducedBlocks = bytes = 0;
+	}
+
+	/** 累加另一个线程的统计，不包括总时间 */
+	void add(const JpegEncodeStats& other)
+	{
+		colorCycles += other.colorCycles;
+		dctCycles += other.dctCycles;
+		entropyCycles += other.entropyCycles;
+		outputCycles += other.outputCycles;
+		for(int i=0; i<3; i++)
+		{
+			dcBits[i] += other.dcBits[i];
+			acBits[i] += other.acBits[i];
+		}
+		stuffedBytes += other.stuffedBytes;
+		eobCount += other.eobCount;
+		zrlCount += other.zrlCount;
+		blocks += other.blocks;
+		zeroBlocks += other.zeroBlocks;
+		flatBlocks += other.flatBlocks;
+		reducedBlocks += other.reducedBlocks;
+		bytes += other.bytes;
+	}
+
+	/** 把周期数按整个编码的周期与时间之比换算为纳秒 */
+	double nanoseconds(long long cycles) const
+	{
+		return totalCycles>0 ? (double)cycles * totalNs / totalCycles : 0;
+	}
+};
+
+#endif
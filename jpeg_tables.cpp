@@ -0,0 +1,230 @@
+#include <string.h>
+#include <atomic>
+#include <mutex>
+
+#include "jpeg_tables.h"
+
+namespace {
+//-------------------------------------------------------------------------------
+//标准亮度量化表 8*8，存储为一维形式
+const unsigned char Luminance_Quantization_Table[64] = 
+{
+	16,  11,  10,  16,  24,  40,  51,  61,
+	12,  12,  14,  19,  26,  58,  60,  55,
+	14,  13,  16,  24,  40,  57,  69,  56,
+	14,  17,  22,  29,  51,  87,  80,  62,
+	18,  22,  37,  56,  68, 109, 103,  77,
+	24,  35,  55,  64,  81, 104, 113,  92,
+	49,  64,  78,  87, 103, 121, 120, 101,
+	72,  92,  95,  98, 112, 100, 103,  99
+};
+
+//-------------------------------------------------------------------------------
+//标准色差量化表 8*8，存储为一维形式
+const unsigned char Chrominance_Quantization_Table[64] = 
+{
+	17,  18,  24,  47,  99,  99,  99,  99,
+	18,  21,  26,  66,  99,  99,  99,  99,
+	24,  26,  56,  99,  99,  99,  99,  99,
+	47,  66,  99,  99,  99,  99,  99,  99,
+	99,  99,  99,  99,  99,  99,  99,  99,
+	99,  99,  99,  99,  99,  99,  99,  99,
+	99,  99,  99,  99,  99,  99,  99,  99,
+	99,  99,  99,  99,  99,  99,  99,  99
+};
+
+//-------------------------------------------------------------------------------
+//判断平坦块时给DCT的舍入误差留出的余量，单位为islow输出的系数，实际误差不超过2
+const int FLAT_ROUNDING_MARGIN = 8;
+
+//-------------------------------------------------------------------------------
+// 编码是对量化后的一维数组，进行编码。
+//编码流程是：1.先使用行程编码，按照0的个数，若一个数字y前有x个零，则编码为(X,Y)则一维数组的第一个值直流DC部分的值为(0,Y)。
+//2.对Y进行编码，采用的是JPEG提供的一张标准码表。编码后会产生一个长度信息Z加上长度信息个的编码位
+//3.将X和Z合并成一个十六进制形式M。
+//4.此时再分别用到直流部分的编码表和交流部分的编码表（长度可能更大），分别对直流部分的M和交流部分的M进行编码。
+
+
+//这里是亮度分量的DC部分的M的编码信息。第一个数组表示编码长度为数组索引号+1的被编码值的个数
+constexpr char Standard_DC_Luminance_NRCodes[] = { 0, 0, 7, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+//这个矩阵表示的是亮度分量的DC部分的M的值出现的频率由高到低排列，同时也对应着上面一个数组的编码长度递增的顺序。即此数组中的前7个元素用3个位进行编码，再其次的后面1个元素用4个位进行编码
+constexpr unsigned char Standard_DC_Luminance_Values[] = { 4, 5, 3, 2, 6, 1, 0, 7, 8, 9, 10, 11 };
+
+//-------------------------------------------------------------------------------
+//这两个数组于上面两个数组类似，只不过对应的是色度分量的DC部分
+constexpr char Standard_DC_Chrominance_NRCodes[] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+constexpr unsigned char Standard_DC_Chrominance_Values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+//-------------------------------------------------------------------------------
+//这两个数组也与上面两个数组类似，只不过对应的是亮度分量的交流部分
+constexpr char Standard_AC_Luminance_NRCodes[] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+constexpr unsigned char Standard_AC_Luminance_Values[] = 
+{
+	0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12,
+	0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+	0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+	0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16,
+	0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39,
+	0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+	0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+	0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79,
+	0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98,
+	0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+	0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+	0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+	0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+//-------------------------------------------------------------------------------
+//这两个数组也与上面两个数组类似，只不过对应的是色度分量的交流部分
+constexpr char Standard_AC_Chrominance_NRCodes[] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+constexpr unsigned char Standard_AC_Chrominance_Values[] =
+{
+	0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21,
+	0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+	0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+	0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34,
+	0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38,
+	0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+	0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+	0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78,
+	0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96,
+	0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+	0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+	0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2,
+	0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+	0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+	0xf9, 0xfa
+};
+
+//-------------------------------------------------------------------------------
+constexpr void _set_spec(JpegHuffmanSpec& spec, const char* nr_codes, const unsigned char* values, int valueCount)
+{
+	for(int i=0; i<16; i++) spec.nrCodes[i] = nr_codes[i];
+	for(int i=0; i<valueCount; i++) spec.values[i] = values[i];
+	spec.valueCount = valueCount;
+}
+
+//-------------------------------------------------------------------------------
+constexpr JpegHuffmanTables _make_std_huffman_tables(void)
+{
+	JpegHuffmanTables tables = {};
+	_set_spec(tables.specs[0], Standard_DC_Luminance_NRCodes, Standard_DC_Luminance_Values, sizeof(Standard_DC_Luminance_Values));
+	_set_spec(tables.specs[1], Standard_AC_Luminance_NRCodes, Standard_AC_Luminance_Values, sizeof(Standard_AC_Luminance_Values));
+	_set_spec(tables.specs[2], Standard_DC_Chrominance_NRCodes, Standard_DC_Chrominance_Values, sizeof(Standard_DC_Chrominance_Values));
+	_set_spec(tables.specs[3], Standard_AC_Chrominance_NRCodes, Standard_AC_Chrominance_Values, sizeof(Standard_AC_Chrominance_Values));
+	jpeg_build_huffman_tables(tables);
+	return tables;
+}
+
+//-------------------------------------------------------------------------------
+//按质量缓存的表格，生成之后不再修改也不释放，读取时不需要加锁
+std::atomic<const JpegQualityTables*> Quality_Cache[100];
+std::mutex Quality_Mutex;
+
+//-------------------------------------------------------------------------------
+//像素都在[m-r/2, m+r/2]中的块，每个AC系数都不超过标准DCT的4r，islow的输出为它的8倍即32r。
+//定点量化的结果为0要求输出乘以倒数小于1<<15，浮点量化要求系数除以步长小于0.5即32r < 4q，
+//两个条件都满足并且再留出DCT本身的舍入误差时，不管用哪种DCT，所有AC系数都量化为0
+int _flat_range(const unsigned char* table, const JpegQuantDivisors* divisors)
+{
+	int limit = 0x7FFFFFFF;
+	for(int i=1; i<64; i++)
+	{
+		int q = table[jpeg_zigzag[i]];
+		int islow = ((1<<15) - 1) / divisors->recip[i];
+		if(islow < limit) limit = islow;
+		if(4*q < limit) limit = 4*q;
+	}
+	limit -= FLAT_ROUNDING_MARGIN;
+	return limit>0 ? limit / 32 : 0;
+}
+
+//-------------------------------------------------------------------------------
+//table为zigzag顺序，第1~63个为AC
+float _trellis_scale(const unsigned char* table)
+{
+	float sum = 0;
+	for(int i=1; i<64; i++) sum += (float)table[i] * table[i];
+	return sum / 63;
+}
+
+//-------------------------------------------------------------------------------
+void _build_quality_tables(int quality_scale, JpegQualityTables* tables)
+{
+	tables->quality = quality_scale;
+
+	//8*8的量化系数
+	for(int i=0; i<64; i++)
+	{	
+		//将量化系数矩阵展开成一维数组（从左上->右下，锯齿形排列）
+		int temp = ((int)(Luminance_Quantization_Table[i] * quality_scale + 50) / 100);
+		if (temp<=0) temp = 1;
+		if (temp>0xFF) temp = 0xFF;
+		tables->yTable[jpeg_zigzag[i]] = (unsigned char)temp;
+		temp = ((int)(Chrominance_Quantization_Table[i] * quality_scale + 50) / 100);
+		if (temp<=0) 	temp = 1;
+		if (temp>0xFF) temp = 0xFF;
+		tables->cbcrTable[jpeg_zigzag[i]] = (unsigned char)temp;
+	}
+
+	//量化除数表
+	jpeg_init_divisors(tables->yTable, &tables->yDivisors);
+	jpeg_init_divisors(tables->cbcrTable, &tables->cbcrDivisors);
+	tables->yFlatRange = _flat_range(tables->yTable, &tables->yDivisors);
+	tables->cbcrFlatRange = _flat_range(tables->cbcrTable, &tables->cbcrDivisors);
+	tables->trellisScale = _trellis_scale(tables->yTable);
+
+	//DQT
+	unsigned char* p = tables->dqt;
+	p[0] = 0xFF;						//marker = 0xFFDB
+	p[1] = 0xDB;
+	p[2] = 0;							//size=132
+	p[3] = 132;
+	p[4] = 0;							//QTYinfo== 0:  bit 0..3: number of QT = 0 (table for Y) 
+										//				bit 4..7: precision of QT
+										//				bit 8	: 0
+	memcpy(p + 5, tables->yTable, 64);	//YTable
+	p[69] = 1;							//QTCbinfo = 1 (quantization table for Cb,Cr)
+	memcpy(p + 70, tables->cbcrTable, 64);	//CbCrTable
+}
+}
+
+//-------------------------------------------------------------------------------
+constexpr JpegHuffmanTables jpeg_std_huffman_tables = _make_std_huffman_tables();
+
+//-------------------------------------------------------------------------------
+const JpegQualityTables* jpeg_get_quality_tables(int quality_scale)
+{
+	if(quality_scale<=0) quality_scale=1;
+	if(quality_scale>=100) quality_scale=99;
+
+	const JpegQualityTables* tables = Quality_Cache[quality_scale].load(std::memory_order_acquire);
+	if(tables) return tables;
+
+	//第一次用到这个质量，加锁后再检查一次，避免两个线程同时生成
+	std::lock_guard<std::mutex> lock(Quality_Mutex);
+	tables = Quality_Cache[quality_scale].load(std::memory_order_relaxed);
+	if(tables==0)
+	{
+		JpegQualityTables* created = new JpegQualityTables;
+		_build_quality_tables(quality_scale, created);
+		Quality_Cache[quality_scale].store(created, std::memory_order_release);
+		tables = created;
+	}
+	return tables;
+}
@@ -0,0 +1,106 @@
+#ifndef __JPEG_TABLES_HEADER__
+#define __JPEG_TABLES_HEADER__
+
+#include "jpeg_dct.h"
+
+// 编码器用到的只读表格。标准霍夫曼表在编译期生成，与质量有关的表按质量缓存，
+// 所有编码器实例共享同一份，不必各自保存和计算
+
+/** 霍夫曼码字，length表示位长度，value为码字 */
+struct JpegHuffmanCode
+{
+	int length;
+	int value;
+};
+
+/** DHT段中的一张表：每种码长的码字个数，以及按码长从短到长排列的符号 */
+struct JpegHuffmanSpec
+{
+	char			nrCodes[16];
+	unsigned char	values[256];
+	int				valueCount;
+};
+
+/** 一套完整的霍夫曼表，四张表依次为亮度DC、亮度AC、色度DC、色度AC */
+struct JpegHuffmanTables
+{
+	JpegHuffmanSpec		specs[4];
+	//由specs生成、按符号索引的码表，DC表只用到前12项
+	JpegHuffmanCode		codes[4][256];
+	//序列化好的DHT段，包括标记和长度
+	unsigned char		dht[4 + 4*17 + 2*12 + 2*256];
+	int					dhtSize;
+};
+
+/** 由specs生成codes和dht，编译期和运行时都可以使用 */
+constexpr void jpeg_build_huffman_tables(JpegHuffmanTables& tables)
+{
+	for(int t=0; t<4; t++)
+	{
+		const JpegHuffmanSpec& spec = tables.specs[t];
+		JpegHuffmanCode* codes = tables.codes[t];
+		for(int i=0; i<256; i++)
+		{
+			codes[i].length = 0;
+			codes[i].value = 0;
+		}
+
+		//同样长度的码字依次加1，长度增加一位时左移一位
+		int pos = 0, code = 0;
+		for(int k=1; k<=16; k++)
+		{
+			for(int j=0; j<spec.nrCodes[k-1]; j++)
+			{
+				codes[spec.values[pos]].value = code;
+				codes[spec.values[pos]].length = k;
+				pos++;
+				code++;
+			}
+			code <<= 1;
+		}
+	}
+
+	//DHT
+	const unsigned char info[4] = { 0x00, 0x10, 0x01, 0x11 };	//bit 0..3: number of HT, bit 4: 0 = DC table, 1 = AC table
+	unsigned char* p = tables.dht;
+	int n = 4;
+	for(int t=0; t<4; t++)
+	{
+		const JpegHuffmanSpec& spec = tables.specs[t];
+		p[n++] = info[t];
+		for(int i=0; i<16; i++) p[n++] = (unsigned char)spec.nrCodes[i];
+		for(int i=0; i<spec.valueCount; i++) p[n++] = spec.values[i];
+	}
+	p[0] = 0xFF;					//marker = 0xFFC4
+	p[1] = 0xC4;
+	p[2] = (unsigned char)((n-2) >> 8);	//length, 0x01A2 for the standard tables
+	p[3] = (unsigned char)((n-2) & 0xFF);
+	tables.dhtSize = n;
+}
+
+/** JPEG标准附录K中的霍夫曼表，编译期生成 */
+extern const JpegHuffmanTables jpeg_std_huffman_tables;
+
+/** 由质量决定的所有表格 */
+struct JpegQualityTables
+{
+	int					quality;
+	//亮度和色差的量化表，zigzag顺序
+	unsigned char		yTable[64];
+	unsigned char		cbcrTable[64];
+	//量化表与DCT缩放因子合并后的除数表
+	JpegQuantDivisors	yDivisors;
+	JpegQuantDivisors	cbcrDivisors;
+	//颜色转换后最大值与最小值之差不超过这个数的块，所有AC系数量化后一定为0，可以跳过DCT只算DC
+	int					yFlatRange;
+	int					cbcrFlatRange;
+	//亮度量化表AC部分步长平方的平均值，trellis量化的lambda乘以它作为每一位的代价，亮度和色度使用同一个值
+	float				trellisScale;
+	//序列化好的DQT段，包括标记和长度
+	unsigned char		dqt[4 + 2*65];
+};
+
+/** 取得指定质量(1~99，超出范围时取边界值)的表格。第一次用到某个质量时生成，之后一直保留，多线程可以同时调用 */
+const JpegQualityTables* jpeg_get_quality_tables(int quality_scale);
+
+#endif
@@ -0,0 +1,201 @@
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#define JPEG_HAS_PAUSE
+#elif defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define JPEG_HAS_PAUSE
+#endif
+
+#include "jpeg_thread_pool.h"
+
+namespace {
+//-------------------------------------------------------------------------------
+//JpegSpscRing等待时先自旋这么多次，之后每次都让出时间片
+const int SPIN_COUNT = 64;
+
+//-------------------------------------------------------------------------------
+void _spin_wait(int& spins)
+{
+	if(spins < SPIN_COUNT)
+	{
+		spins++;
+#ifdef JPEG_HAS_PAUSE
+		_mm_pause();
+#endif
+	}
+	else
+	{
+		std::this_thread::yield();
+	}
+}
+
+}
+
+//-------------------------------------------------------------------------------
+JpegThreadPool::JpegThreadPool(int threadCount)
+	: m_generation(0)
+	, m_active(0)
+	, m_quit(false)
+	, m_task(0)
+	, m_workerTask(0)
+	, m_context(0)
+	, m_count(0)
+	, m_next(0)
+	, m_ranges(threadCount>1 ? threadCount : 1)
+{
+	for(int i=1; i<threadCount; i++)
+		m_threads.push_back(std::thread(&JpegThreadPool::_workerMain, this, i));
+}
+
+//-------------------------------------------------------------------------------
+JpegThreadPool::~JpegThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+
+	for(size_t i=0; i<m_threads.size(); i++) m_threads[i].join();
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::parallelFor(int count, JpegTaskFunc task, void* context)
+{
+	if(count<=0) return;
+
+	//没有工作线程或者只有一个任务时直接在当前线程执行
+	if(m_threads.empty() || count==1)
+	{
+		for(int i=0; i<count; i++) task(context, i);
+		return;
+	}
+
+	m_task = task;
+	m_workerTask = 0;
+	m_context = context;
+	_start(count);
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::parallelForStealing(int count, JpegWorkerTaskFunc task, void* context)
+{
+	if(count<=0) return;
+
+	if(m_threads.empty() || count==1)
+	{
+		for(int i=0; i<count; i++) task(context, i, 0);
+		return;
+	}
+
+	//每个线程分到连续的一段
+	int threads = threadCount();
+	for(int i=0; i<threads; i++)
+	{
+		m_ranges[i].next = (int)((long long)i * count / threads);
+		m_ranges[i].end = (int)((long long)(i+1) * count / threads);
+	}
+
+	m_task = 0;
+	m_workerTask = task;
+	m_context = context;
+	_start(count);
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::_start(int count)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_count = count;
+		m_next = 0;
+		m_active = (int)m_threads.size();
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	_runTasks(0);
+	_wait();
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::_wait(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(m_active > 0) m_done.wait(lock);
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::_runTasks(int worker)
+{
+	if(m_workerTask)
+	{
+		//先做自己的一段，再依次从后面的线程的段中窃取，取任务的方式相同，都是从段的开头取
+		int threads = threadCount();
+		for(int k=0; k<threads; k++)
+		{
+			Range& range = m_ranges[(worker + k) % threads];
+			for(;;)
+			{
+				int index = range.next++;
+				if(index >= range.end) break;
+				m_workerTask(m_context, index, worker);
+			}
+		}
+		return;
+	}
+
+	for(;;)
+	{
+		int index = m_next++;
+		if(index >= m_count) break;
+		m_task(m_context, index);
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegThreadPool::_workerMain(int worker)
+{
+	unsigned int seen = 0;
+	for(;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while(!m_quit && m_generation==seen) m_wake.wait(lock);
+			if(m_quit) return;
+			seen = m_generation;
+		}
+
+		_runTasks(worker);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(--m_active == 0) m_done.notify_all();
+	}
+}
+
+//-------------------------------------------------------------------------------
+void JpegSpscRing::reset(int capacity)
+{
+	m_capacity = capacity>0 ? capacity : 1;
+	m_pushed.store(0, std::memory_order_relaxed);
+	m_popped.store(0, std::memory_order_relaxed);
+}
+
+//-------------------------------------------------------------------------------
+long long JpegSpscRing::waitSpace(void)
+{
+	//m_pushed只有生产者自己写，m_popped的acquire保证消费者已经用完了要覆盖的元素
+	long long pushed = m_pushed.load(std::memory_order_relaxed);
+	int spins = 0;
+	while(pushed - m_popped.load(std::memory_order_acquire) >= m_capacity) _spin_wait(spins);
+	return pushed;
+}
+
+//-------------------------------------------------------------------------------
+long long JpegSpscRing::waitItem(void)
+{
+	long long popped = m_popped.load(std::memory_order_relaxed);
+	int spins = 0;
+	while(m_pushed.load(std::memory_order_acquire) <= popped) _spin_wait(spins);
+	return popped;
+}
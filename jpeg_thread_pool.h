@@ -0,0 +1,100 @@
+#ifndef __JPEG_THREAD_POOL_HEADER__
+#define __JPEG_THREAD_POOL_HEADER__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+/** 任务回调，index为任务序号 */
+typedef void (*JpegTaskFunc)(void* context, int index);
+/** 带线程序号的任务回调，worker在0..threadCount-1之间，0为调用parallelFor的线程，可以用来索引每个线程各自的数据 */
+typedef void (*JpegWorkerTaskFunc)(void* context, int index, int worker);
+
+// 固定数量的工作线程，用于把一批相互独立的任务分给多个核心执行
+class JpegThreadPool
+{
+public:
+	/** threadCount为参与计算的线程总数，包括调用parallelFor的线程 */
+	explicit JpegThreadPool(int threadCount);
+	~JpegThreadPool();
+
+	int threadCount(void) const { return (int)m_threads.size() + 1; }
+
+	/** 并行执行task(context, 0..count-1)，调用线程也参与计算，全部完成后返回。同一时间只能有一个调用者 */
+	void parallelFor(int count, JpegTaskFunc task, void* context);
+
+	/** 与parallelFor相同，但任务先按线程数平均分成连续的几段，每个线程先做自己的那一段，
+	 *  做完之后再从其他线程的段中窃取。适合数量很多、耗时不均的小任务 */
+	void parallelForStealing(int count, JpegWorkerTaskFunc task, void* context);
+
+private:
+	void _workerMain(int worker);
+	void _runTasks(int worker);
+	void _start(int count);
+	void _wait(void);
+
+private:
+	std::vector<std::thread>	m_threads;
+	std::mutex					m_mutex;
+	std::condition_variable		m_wake;
+	std::condition_variable		m_done;
+	unsigned int				m_generation;	//每次parallelFor加1，用来唤醒工作线程
+	int							m_active;		//还没有完成当前这一批任务的工作线程数
+	bool						m_quit;
+
+	JpegTaskFunc				m_task;
+	JpegWorkerTaskFunc			m_workerTask;
+	void*						m_context;
+	int							m_count;
+	std::atomic<int>			m_next;
+
+	//parallelForStealing中每个线程的一段任务，各占一个缓存行，避免线程之间互相干扰
+	struct Range
+	{
+		std::atomic<int>	next;
+		int					end;
+		char				padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+	};
+	std::vector<Range>			m_ranges;
+
+private:
+	JpegThreadPool(const JpegThreadPool&);
+	JpegThreadPool& operator=(const JpegThreadPool&);
+};
+
+// 单生产者、单消费者的无锁环形队列，只管理序号，元素由调用者按 序号%capacity 存放在自己的数组中。
+// 生产者和消费者各自只写一个计数器，用acquire/release同步，不加锁。
+// 等待时先自旋一会儿，再让出时间片，适合两边都在不停工作、很少真正等待的流水线
+class JpegSpscRing
+{
+public:
+	JpegSpscRing() : m_capacity(1), m_pushed(0), m_popped(0) {}
+
+	/** 清空队列，capacity为元素个数。只能在生产者和消费者都没有使用时调用 */
+	void reset(int capacity);
+
+	/** 生产者：等到有空位，返回下一个元素的序号，写好元素后调用push */
+	long long waitSpace(void);
+	void push(void) { m_pushed.store(m_pushed.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+	/** 消费者：等到有元素，返回最早的元素的序号，用完后调用pop */
+	long long waitItem(void);
+	void pop(void) { m_popped.store(m_popped.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+private:
+	//两个计数器由不同的线程写，各占一个缓存行
+	int						m_capacity;
+	char					m_padding0[64 - sizeof(int)];
+	std::atomic<long long>	m_pushed;
+	char					m_padding1[64 - sizeof(std::atomic<long long>)];
+	std::atomic<long long>	m_popped;
+	char					m_padding2[64 - sizeof(std::atomic<long long>)];
+
+private:
+	JpegSpscRing(const JpegSpscRing&);
+	JpegSpscRing& operator=(const JpegSpscRing&);
+};
+
+#endif
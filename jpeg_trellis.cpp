@@ -0,0 +1,83 @@
+#include "jpeg_trellis.h"
+#include "jpeg_bitwriter.h"
+
+//-------------------------------------------------------------------------------
+void jpeg_trellis_quantize(const float* scaled, short* coef, const unsigned char* quant_table, 
+	const JpegHuffmanCode* acCodes, float lambda)
+{
+	//每个系数的失真权重：步长的平方，乘上之后就是像素的误差平方和
+	float weight[64];
+	for(int i=1; i<64; i++) weight[i] = (float)quant_table[i] * quant_table[i];
+
+	//zeroDist[i]为第1~i个系数全部量化为0时的失真之和
+	float zeroDist[64];
+	zeroDist[0] = 0;
+	for(int i=1; i<64; i++) zeroDist[i] = zeroDist[i-1] + scaled[i]*scaled[i]*weight[i];
+
+	//cost[i]：第i个系数是最后一个非0系数时，第1~i个系数的最小代价，level[i]为这时第i个系数的值，
+	//prev[i]为它前面的一个非0系数(0表示前面全为0)。只有四舍五入后非0的位置才可能是非0系数
+	float cost[64];
+	short level[64];
+	int prev[64];
+	int active[64];
+	int activeCount = 1;
+	cost[0] = 0;
+	active[0] = 0;
+
+	int zrlLength = acCodes[0xF0].length;
+	for(int i=1; i<64; i++)
+	{
+		if(coef[i]==0) continue;
+
+		//候选值：四舍五入的结果，以及绝对值小1的值(不为0时)，改成0的情况由跳过这个位置表示
+		int candidates[2];
+		int candidateCount = 0;
+		candidates[candidateCount++] = coef[i];
+		if(coef[i] > 1) candidates[candidateCount++] = coef[i] - 1;
+		else if(coef[i] < -1) candidates[candidateCount++] = coef[i] + 1;
+
+		cost[i] = 1e30f;
+		for(int c=0; c<candidateCount; c++)
+		{
+			int value = candidates[c];
+			int size = jpeg_bit_length(value<0 ? -value : value);
+			float diff = scaled[i] - value;
+			float dist = diff*diff*weight[i];
+
+			for(int a=0; a<activeCount; a++)
+			{
+				int j = active[a];
+				int run = i - j - 1;
+				int codeLength = acCodes[((run & 15) << 4) | size].length;
+				if(codeLength==0) continue;
+
+				int bits = (run >> 4) * zrlLength + codeLength + size;
+				float candidate = cost[j] + (zeroDist[i-1] - zeroDist[j]) + dist + lambda * bits;
+				if(candidate < cost[i])
+				{
+					cost[i] = candidate;
+					level[i] = (short)value;
+					prev[i] = j;
+				}
+			}
+		}
+		if(cost[i] < 1e30f) active[activeCount++] = i;
+	}
+
+	//选择最后一个非0系数的位置，之后的系数都为0，不到第63个时要加上EOB
+	int last = 0;
+	float best = 1e30f;
+	for(int a=0; a<activeCount; a++)
+	{
+		int j = active[a];
+		float total = cost[j] + (zeroDist[63] - zeroDist[j]) + (j<63 ? lambda * acCodes[0x00].length : 0);
+		if(total < best)
+		{
+			best = total;
+			last = j;
+		}
+	}
+
+	for(int i=1; i<64; i++) coef[i] = 0;
+	for(int i=last; i>0; i=prev[i]) coef[i] = level[i];
+}
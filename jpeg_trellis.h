@@ -0,0 +1,18 @@
+#ifndef __JPEG_TRELLIS_HEADER__
+#define __JPEG_TRELLIS_HEADER__
+
+#include "jpeg_tables.h"
+
+// 率失真优化的量化(trellis量化)。普通的量化对每个系数单独四舍五入，这里对一个块的所有AC系数一起选择，
+// 使 失真 + lambda*位数 最小：有时把一个系数改小1、甚至改成0，失真略有增加，
+// 但游程变长、附加位变少或者提前EOB，能省下更多的位
+
+/** 优化一个块的AC系数，DC不变。
+ *  scaled为未量化的系数除以量化步长(zigzag顺序)，coef输入为四舍五入的结果，输出为优化后的结果。
+ *  失真为这个块的像素误差平方和(DCT是正交变换，等于(scaled - 结果)^2 * 步长^2之和)，没有归一化；
+ *  位数按acCodes中的码长计算，包括ZRL、EOB和附加位。lambda为每一位相当的误差平方和，
+ *  同一幅图像的所有块应该使用同一个尺度，见JpegEncoder::_quantizeBlock */
+void jpeg_trellis_quantize(const float* scaled, short* coef, const unsigned char* quant_table, 
+	const JpegHuffmanCode* acCodes, float lambda);
+
+#endif
@@ -1,5 +1,285 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
 #include "jpeg_encoder.h"
+#include "jpeg_batch.h"
+#include "jpeg_sequence.h"
+#include "jpeg_pyramid.h"
+
+//-------------------------------------------------------------------------------
+// 把同一幅图像编码count次，测试批量编码的吞吐量
+static int _batch_test(const char* inputFileName, int count, int threads)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+
+	//每个任务一个固定大小的输出缓冲区，编码过程中不分配内存
+	const JpegImageView& view = bmp.view();
+	int capacity = view.width * view.height * 3 + 1024;
+	std::vector<unsigned char> buffers((size_t)capacity * count);
+	std::vector<JpegBufferOutput> outputs;
+	std::vector<JpegBatchJob> jobs(count);
+	for(int i=0; i<count; i++) outputs.push_back(JpegBufferOutput(&buffers[(size_t)capacity * i], capacity));
+	for(int i=0; i<count; i++)
+	{
+		jobs[i].input = view;
+		jobs[i].quality = 50;
+		jobs[i].output = &outputs[i];
+	}
+
+	JpegBatchEncoder batch(threads);
+
+	//第一遍预热，不计入统计
+	batch.encode(&jobs[0], count);
+	batch.resetStats();
+	for(int i=0; i<count; i++) outputs[i].reset();
+
+	int successed = batch.encode(&jobs[0], count);
+	const JpegBatchStats& stats = batch.stats();
+	printf("threads=%d images=%lld failed=%lld %.1f images/s input %.1f MB/s output %.1f MB/s\n", 
+		batch.threadCount(), stats.images, stats.failed, stats.imagesPerSecond(), stats.inputMBPerSecond(), stats.outputMBPerSecond());
+	return successed==count ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 模拟屏幕录制：每帧只有一个移动的小方块改变，比较序列编码与逐帧直接编码的速度，并检查输出是否相同
+static int _sequence_test(const char* inputFileName, int frames, int restartInterval)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+
+	const JpegImageView& view = bmp.view();
+	int width = view.width, height = view.height, stride = width * jpeg_pixel_size(view.format);
+	std::vector<unsigned char> frame((size_t)stride * height);
+	for(int y=0; y<height; y++) memcpy(&frame[(size_t)y * stride], view.pixels + (long long)y * view.stride, stride);
+
+	JpegEncoder encoder;
+	JpegSequenceEncoder sequence;
+	encoder.setRestartInterval(restartInterval);
+	sequence.setRestartInterval(restartInterval);
+	std::vector<unsigned char> expected, actual;
+	double directSeconds = 0;
+	int mismatches = 0;
+
+	for(int i=0; i<frames; i++)
+	{
+		//32*32的方块沿对角线移动，颜色每帧不同
+		int size = 32;
+		int x0 = (i * 7) % (width > size ? width - size : 1), y0 = (i * 5) % (height > size ? height - size : 1);
+		for(int y=y0; y<y0+size && y<height; y++)
+			for(int x=x0; x<x0+size && x<width; x++)
+				memset(&frame[(size_t)y * stride + x * jpeg_pixel_size(view.format)], (i * 37) & 0xFF, jpeg_pixel_size(view.format));
+
+		expected.clear();
+		JpegVectorOutput directOutput(expected);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		encoder.encode(&frame[0], width, height, stride, view.format, 50, directOutput);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		directSeconds += elapsed.count();
+
+		actual.clear();
+		JpegVectorOutput sequenceOutput(actual);
+		if(!sequence.encodeFrame(&frame[0], width, height, stride, view.format, 50, sequenceOutput) || actual!=expected) mismatches++;
+	}
+
+	const JpegSequenceStats& stats = sequence.stats();
+	printf("frames=%d hit rate %.1f%% direct %.1f frames/s sequence %.1f frames/s speedup %.2fx mismatches=%d\n", 
+		frames, stats.hitRate() * 100, directSeconds>0 ? frames/directSeconds : 0, stats.framesPerSecond(),
+		stats.seconds>0 ? directSeconds/stats.seconds : 0, mismatches);
+	return mismatches==0 ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 瓦片只数个数，不保存
+static bool _count_tile(void* context, int level, int column, int row, const unsigned char* data, int size)
+{
+	(void)context; (void)level; (void)column; (void)row; (void)data; (void)size;
+	return true;
+}
+
+//-------------------------------------------------------------------------------
+// 生成整个瓦片金字塔，测试每秒编码的瓦片数
+static int _pyramid_test(const char* inputFileName, int tileSize, int threads)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+
+	JpegPyramidEncoder pyramid(threads);
+	if(!pyramid.setTileSize(tileSize, 1)) return 1;
+
+	bool successed = pyramid.encode(bmp.view(), 50, _count_tile, 0);
+	const JpegPyramidStats& stats = pyramid.stats();
+	printf("threads=%d levels=%d tiles=%lld failed=%lld output %lld bytes %.1f ms %.1f tiles/s\n", threads, stats.levels, 
+		stats.tiles, stats.failed, stats.outputBytes, stats.seconds * 1000, stats.seconds>0 ? stats.tiles/stats.seconds : 0);
+	return successed ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 同一幅图像输出几种质量：逐个质量直接编码，与做一次DCT之后重新量化比较速度，并检查输出是否相同
+static int _variants_test(const char* inputFileName)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+
+	const JpegImageView& view = bmp.view();
+	const int qualities[] = { 10, 30, 50, 70, 90 };
+	const int count = sizeof(qualities) / sizeof(qualities[0]);
+
+	JpegEncoder encoder;
+	std::vector<unsigned char> expected[count], actual;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+	{
+		JpegVectorOutput output(expected[i]);
+		if(!encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, qualities[i], output)) return 1;
+	}
+	std::chrono::duration<double> direct = std::chrono::steady_clock::now() - start;
+
+	start = std::chrono::steady_clock::now();
+	JpegDctStore store;
+	if(!encoder.transform(view.pixels, view.width, view.height, view.stride, view.format, store)) return 1;
+	int mismatches = 0;
+	for(int i=0; i<count; i++)
+	{
+		actual.clear();
+		JpegVectorOutput output(actual);
+		if(!encoder.encodeCoefficients(store, qualities[i], output) || actual!=expected[i]) mismatches++;
+	}
+	std::chrono::duration<double> reused = std::chrono::steady_clock::now() - start;
+
+	printf("variants=%d coefficients %.1f MB direct %.1f ms reused %.1f ms speedup %.2fx mismatches=%d\n", count, 
+		store.bytes() / 1048576.0, direct.count() * 1000, reused.count() * 1000, 
+		reused.count()>0 ? direct.count()/reused.count() : 0, mismatches);
+	return mismatches==0 ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 同一幅图像分别用stdio和异步输出写到文件count次，比较耗时并检查文件是否相同
+static int _write_test(const char* inputFileName, const char* outputFileName, int count, bool direct)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+	const JpegImageView& view = bmp.view();
+
+	JpegEncoder encoder;
+	std::vector<unsigned char> expected, actual;
+
+	//stdio：编码线程在fwrite的缓冲区满时直接写文件
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+	{
+		FILE* fp = fopen(outputFileName, "wb");
+		if(fp==0) return 1;
+		JpegFileOutput output(fp);
+		bool successed = encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, output);
+		if(fclose(fp)!=0 || !successed) return 1;
+	}
+	std::chrono::duration<double> stdioTime = std::chrono::steady_clock::now() - start;
+	{
+		JpegVectorOutput output(expected);
+		encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, output);
+	}
+
+	//异步输出
+	JpegAsyncFileOutput& file = encoder.fileOutput();
+	file.setDirectIo(direct);
+	double stall = 0;
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+	{
+		if(!file.open(outputFileName)) return 1;
+		bool successed = encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, file);
+		if(!file.close() || !successed) return 1;
+		stall += file.stallSeconds();
+	}
+	std::chrono::duration<double> asyncTime = std::chrono::steady_clock::now() - start;
+
+	FILE* fp = fopen(outputFileName, "rb");
+	if(fp==0) return 1;
+	actual.resize(expected.size() + 1);
+	actual.resize(fread(&actual[0], 1, actual.size(), fp));
+	fclose(fp);
+
+	const char* backends[] = { "none", "io_uring", "thread" };
+	printf("files=%d bytes=%d stdio %.1f ms async(%s%s) %.1f ms stall %.1f ms same=%d\n", count, (int)expected.size(), 
+		stdioTime.count() * 1000, backends[file.backend()], file.directIo() ? ",direct" : "", asyncTime.count() * 1000, 
+		stall * 1000, actual==expected);
+	return actual==expected ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 同一幅图像分别用单线程和流水线编码count次，比较速度并检查输出是否相同
+static int _pipeline_test(const char* inputFileName, int count, int threads)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+	const JpegImageView& view = bmp.view();
+
+	JpegEncoder encoder;
+	std::vector<unsigned char> expected, actual;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+	{
+		expected.clear();
+		JpegVectorOutput output(expected);
+		if(!encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, output)) return 1;
+	}
+	std::chrono::duration<double> serial = std::chrono::steady_clock::now() - start;
+
+	encoder.setThreadCount(threads);
+	encoder.setPipelined(true);
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<count; i++)
+	{
+		actual.clear();
+		JpegVectorOutput output(actual);
+		if(!encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, output)) return 1;
+	}
+	std::chrono::duration<double> pipelined = std::chrono::steady_clock::now() - start;
+
+	printf("threads=%d images=%d serial %.1f ms pipelined %.1f ms speedup %.2fx same=%d\n", threads, count, 
+		serial.count() * 1000, pipelined.count() * 1000, pipelined.count()>0 ? serial.count()/pipelined.count() : 0, 
+		actual==expected);
+	return actual==expected ? 0 : 1;
+}
+
+//-------------------------------------------------------------------------------
+// 同一幅图像分别关闭和打开平坦块的快速路径编码count次，比较速度并检查输出是否相同
+static int _fast_blocks_test(const char* inputFileName, int count)
+{
+	JpegBmpFile bmp;
+	if(!bmp.open(inputFileName)) return 1;
+	const JpegImageView& view = bmp.view();
+
+	JpegEncoder encoder;
+	std::vector<unsigned char> expected, actual;
+	//两种方式交替运行，各取最快的一次，减少其他进程的干扰
+	double seconds[2] = { 0, 0 };
+	for(int i=0; i<count; i++)
+	{
+		for(int fast=0; fast<2; fast++)
+		{
+			encoder.setFastBlocks(fast!=0);
+			std::vector<unsigned char>& buffer = fast ? actual : expected;
+			buffer.clear();
+			JpegVectorOutput output(buffer);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if(!encoder.encode(view.pixels, view.width, view.height, view.stride, view.format, 50, output)) return 1;
+			double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if(i==0 || elapsed<seconds[fast]) seconds[fast] = elapsed;
+		}
+	}
+
+	const JpegEncodeStats& stats = encoder.stats();
+	printf("blocks=%lld flat=%.1f%% reduced=%.1f%% off %.1f ms on %.1f ms speedup %.2fx same=%d\n", stats.blocks, 
+		stats.blocks ? stats.flatBlocks * 100.0 / stats.blocks : 0, stats.blocks ? stats.reducedBlocks * 100.0 / stats.blocks : 0, 
+		seconds[0] * 1000, seconds[1] * 1000, seconds[1]>0 ? seconds[0]/seconds[1] : 0, actual==expected);
+	return actual==expected ? 0 : 1;
+}
 
 //-------------------------------------------------------------------------------
 int main(int argc, char* argv[])
@@ -7,9 +287,86 @@ int main(int argc, char* argv[])
 	if(argc<2)
 	{
 		printf("Usage: %s inputFile\n\tInput file must be 24bit bitmap file.\n", argv[0]);
+		printf("       %s -selftest [scalar|sse2|avx2|neon]\n\tCheck every SIMD kernel, or only the given one, against the scalar one.\n", argv[0]);
+		printf("       %s -batch inputFile [count] [threads]\n\tEncode the file count times with a batch encoder and report throughput.\n", argv[0]);
+		printf("       %s -sequence inputFile [frames] [restartInterval]\n\tEncode a simulated screen capture with the frame cache and report the hit rate.\n", argv[0]);
+		printf("       %s -pyramid inputFile [tileSize] [threads]\n\tEncode a tile pyramid of the file and report throughput.\n", argv[0]);
+		printf("       %s -variants inputFile\n\tEncode the file at several qualities from one DCT pass and compare with direct encoding.\n", argv[0]);
+		printf("       %s -write inputFile outputFile [count] [direct]\n\tWrite the encoded file count times through stdio and through the async output and compare.\n", argv[0]);
+		printf("       %s -pipeline inputFile [count] [threads]\n\tEncode the file count times on one thread and with the pipelined encoder and compare.\n", argv[0]);
+		printf("       %s -fastblocks inputFile [count]\n\tEncode the file count times without and with the flat block fast paths, report the best times and compare.\n", argv[0]);
 		return 1;
 	}
 
+	if(strcmp(argv[1], "-selftest")==0)
+	{
+		if(argc>2)
+		{
+			//只测试指定名字的一种内核
+			for(int level=JPEG_SIMD_SCALAR; level<=JPEG_SIMD_NEON; level++)
+			{
+				const JpegKernels* kernels = jpeg_get_kernels((JpegSimdLevel)level);
+				if(kernels==0 || strcmp(kernels->name, argv[2])!=0) continue;
+
+				bool passed = jpeg_simd_self_test_level((JpegSimdLevel)level);
+				printf("simd=%s self test %s\n", kernels->name, passed ? "passed" : "FAILED");
+				return passed ? 0 : 1;
+			}
+			printf("simd level %s is not available\n", argv[2]);
+			return 1;
+		}
+
+		bool passed = jpeg_simd_self_test();
+		printf("simd=%s self test %s\n", jpeg_get_kernels(jpeg_detect_simd())->name, passed ? "passed" : "FAILED");
+		return passed ? 0 : 1;
+	}
+
+	if(strcmp(argv[1], "-batch")==0 && argc>2)
+	{
+		int count = argc>3 ? atoi(argv[3]) : 1000;
+		int threads = argc>4 ? atoi(argv[4]) : 4;
+		return _batch_test(argv[2], count>0 ? count : 1, threads);
+	}
+
+	if(strcmp(argv[1], "-sequence")==0 && argc>2)
+	{
+		int frames = argc>3 ? atoi(argv[3]) : 100;
+		int restartInterval = argc>4 ? atoi(argv[4]) : 0;
+		return _sequence_test(argv[2], frames>0 ? frames : 1, restartInterval);
+	}
+
+	if(strcmp(argv[1], "-pyramid")==0 && argc>2)
+	{
+		int tileSize = argc>3 ? atoi(argv[3]) : 256;
+		int threads = argc>4 ? atoi(argv[4]) : 4;
+		return _pyramid_test(argv[2], tileSize, threads);
+	}
+
+	if(strcmp(argv[1], "-variants")==0 && argc>2)
+	{
+		return _variants_test(argv[2]);
+	}
+
+	if(strcmp(argv[1], "-write")==0 && argc>3)
+	{
+		int count = argc>4 ? atoi(argv[4]) : 10;
+		bool direct = argc>5 && atoi(argv[5])!=0;
+		return _write_test(argv[2], argv[3], count>0 ? count : 1, direct);
+	}
+
+	if(strcmp(argv[1], "-pipeline")==0 && argc>2)
+	{
+		int count = argc>3 ? atoi(argv[3]) : 10;
+		int threads = argc>4 ? atoi(argv[4]) : 3;
+		return _pipeline_test(argv[2], count>0 ? count : 1, threads>1 ? threads : 2);
+	}
+
+	if(strcmp(argv[1], "-fastblocks")==0 && argc>2)
+	{
+		int count = argc>3 ? atoi(argv[3]) : 10;
+		return _fast_blocks_test(argv[2], count>0 ? count : 1);
+	}
+
 	const char* inputFileName = argv[1];
 
 	JpegEncoder encoder;